@@ -193,7 +193,8 @@ HL_PRIM varray *HL_NAME(result_get_fields)( sqlite_result *r ) {
 	int i;
 	for (i = 0; i < r->ncols; i++)
 	{
-		hl_aptr(a, vbyte*)[i] = (vbyte *)sqlite3_column_name16(r->r, i);
+		const uchar *name = (const uchar *)sqlite3_column_name16(r->r, i);
+		hl_aptr(a, vbyte*)[i] = name ? hl_intern(name, (int)ustrlen(name), NULL) : NULL;
 	}
 
 	return a;
@@ -0,0 +1,18 @@
+
+@:result(11136000)
+class BytesBlit {
+
+	public static function main() {
+		var src = haxe.io.Bytes.alloc(256);
+		for( i in 0...256 )
+			src.set(i, i);
+		var dst = haxe.io.Bytes.alloc(256);
+		var tot = 0;
+		for( k in 0...10000000 ) {
+			dst.blit(k & 127, src, (k >> 4) & 127, 1 + (k & 15));
+			tot = (tot * 31 + dst.get(k & 127)) & 0xFFFFFF;
+		}
+		Benchs.result(tot);
+	}
+
+}
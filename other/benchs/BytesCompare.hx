@@ -0,0 +1,14 @@
+
+@:result(2489864)
+class BytesCompare {
+
+	public static function main() {
+		var keys = [for( i in 0...256 ) haxe.io.Bytes.ofString("key_" + (i * 7919 % 1000))];
+		var count = 0;
+		for( k in 0...5000000 )
+			if( keys[k & 255].compare(keys[(k >> 8) & 255]) < 0 )
+				count++;
+		Benchs.result(count);
+	}
+
+}
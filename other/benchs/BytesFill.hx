@@ -0,0 +1,15 @@
+
+@:result(12069225)
+class BytesFill {
+
+	public static function main() {
+		var b = haxe.io.Bytes.alloc(64);
+		var tot = 0;
+		for( k in 0...10000000 ) {
+			b.fill(k & 31, 1 + (k & 15), k & 255);
+			tot = (tot * 31 + b.get((k * 7) & 63)) & 0xFFFFFF;
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,31 @@
+@:result(44191876)
+class BytesFind {
+
+	static function haystack( len : Int ) {
+		var seed = 1;
+		var b = new StringBuf();
+		for( i in 0...len ) {
+			seed = seed * 1103515245 + 12345;
+			b.addChar(97 + ((seed >>> 16) % 26));
+		}
+		return b.toString();
+	}
+
+	public static function main() {
+		var tot = 0;
+		for( size in [64, 1024, 65536] ) {
+			var hay = haystack(size);
+			for( nlen in [1, 4, 16, 64] ) {
+				if( nlen >= size ) continue;
+				var last = hay.substr(size - nlen);
+				var first = hay.substr(0, nlen);
+				for( i in 0...Std.int(4000000 / size) ) {
+					tot += hay.indexOf(last);
+					tot += hay.lastIndexOf(first);
+				}
+			}
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,115 @@
+#if hl
+typedef NativeConcurrentMap = hl.Abstract<"hl_int_cmap">;
+#else
+typedef NativeConcurrentMap = LockedMap;
+#end
+
+// reference : a single lock around a regular map
+class LockedMap {
+
+	var lock = new sys.thread.Mutex();
+	var map = new haxe.ds.IntMap<Int>();
+
+	public function new() {
+	}
+
+	public function set( k : Int, v : Int ) {
+		lock.acquire();
+		map.set(k, v);
+		lock.release();
+	}
+
+	public function get( k : Int ) : Null<Int> {
+		lock.acquire();
+		var v = map.get(k);
+		lock.release();
+		return v;
+	}
+
+}
+
+@:result(11249998)
+class ConcurrentMap {
+
+	static inline var KEYS = 100000;
+	static inline var OPS = 1000000;
+
+	#if hl
+	@:hlNative("std","hicalloc") static function alloc() : NativeConcurrentMap { return null; }
+	@:hlNative("std","hicset") static function set( m : NativeConcurrentMap, k : Int, v : Dynamic ) : Void {}
+	@:hlNative("std","hicget") static function get( m : NativeConcurrentMap, k : Int ) : Dynamic { return null; }
+	#else
+	static function alloc() return new LockedMap();
+	static function set( m : NativeConcurrentMap, k : Int, v : Int ) m.set(k, v);
+	static function get( m : NativeConcurrentMap, k : Int ) return m.get(k);
+	#end
+
+	// read-heavy mix : one write for 15 reads
+	static function runSharded( m : NativeConcurrentMap, id : Int, ops : Int ) {
+		var x = id * 7919 + 1;
+		var hits = 0;
+		for( i in 0...ops ) {
+			x = x * 1664525 + 1013904223;
+			var k = (x >>> 8) % KEYS;
+			if( x & 15 == 0 )
+				set(m, k, k);
+			else if( get(m, k) == k )
+				hits++;
+		}
+		return hits;
+	}
+
+	static function runLocked( m : LockedMap, id : Int, ops : Int ) {
+		var x = id * 7919 + 1;
+		var hits = 0;
+		for( i in 0...ops ) {
+			x = x * 1664525 + 1013904223;
+			var k = (x >>> 8) % KEYS;
+			if( x & 15 == 0 )
+				m.set(k, k);
+			else if( m.get(k) == k )
+				hits++;
+		}
+		return hits;
+	}
+
+	// same operations split between 1 to 32 threads
+	static function sweep( name : String, run : Int -> Int -> Int ) {
+		var total = 0;
+		var count = 1;
+		while( count <= 32 ) {
+			var done = new sys.thread.Lock();
+			var mutex = new sys.thread.Mutex();
+			var hits = 0;
+			var ops = Std.int(OPS / count);
+			var t0 = haxe.Timer.stamp();
+			for( id in 0...count )
+				sys.thread.Thread.create(function() {
+					var h = run(id, ops);
+					mutex.acquire();
+					hits += h;
+					mutex.release();
+					done.release();
+				});
+			for( id in 0...count )
+				done.wait();
+			Sys.stderr().writeString(name + " " + count + " threads : " + Std.int((haxe.Timer.stamp() - t0) * 1000) + "ms\n");
+			total += hits;
+			count *= 2;
+		}
+		return total;
+	}
+
+	public static function main() {
+		var m = alloc();
+		var l = new LockedMap();
+		for( k in 0...KEYS ) {
+			set(m, k, k);
+			l.set(k, k);
+		}
+		var total = sweep("sharded", runSharded.bind(m));
+		total += sweep("mutex", runLocked.bind(l));
+		Benchs.result(total);
+	}
+
+}
@@ -0,0 +1,16 @@
+@:result(62178289)
+class FloatToString {
+
+	static inline var COUNT = 2000000;
+
+	public static function main() {
+		var tot = 0;
+		for( i in 0...COUNT ) {
+			tot += Std.string(i / 7).length;
+			tot += Std.string(i * 0.001).length;
+			tot += Std.string(i).length;
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,18 @@
+@:result(2000000)
+class Intern {
+
+	@:hlNative("std","string_intern") static function intern( b : hl.Bytes, len : Int ) : hl.Bytes {
+		return null;
+	}
+
+	public static function main() {
+		var tot = 0;
+		var canon = [for( i in 0...64 ) { var s = "key" + i; @:privateAccess intern(s.bytes, s.length); }];
+		for( i in 0...2000000 ) {
+			var s = "key" + (i & 63);
+			if( @:privateAccess intern(s.bytes, s.length) == canon[i & 63] ) tot++;
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,47 @@
+@:result(1778143)
+class Maps {
+
+	static inline var N = 200000;
+
+	public static function main() {
+		var tot = 0;
+		var objs = [for( i in 0...N ) { v : i }];
+		for( round in 0...5 ) {
+			var im = new haxe.ds.IntMap<Int>();
+			for( i in 0...N )
+				im.set(i * 7, i);
+			for( i in 0...N ) {
+				var v = im.get(i * 7 + (i & 1));
+				if( v != null ) tot = (tot + (v & 15)) & 0xFFFFFF;
+			}
+			for( i in 0...N >> 1 )
+				im.remove(i * 14);
+			for( k in im.keys() )
+				tot = (tot + k) & 0xFFFFFF;
+
+			var sm = new haxe.ds.StringMap<Int>();
+			for( i in 0...N >> 2 )
+				sm.set("k" + i, i);
+			for( i in 0...N >> 2 ) {
+				var v = sm.get("k" + (i * 2));
+				if( v != null ) tot = (tot + v) & 0xFFFFFF;
+			}
+			for( i in 0...N >> 2 )
+				if( i % 3 == 0 ) sm.remove("k" + i);
+			for( v in sm )
+				tot = (tot + v) & 0xFFFFFF;
+
+			var om = new haxe.ds.ObjectMap<{ v : Int },Int>();
+			for( o in objs )
+				om.set(o, o.v);
+			for( o in objs )
+				tot = (tot + om.get(o)) & 0xFFFFFF;
+			for( o in objs )
+				if( o.v & 1 == 0 ) om.remove(o);
+			for( v in om )
+				tot = (tot + v) & 0xFFFFFF;
+		}
+		Benchs.result(tot);
+	}
+
+}
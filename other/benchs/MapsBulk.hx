@@ -0,0 +1,42 @@
+#if hl
+typedef NativeIntMap = hl.Abstract<"hl_int_map">;
+#end
+
+@:result(12800768)
+class MapsBulk {
+
+	static inline var N = 10000000;
+
+	#if hl
+	@:hlNative("std","hialloc") static function alloc() : NativeIntMap { return null; }
+	@:hlNative("std","hireserve") static function reserve( m : NativeIntMap, count : Int ) : Void {}
+	@:hlNative("std","hiset") static function set( m : NativeIntMap, k : Int, v : Dynamic ) : Void {}
+	@:hlNative("std","hinext") static function next( m : NativeIntMap, pos : Int ) : Int { return 0; }
+	@:hlNative("std","hikeyat") static function keyAt( m : NativeIntMap, pos : Int ) : Int { return 0; }
+	@:hlNative("std","hivalueat") static function valueAt( m : NativeIntMap, pos : Int ) : Dynamic { return null; }
+	#end
+
+	public static function main() {
+		var tot = 0;
+		#if hl
+		var m = alloc();
+		reserve(m, N);
+		for( i in 0...N )
+			set(m, i * 3, i);
+		var c = next(m, 0);
+		while( c >= 0 ) {
+			var v : Int = valueAt(m, c);
+			tot = (tot + keyAt(m, c) + v) & 0xFFFFFF;
+			c = next(m, c + 1);
+		}
+		#else
+		var m = new haxe.ds.IntMap<Int>();
+		for( i in 0...N )
+			m.set(i * 3, i);
+		for( k => v in m )
+			tot = (tot + k + v) & 0xFFFFFF;
+		#end
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,18 @@
+@:result(2000000)
+class ParseNumbers {
+
+	static inline var COUNT = 100000;
+
+	public static function main() {
+		var floats = [for( i in 0...COUNT ) i + "." + (i % 1000)];
+		var ints = [for( i in 0...COUNT ) Std.string(i)];
+		var tot = 0;
+		for( k in 0...10 )
+			for( i in 0...COUNT ) {
+				if( Std.int(Std.parseFloat(floats[i])) == i ) tot++;
+				if( Std.parseInt(ints[i]) == i ) tot++;
+			}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,32 @@
+@:result(266670)
+class Regexp {
+
+	@:hlNative("std","regexp_match_all") static function matchAll( r : hl.Abstract<"ereg">, s : hl.Bytes, pos : Int, len : Int, max : Int, groups : Bool ) : hl.NativeArray<Int> {
+		return null;
+	}
+
+	public static function main() {
+		var b = new StringBuf();
+		var levels = ["INFO", "WARN", "ERROR", "DEBUG"];
+		for( i in 0...20000 ) {
+			b.add('2024-01-${10 + i % 20} 12:${10 + i % 50}:${10 + i % 49} [${levels[i & 3]}] request ');
+			b.add(i % 3 == 0 ? 'from 10.0.${i % 256}.${i % 7} ok' : 'id=$i done');
+			b.add("\n");
+		}
+		var text = b.toString();
+		var lines = text.split("\n");
+		lines.pop();
+		var line = ~/^(\d+-\d+-\d+) (\d+:\d+:\d+) \[(\w+)\] (.*)$/;
+		var ip = ~/\b\d{1,3}\.\d{1,3}\.\d{1,3}\.\d{1,3}\b/;
+		var tot = 0;
+		for( round in 0...10 ) {
+			for( l in lines )
+				if( line.match(l) && line.matched(3).length > 0 )
+					tot++;
+			var m = matchAll(@:privateAccess ip.r, @:privateAccess text.bytes, 0, text.length, 0, false);
+			tot += m.length >> 1;
+		}
+		Benchs.result(tot);
+	}
+
+}
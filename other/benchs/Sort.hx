@@ -0,0 +1,31 @@
+@:result(7999992)
+class Sort {
+
+	@:hlNative("std","bsort_native_i32") static function sortNative( b : hl.Bytes, pos : Int, len : Int, desc : Bool, threads : Int ) : Void {
+	}
+
+	public static function main() {
+		var tot = 0;
+		var n = 1000000;
+		var seed = 1;
+		for( round in 0...4 ) {
+			var a = [];
+			var b = new hl.Bytes(n * 4);
+			for( i in 0...n ) {
+				seed = seed * 1103515245 + 12345;
+				var v = (seed >>> 8) % 100000;
+				a.push(v);
+				b.setI32(i << 2, v);
+			}
+			a.sort(Reflect.compare);
+			sortNative(b, 0, n, round & 1 == 1, 1 + round);
+			for( i in 1...n ) {
+				if( a[i - 1] <= a[i] ) tot++;
+				var x = b.getI32((i - 1) << 2), y = b.getI32(i << 2);
+				if( round & 1 == 1 ? x >= y : x <= y ) tot++;
+			}
+		}
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,36 @@
+@:result(32917424)
+class StringCase {
+
+	@:hlNative("std","ucs2_icompare") static function icompare( a : hl.Bytes, apos : Int, b : hl.Bytes, bpos : Int, len : Int ) : Int {
+		return 0;
+	}
+
+	static function text( len : Int ) {
+		var seed = 1;
+		var b = new StringBuf();
+		for( i in 0...len ) {
+			seed = seed * 1103515245 + 12345;
+			var r = (seed >>> 16) % 53;
+			b.addChar(r < 26 ? 97 + r : r < 52 ? 65 + r - 26 : 32);
+		}
+		return b.toString();
+	}
+
+	public static function main() {
+		var tot = 0;
+		var len = 4096;
+		var src = text(len);
+		var other = src.substr(0, len - 1) + "~";
+		for( i in 0...200000 ) {
+			var lo = src.toLowerCase();
+			var up = src.toUpperCase();
+			tot += lo.charCodeAt(i % len) + up.charCodeAt((i * 7) % len);
+			@:privateAccess {
+				if( icompare(lo.bytes, 0, up.bytes, 0, len) == 0 ) tot++;
+				tot += icompare(src.bytes, 0, other.bytes, 0, len);
+			}
+		}
+		Benchs.result(tot);
+	}
+
+}
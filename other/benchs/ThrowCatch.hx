@@ -0,0 +1,27 @@
+@:result(15385152)
+class ThrowCatch {
+
+	static function deep( n : Int, v : Int ) : Int {
+		if( n == 0 ) throw v;
+		return deep(n - 1, v) + 1;
+	}
+
+	static function run( depth : Int ) : Int {
+		if( depth > 0 )
+			return run(depth - 1);
+		var tot = 0;
+		for( k in 0...2000000 ) {
+			try {
+				tot += deep(k & 15, k);
+			} catch( e : Int ) {
+				tot = (tot * 31 + e) & 0xFFFFFF;
+			}
+		}
+		return tot;
+	}
+
+	public static function main() {
+		Benchs.result(run(100));
+	}
+
+}
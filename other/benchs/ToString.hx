@@ -0,0 +1,17 @@
+@:result(34499900)
+class ToString {
+
+	static function make( depth : Int, id : Int ) : { v : Int, f : Float, name : String, l : Dynamic, r : Dynamic } {
+		if( depth == 0 ) return null;
+		return { v : id, f : id * 0.5, name : "n" + id, l : make(depth - 1, id * 2), r : make(depth - 1, id * 2 + 1) };
+	}
+
+	public static function main() {
+		var tot = 0;
+		var tree = make(15, 1);
+		for( i in 0...20 )
+			tot += Std.string(tree).length;
+		Benchs.result(tot);
+	}
+
+}
@@ -0,0 +1,22 @@
+@:result(11248140)
+class ToStringNested {
+
+	static function tree( depth : Int, id : Int ) : Dynamic {
+		if( depth == 0 ) return { id : id };
+		return { a : tree(depth - 1, id * 4), b : tree(depth - 1, id * 4 + 1), c : tree(depth - 1, id * 4 + 2), d : tree(depth - 1, id * 4 + 3) };
+	}
+
+	public static function main() {
+		var tot = 0;
+		var chain : Dynamic = null;
+		for( i in 0...5000 )
+			chain = { v : i, next : chain };
+		for( i in 0...50 )
+			tot += Std.string(chain).length;
+		var wide = tree(7, 1);
+		for( i in 0...20 )
+			tot += Std.string(wide).length;
+		Benchs.result(tot);
+	}
+
+}
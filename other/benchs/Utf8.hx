@@ -0,0 +1,26 @@
+@:result(142000000)
+class Utf8 {
+
+	static var CORPORA = [
+		"The quick brown fox jumps over the lazy dog, again and again. ",
+		"Le cœur déçu mais l'âme plutôt naïve, Louÿs rêva de crapaüter. ",
+		"敏捷的棕色狐狸跳过了懒狗。我们的数据在这里传输。",
+	];
+
+	public static function main() {
+		var tot = 0;
+		for( text in CORPORA ) {
+			var buf = new StringBuf();
+			for( i in 0...2000 )
+				buf.add(text);
+			var str = buf.toString();
+			for( i in 0...200 ) {
+				var bytes = haxe.io.Bytes.ofString(str);
+				tot += bytes.length;
+				tot += bytes.toString().length;
+			}
+		}
+		Benchs.result(tot);
+	}
+
+}
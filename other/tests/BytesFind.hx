@@ -0,0 +1,107 @@
+class BytesFind {
+
+	@:hlNative("std","bytes_find16") static function find16( where : hl.Bytes, pos : Int, len : Int, which : hl.Bytes, wpos : Int, wlen : Int ) : Int {
+		return 0;
+	}
+
+	@:hlNative("std","bytes_rfind16") static function rfind16( where : hl.Bytes, len : Int, which : hl.Bytes, wlen : Int ) : Int {
+		return 0;
+	}
+
+	@:hlNative("std","bytes_find_any16") static function findAny16( where : hl.Bytes, pos : Int, len : Int, set : hl.Bytes, count : Int ) : Int {
+		return 0;
+	}
+
+	@:hlNative("std","bytes_offset") static function offset( b : hl.Bytes, delta : Int ) : hl.Bytes {
+		return null;
+	}
+
+	// reference searches : byte lengths, only even offsets are UCS2 chars
+	static function refFind( s : hl.Bytes, len : Int, p : hl.Bytes, plen : Int ) {
+		var i = 0;
+		while( i + plen <= len ) {
+			if( s.compare(i, p, 0, plen) == 0 )
+				return i;
+			i += 2;
+		}
+		return -1;
+	}
+
+	static function refRFind( s : hl.Bytes, len : Int, p : hl.Bytes, plen : Int ) {
+		if( plen > len ) return -1;
+		var i = len - plen;
+		while( i >= 0 ) {
+			if( s.compare(i, p, 0, plen) == 0 )
+				return i;
+			i -= 2;
+		}
+		return -1;
+	}
+
+	static function refFindAny( s : hl.Bytes, len : Int, set : hl.Bytes, count : Int ) {
+		var i = 0;
+		while( i + 2 <= len ) {
+			var c = s.getUI16(i);
+			for( k in 0...count )
+				if( set.getUI16(k << 1) == c )
+					return i;
+			i += 2;
+		}
+		return -1;
+	}
+
+	static function main() {
+		var seed = 3;
+		function rand( n : Int ) {
+			seed = seed * 1103515245 + 12345;
+			return (seed >>> 8) % n;
+		}
+		var size = 200;
+		var buf = new hl.Bytes(size + 1);
+		var pat = new hl.Bytes(32);
+		var checks = 0;
+		for( iter in 0...20000 ) {
+			// a small alphabet where the high byte of a char equals the low byte of others, so straddled matches exist
+			for( i in 0...size + 1 )
+				buf[i] = 0x41 + rand(3);
+			var base = rand(2); // odd base : chars are not aligned in memory
+			var s = offset(buf, base);
+			var len = rand((size >> 1) + 1) << 1;
+			var plen = (1 + rand(5)) << 1;
+			// pattern taken at any byte offset of the buffer, including odd ones which straddle two chars
+			var from = rand(size - plen + 1);
+			pat.blit(0, buf, from, plen);
+			var pos = rand((len >> 1) + 1) << 1;
+			var expect = refFind(offset(s, pos), len - pos, pat, plen);
+			var got = find16(s, pos, len - pos, pat, 0, plen);
+			if( got != (expect < 0 ? -1 : pos + expect) )
+				throw "find16 " + iter + " : " + got + " should be " + expect;
+			expect = refRFind(s, len, pat, plen);
+			got = rfind16(s, len, pat, plen);
+			if( got != expect )
+				throw "rfind16 " + iter + " : " + got + " should be " + expect;
+			var count = 1 + rand(10);
+			for( k in 0...count )
+				pat.setUI16(k << 1, 0x4141 + rand(3) + (rand(3) << 8));
+			expect = refFindAny(offset(s, pos), len - pos, pat, count);
+			got = findAny16(s, pos, len - pos, pat, count);
+			if( got != (expect < 0 ? -1 : pos + expect) )
+				throw "find_any16 " + iter + " : " + got + " should be " + expect;
+			checks++;
+		}
+		// a char found at an odd offset only, straddling two chars
+		var b = new hl.Bytes(64);
+		for( i in 0...32 )
+			b.setUI16(i << 1, 0x4200 + i);
+		pat.setUI16(0, 0x0542); // high byte of char 4, low byte of char 5
+		if( find16(b, 0, 64, pat, 0, 2) != -1 || rfind16(b, 64, pat, 2) != -1 || findAny16(b, 0, 64, pat, 1) != -1 )
+			throw "straddled match";
+		pat.setUI16(0, 0x4205);
+		if( find16(b, 2, 62, pat, 0, 2) != 10 || rfind16(b, 64, pat, 2) != 10 || findAny16(b, 2, 62, pat, 1) != 10 )
+			throw "aligned match";
+		if( find16(b, 0, 64, pat, 0, 0) != 0 || rfind16(b, 64, pat, 0) != 64 || findAny16(b, 0, 64, pat, 0) != -1 )
+			throw "empty pattern";
+		trace(checks);
+	}
+
+}
@@ -0,0 +1,37 @@
+class Calls {
+
+	static function call3( a : Int, b : Int, c : Int ) {
+		return a * 100 + b * 10 + c;
+	}
+
+	static function call4( a : Int, b : Int, c : Int, d : Int ) {
+		return a * 1000 + b * 100 + c * 10 + d;
+	}
+
+	static function call3f( a : Float, b : Int, c : Float ) {
+		return a * b + c;
+	}
+
+	static function call4s( a : String, b : String, c : String, d : String ) {
+		return a + b + c + d;
+	}
+
+	static function check( v : Dynamic, expect : Dynamic ) {
+		if( v != expect )
+			throw "got " + v + " instead of " + expect;
+	}
+
+	static function main() {
+		// the last argument is computed right before the call and only used by it
+		check(call3(1, 2, 3), 123);
+		check(call4(4, 5, 6, 7), 4567);
+		check(call3f(1.5, 2, 0.25), 3.25);
+		check(call4s("a", "b", "c", "d"), "abcd");
+		var x = 0;
+		for( i in 0...10 )
+			x += call4(i, i + 1, i + 2, i * 3) - call3(i, i * 2, i + 5);
+		check(x, 45790);
+		trace("ok");
+	}
+
+}
@@ -0,0 +1,50 @@
+class FloatFormat {
+
+	static function check( f : Float, ?expect : String ) {
+		var s = Std.string(f);
+		if( expect != null && s != expect )
+			throw "Std.string(" + expect + ") = " + s;
+		var back = Std.parseFloat(s);
+		if( haxe.io.FPHelper.doubleToI64(back) != haxe.io.FPHelper.doubleToI64(f) )
+			throw s + " does not round-trip";
+	}
+
+	static function main() {
+		check(0, "0");
+		check(-0.0, "-0");
+		check(1, "1");
+		check(-1, "-1");
+		check(0.1, "0.1");
+		check(0.1 + 0.2, "0.30000000000000004");
+		check(5.1, "5.1");
+		check(86.57, "86.57");
+		check(Math.PI, "3.141592653589793");
+		check(100000000000000, "100000000000000");
+		check(1e15, "1e+15");
+		check(1e-4, "0.0001");
+		check(1e-5, "1e-05");
+		check(1e23, "1e+23");
+		check(5e-324, "5e-324");
+		check(1.7976931348623157e308, "1.7976931348623157e+308");
+		check(2.2250738585072014e-308, "2.2250738585072014e-308");
+		if( Std.string(-2147483648) != "-2147483648" )
+			throw "Std.string(Int)";
+
+		// random bit patterns and random decimals
+		var seed = 1;
+		function rand() {
+			seed = seed * 1103515245 + 12345;
+			return seed;
+		}
+		var count = 0;
+		while( count < 1000000 ) {
+			var f = haxe.io.FPHelper.i64ToDouble(rand(), rand());
+			if( Math.isNaN(f) || !Math.isFinite(f) ) continue;
+			check(f);
+			check((rand() & 0xFFFFFF) / ((rand() & 0xFFFF) + 1));
+			count++;
+		}
+		trace("ok");
+	}
+
+}
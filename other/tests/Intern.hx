@@ -0,0 +1,41 @@
+class Intern {
+
+	@:hlNative("std","string_intern") static function intern( b : hl.Bytes, len : Int ) : hl.Bytes {
+		return null;
+	}
+
+	static function get( s : String ) {
+		var b = intern(@:privateAccess s.bytes, s.length);
+		if( b.compare(0, @:privateAccess s.bytes, 0, s.length << 1) != 0 || b.getUI16(s.length << 1) != 0 )
+			throw "bad interned copy of " + s;
+		return b;
+	}
+
+	static function fill( prefix : String, count : Int ) {
+		for( i in 0...count )
+			get(prefix + i);
+	}
+
+	static function main() {
+		var kept = new hl.NativeArray<hl.Bytes>(1000);
+		for( i in 0...kept.length )
+			kept[i] = get("keep" + i);
+		// only the table refers to these copies, and it does not keep them alive
+		fill("drop", 100000);
+		hl.Gc.major();
+		// reuse the memory of the collected copies : a stale entry would now point to other strings
+		var garbage = [for( i in 0...100000 ) "#" + i + "#"];
+		for( i in 0...kept.length )
+			if( get("keep" + i) != kept[i] )
+				throw "keep" + i + " was not kept by the table";
+		for( i in 0...100000 ) {
+			var s = "drop" + i;
+			if( get(s) != get(s) )
+				throw s + " was not interned again";
+		}
+		if( garbage.length != 100000 )
+			throw "garbage was collected";
+		trace("ok");
+	}
+
+}
@@ -0,0 +1,51 @@
+class NativeSort {
+
+	@:hlNative("std","bsort_native_i32") static function sortI32( b : hl.Bytes, pos : Int, len : Int, desc : Bool, threads : Int ) : Void {
+	}
+
+	@:hlNative("std","bsort_native_f64") static function sortF64( b : hl.Bytes, pos : Int, len : Int, desc : Bool, threads : Int ) : Void {
+	}
+
+	static function copy( b : hl.Bytes, size : Int ) {
+		var c = new hl.Bytes(size);
+		c.blit(0, b, 0, size);
+		return c;
+	}
+
+	static function main() {
+		// above the parallel threshold : slices are sorted and merged on several threads
+		var n = 300001;
+		var ints = new hl.Bytes(n * 4);
+		var floats = new hl.Bytes(n * 8);
+		var seed = 7;
+		for( i in 0...n ) {
+			seed = seed * 1103515245 + 12345;
+			ints.setI32(i << 2, seed);
+			floats.setF64(i << 3, i % 1009 == 0 ? Math.NaN : i % 997 == 0 ? -0. : (seed >> 4) / 1000.);
+		}
+		for( desc in [false, true] ) {
+			var serialI = copy(ints, n * 4);
+			var serialF = copy(floats, n * 8);
+			sortI32(serialI, 0, n, desc, 1);
+			sortF64(serialF, 0, n, desc, 1);
+			for( i in 1...n ) {
+				var a = serialI.getI32((i - 1) << 2), b = serialI.getI32(i << 2);
+				if( desc ? a < b : a > b )
+					throw "unsorted at " + i;
+			}
+			// run counts that are not a power of two leave a slice unmerged on some passes
+			for( threads in [2, 3, 5, 16] ) {
+				var bi = copy(ints, n * 4);
+				sortI32(bi, 0, n, desc, threads);
+				if( bi.compare(0, serialI, 0, n * 4) != 0 )
+					throw "i32 sort with " + threads + " threads differs";
+				var bf = copy(floats, n * 8);
+				sortF64(bf, 0, n, desc, threads);
+				if( bf.compare(0, serialF, 0, n * 8) != 0 )
+					throw "f64 sort with " + threads + " threads differs";
+			}
+		}
+		trace("ok");
+	}
+
+}
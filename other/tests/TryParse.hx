@@ -0,0 +1,133 @@
+class TryParse {
+
+	@:hlNative("std","try_parse_float") static function tryFloat( b : hl.Bytes, pos : Int, len : Int, ok : hl.Ref<Bool> ) : Float {
+		return 0.;
+	}
+
+	@:hlNative("std","try_parse_float_utf8") static function tryFloatUtf8( b : hl.Bytes, pos : Int, len : Int, ok : hl.Ref<Bool> ) : Float {
+		return 0.;
+	}
+
+	@:hlNative("std","try_parse_int_utf8") static function tryIntUtf8( b : hl.Bytes, pos : Int, len : Int, ok : hl.Ref<Bool> ) : Int {
+		return 0;
+	}
+
+	@:hlNative("std","parse_f64_column") static function parseF64Column( b : hl.Bytes, pos : Int, len : Int, sep : Int, count : hl.Ref<Int>, errors : hl.Ref<Int> ) : hl.Bytes {
+		return null;
+	}
+
+	@:hlNative("std","parse_i32_column") static function parseI32Column( b : hl.Bytes, pos : Int, len : Int, sep : Int, count : hl.Ref<Int>, errors : hl.Ref<Int> ) : hl.Bytes {
+		return null;
+	}
+
+	// test strings are ASCII
+	static function utf8( s : String ) {
+		var b = new hl.Bytes(s.length + 1);
+		for( i in 0...s.length )
+			b[i] = s.charCodeAt(i);
+		b[s.length] = 0;
+		return b;
+	}
+
+	static function bits( f : Float ) {
+		return haxe.io.FPHelper.doubleToI64(f);
+	}
+
+	static function checkFloat( s : String, high : Int, low : Int ) {
+		var ok = false;
+		var f = tryFloatUtf8(utf8(s), 0, s.length, ok);
+		if( !ok || bits(f) != haxe.Int64.make(high, low) )
+			throw "try_parse_float_utf8(" + s + ") = " + f;
+		ok = false;
+		f = tryFloat(@:privateAccess s.bytes, 0, s.length, ok);
+		if( !ok || bits(f) != haxe.Int64.make(high, low) )
+			throw "try_parse_float(" + s + ") = " + f;
+	}
+
+	static function checkInvalid( s : String ) {
+		var ok = true;
+		tryFloatUtf8(utf8(s), 0, s.length, ok);
+		if( ok ) throw "try_parse_float_utf8(" + s + ") should fail";
+		ok = true;
+		tryIntUtf8(utf8(s), 0, s.length, ok);
+		if( ok ) throw "try_parse_int_utf8(" + s + ") should fail";
+	}
+
+	static function checkInt( s : String, v : Int ) {
+		var ok = false;
+		var i = tryIntUtf8(utf8(s), 0, s.length, ok);
+		if( !ok || i != v )
+			throw "try_parse_int_utf8(" + s + ") = " + i;
+	}
+
+	static function main() {
+		// halfway cases round to even
+		checkFloat("9007199254740993", 0x43400000, 0);
+		checkFloat("9007199254740995", 0x43400000, 2);
+		// more than 19 significant digits
+		checkFloat("9007199254740993.0000000000000000001", 0x43400000, 1);
+		checkFloat("1.00000000000000011102230246251565404236316680908203125", 0x3FF00000, 0);
+		checkFloat("1.00000000000000011102230246251565404236316680908203126", 0x3FF00000, 1);
+		checkFloat("12345678901234567890123", 0x4484EA15, 0xB273B38A);
+		checkFloat("0.1000000000000000055511151231257827021181583404541015625", 0x3FB99999, 0x9999999A);
+		// subnormals, underflow and overflow
+		checkFloat("4.9406564584124654e-324", 0, 1);
+		checkFloat("2.4703282292062327e-324", 0, 0);
+		checkFloat("2.4703282292062328e-324", 0, 1);
+		checkFloat("2.2250738585072011e-308", 0x000FFFFF, 0xFFFFFFFF);
+		checkFloat("1e-400", 0, 0);
+		checkFloat("1e400", 0x7FF00000, 0);
+		checkFloat("-0", 0x80000000, 0);
+		// leading spaces are skipped, the number ends at the first invalid char
+		checkFloat("  7.5e-1xyz", 0x3FE80000, 0);
+
+		for( s in ["", " ", "abc", "-", ".", "e5"] )
+			checkInvalid(s);
+		checkInt("2147483647", 2147483647);
+		checkInt("-2147483648", -2147483647 - 1);
+		checkInt("0x7FFFFFFF", 2147483647);
+		checkInt("0xffffffff", -1);
+		checkInt("  42", 42);
+		checkInt("+7", 7);
+
+		// random doubles round-trip through their shortest representation
+		var seed = 1;
+		function rand() {
+			seed = seed * 1103515245 + 12345;
+			return seed;
+		}
+		var n = 0;
+		while( n < 100000 ) {
+			var f = haxe.io.FPHelper.i64ToDouble(rand(), rand());
+			if( Math.isNaN(f) || !Math.isFinite(f) ) continue;
+			var s = Std.string(f);
+			var ok = false;
+			var back = tryFloatUtf8(utf8(s), 0, s.length, ok);
+			if( !ok || bits(back) != bits(f) )
+				throw s + " does not round-trip";
+			n++;
+		}
+
+		var count = 0, errors = 0;
+		var s = "1.5,abc,,3e2,-0";
+		var col = parseF64Column(utf8(s), 0, s.length, ",".code, count, errors);
+		if( count != 5 || errors != 2 || col.getF64(0) != 1.5 || !Math.isNaN(col.getF64(8)) || !Math.isNaN(col.getF64(16)) || col.getF64(24) != 300 || bits(col.getF64(32)) != haxe.Int64.make(0x80000000, 0) )
+			throw "parse_f64_column(" + s + ")";
+		s = "1,";
+		col = parseF64Column(utf8(s), 0, s.length, ",".code, count, errors);
+		if( count != 2 || errors != 1 || col.getF64(0) != 1 || !Math.isNaN(col.getF64(8)) )
+			throw "parse_f64_column(" + s + ")";
+		parseF64Column(utf8(s), 0, 0, ",".code, count, errors);
+		if( count != 0 || errors != 0 )
+			throw "empty f64 column";
+		s = "1;x;0x10;-7;";
+		col = parseI32Column(utf8(s), 0, s.length, ";".code, count, errors);
+		if( count != 5 || errors != 2 || col.getI32(0) != 1 || col.getI32(4) != 0 || col.getI32(8) != 16 || col.getI32(12) != -7 || col.getI32(16) != 0 )
+			throw "parse_i32_column(" + s + ")";
+		parseI32Column(utf8(s), 0, 0, ";".code, count, errors);
+		if( count != 0 || errors != 0 )
+			throw "empty i32 column";
+		trace("ok");
+	}
+
+}
@@ -37,6 +37,7 @@ typedef struct {
 	int pos;
 	const char *error;
 	hl_code *code;
+	bool inplace;
 } hl_reader;
 
 #undef ERROR
@@ -67,6 +68,22 @@ static void hl_read_bytes( hl_reader *r, void *data, int size ) {
 	r->pos += size;
 }
 
+static void *hl_read_block( hl_reader *r, int size ) {
+	void *data;
+	if( !r->inplace ) {
+		data = hl_malloc(&r->code->alloc,size);
+		hl_read_bytes(r,data,size);
+		return data;
+	}
+	if( size < 0 || r->pos + size > r->size ) {
+		ERROR("No more data");
+		return NULL;
+	}
+	data = (void*)(r->b + r->pos);
+	r->pos += size;
+	return data;
+}
+
 static double hl_read_double( hl_reader *r ) {
 	double d = 0.;
 	hl_read_bytes(r, &d, 8);
@@ -359,12 +376,12 @@ const char *hl_op_name( int op ) {
 static char **hl_read_strings( hl_reader *r, int nstrings, int **out_lens ) {
 	int size = hl_read_i32(r);
 	hl_code *c = r->code;
-	char *sbase = (char*)hl_malloc(&c->alloc,sizeof(char) * size);
+	char *sbase = (char*)hl_read_block(r, size);
 	char *sdata = sbase;
 	char **strings;
 	int *lens;
 	int i;
-	hl_read_bytes(r, sdata, size);
+	if( r->error ) return NULL;
 	ALLOC(strings, char*, nstrings);
 	ALLOC(lens, int, nstrings);
 	for(i=0;i<nstrings;i++) {
@@ -382,11 +399,11 @@ static char **hl_read_strings( hl_reader *r, int nstrings, int **out_lens ) {
 	return strings;
 }
 
-static int *hl_read_debug_infos( hl_reader *r, int nops ) {
+// when debug is NULL, only skip the debug infos
+static void hl_read_debug_infos( hl_reader *r, int nops, int *debug ) {
 	int curfile = -1, curline = 0;
 	hl_code *code = r->code;
-	int *debug = (int*)hl_malloc(&code->alloc, sizeof(int) * nops * 2);
-	int i = 0;	
+	int i = 0;
 	while( i < nops ) {
 		int c = READ();
 		if( c & 1 ) {
@@ -397,39 +414,73 @@ static int *hl_read_debug_infos( hl_reader *r, int nops ) {
 		} else if( c & 2 ) {
 			int delta = c >> 6;
 			int count = (c >> 2) & 15;
-			if( i + count > nops )
+			if( i + count > nops ) {
 				ERROR("Outside range");
-			while( count-- ) {
-				debug[i<<1] = curfile;
-				debug[(i<<1)|1] = curline;
-				i++;
+				return;
 			}
+			if( debug ) {
+				while( count-- ) {
+					debug[i<<1] = curfile;
+					debug[(i<<1)|1] = curline;
+					i++;
+				}
+			} else
+				i += count;
 			curline += delta;
 		} else if( c & 4 ) {
 			curline += c >> 3;
-			debug[i<<1] = curfile;
-			debug[(i<<1)|1] = curline;
+			if( debug ) {
+				debug[i<<1] = curfile;
+				debug[(i<<1)|1] = curline;
+			}
 			i++;
 		} else {
 			unsigned char b2 = READ();
 			unsigned char b3 = READ();
 			curline = (c >> 3) | (b2 << 5) | (b3 << 13);
-			debug[i<<1] = curfile;
-			debug[(i<<1)|1] = curline;
+			if( debug ) {
+				debug[i<<1] = curfile;
+				debug[(i<<1)|1] = curline;
+			}
 			i++;
 		}
+		if( r->error ) return;
+	}
+}
+
+/*
+	When the code is read in place, the debug infos of a function are only
+	decoded the first time they are requested (stack traces, profilers or
+	JIT inlining), using the position recorded by hl_code_read.
+*/
+int *hl_get_debug_infos( hl_code *c, hl_function *f ) {
+	int *debug = f->debug;
+	if( debug == NULL && c->debug_pos ) {
+		hl_reader r = { c->data, c->data_size, c->debug_pos[f - c->functions], NULL, c, true };
+		hl_global_lock(true);
+		debug = f->debug;
+		if( debug == NULL ) {
+			debug = (int*)hl_malloc(&c->alloc, sizeof(int) * f->nops * 2);
+			hl_read_debug_infos(&r, f->nops, debug);
+			if( r.error )
+				debug = NULL;
+			else
+				f->debug = debug;
+		}
+		hl_global_lock(false);
 	}
 	return debug;
 }
 
-hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
-	hl_reader _r = { data, size, 0, 0, NULL };	
+static hl_code *hl_code_read_ex( const unsigned char *data, int size, bool inplace, char **error_msg ) {
+	hl_reader _r = { data, size, 0, 0, NULL, inplace };
 	hl_reader *r = &_r;
 	hl_code *c;
 	hl_alloc alloc;
 	int i;
 	int flags;
 	int max_version = 5;
+	hl_startup_begin(t);
 	hl_alloc_init(&alloc);
 	c = hl_zalloc(&alloc,sizeof(hl_code));
 	c->alloc = alloc;
@@ -469,8 +520,7 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 	CHK_ERROR();
 	if( c->version >= 5 ) {
 		int size = hl_read_i32(r);
-		c->bytes = hl_malloc(&c->alloc,size);
-		hl_read_bytes(r,c->bytes,size);
+		c->bytes = (char*)hl_read_block(r,size);
 		ALLOC(c->bytes_pos,int,c->nbytes);
 		CHK_ERROR();
 		for(i=0;i<c->nbytes;i++)
@@ -482,6 +532,7 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 		c->debugfiles = hl_read_strings(r, c->ndebugfiles, &c->debugfiles_lens);
 		CHK_ERROR();
 	}
+	hl_startup_mark(t,code_strings);
 	ALLOC(c->types, hl_type, c->ntypes);
 	for(i=0;i<c->ntypes;i++) {
 		hl_read_type(r, c->types + i);
@@ -500,12 +551,27 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 		n->findex = UINDEX();
 	}
 	CHK_ERROR();
+	hl_startup_mark(t,code_types);
 	ALLOC(c->functions, hl_function, c->nfunctions);
+	if( inplace && c->hasdebug ) {
+		c->data = data;
+		c->data_size = size;
+		ALLOC(c->debug_pos, int, c->nfunctions);
+	}
 	for(i=0;i<c->nfunctions;i++) {
 		hl_read_function(r,c->functions+i);
 		CHK_ERROR();
+		hl_startup_mark(t,code_functions);
 		if( c->hasdebug ) {
-			c->functions[i].debug = hl_read_debug_infos(r,c->functions[i].nops);
+			hl_function *f = c->functions + i;
+			if( inplace ) {
+				c->debug_pos[i] = r->pos;
+				hl_read_debug_infos(r, f->nops, NULL);
+			} else {
+				f->debug = (int*)hl_malloc(&c->alloc, sizeof(int) * f->nops * 2);
+				hl_read_debug_infos(r, f->nops, f->debug);
+			}
+			CHK_ERROR();
 			if( c->version >= 3 ) {
 				// skip assigns (no need here)
 				int nassigns = UINDEX();
@@ -515,6 +581,7 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 					INDEX();
 				}
 			}
+			hl_startup_mark(t,code_debug);
 		}
 	}
 	CHK_ERROR();
@@ -532,6 +599,14 @@ hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
 	return c;
 }
 
+hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg ) {
+	return hl_code_read_ex(data, size, false, error_msg);
+}
+
+hl_code *hl_code_read_inplace( const unsigned char *data, int size, char **error_msg ) {
+	return hl_code_read_ex(data, size, true, error_msg);
+}
+
 void hl_code_free( hl_code *c ) {
 	hl_free(&c->falloc);
 }
@@ -790,6 +790,29 @@ static void gc_mark_stack( void *start, void *end ) {
 	GC_STACK_END();
 }
 
+/*
+	Weak hooks are called once marking is done, before unmarked blocks are
+	swept, so tables kept outside of the GC can drop the dead pointers they
+	hold. They run with the world stopped and must not allocate GC memory.
+*/
+#define GC_MAX_WEAK_HOOKS	8
+static hl_weak_hook gc_weak_hooks[GC_MAX_WEAK_HOOKS];
+static int gc_weak_hooks_count = 0;
+
+HL_API void hl_gc_add_weak_hook( hl_weak_hook hook ) {
+	if( gc_weak_hooks_count == GC_MAX_WEAK_HOOKS ) hl_fatal("Too many GC weak hooks");
+	gc_weak_hooks[gc_weak_hooks_count++] = hook;
+}
+
+// only meaningful from a weak hook : non GC pointers are reported as marked
+HL_API bool hl_gc_is_marked( void *ptr ) {
+	gc_pheader *page = GC_GET_PAGE(ptr);
+	int bid;
+	if( !page || !INPAGE(ptr,page) ) return true;
+	bid = gc_allocator_get_block_id(page, ptr);
+	return bid < 0 || (page->bmp[bid>>3] & (1<<(bid&7))) != 0;
+}
+
 static void gc_mark() {
 	GC_STACK_BEGIN(&global_mark_stack);
 	int mark_bytes = gc_stats.mark_bytes;
@@ -845,6 +868,8 @@ static void gc_mark() {
 				hl_fatal("assert");
 		}
 	}
+	for(i=0;i<gc_weak_hooks_count;i++)
+		gc_weak_hooks[i]();
 	gc_allocator_after_mark();
 }
 
@@ -959,6 +984,21 @@ int gc_get_mark_threads( hl_thread **tids ) {
 	return gc_mark_threads;
 }
 
+// boxes are immutable : share them for small ints
+#define DYN_INT_MIN		(-128)
+#define DYN_INT_MAX		1023
+
+static vdynamic vdyn_ints[DYN_INT_MAX - DYN_INT_MIN + 1];
+
+static void dyn_ints_init() {
+	int i;
+	for(i=DYN_INT_MIN;i<=DYN_INT_MAX;i++) {
+		vdynamic *d = vdyn_ints + (i - DYN_INT_MIN);
+		d->t = &hlt_i32;
+		d->v.i = i;
+	}
+}
+
 static void hl_gc_init() {
 	int i;
 	for(i=0;i<1<<GC_LEVEL0_BITS;i++)
@@ -973,6 +1013,7 @@ static void hl_gc_init() {
 		gc_flags |= GC_DUMP_MEM;
 #	endif
 	gc_stats.mark_bytes = 4; // prevent reading out of bmp
+	dyn_ints_init();
 	memset(&gc_threads,0,sizeof(gc_threads));
 	gc_threads.global_lock = hl_mutex_alloc(false);
 	gc_threads.exclusive_lock = hl_mutex_alloc(false);
@@ -1040,13 +1081,17 @@ HL_API void hl_blocking( bool b ) {
 
 void hl_cache_free();
 void hl_cache_init();
+void hl_intern_init();
+void hl_intern_free();
 
 void hl_global_init() {
 	hl_gc_init();
 	hl_cache_init();
+	hl_intern_init();
 }
 
 void hl_global_free() {
+	hl_intern_free();
 	hl_cache_free();
 	hl_gc_free();
 }
@@ -1268,6 +1313,15 @@ vdynamic *hl_alloc_dynbool( bool b ) {
 	return (vdynamic*)(b ? &vdyn_true : &vdyn_false);
 }
 
+vdynamic *hl_alloc_dyni32( int v ) {
+	vdynamic *d;
+	if( (unsigned)(v - DYN_INT_MIN) <= (unsigned)(DYN_INT_MAX - DYN_INT_MIN) )
+		return vdyn_ints + (v - DYN_INT_MIN);
+	d = hl_alloc_dynamic(&hlt_i32);
+	d->v.i = v;
+	return d;
+}
+
 
 vdynamic *hl_alloc_obj( hl_type *t ) {
 	vobj *o;
@@ -317,6 +317,32 @@ C_FUNCTION_END
 #	define HL_UNREACHABLE __builtin_unreachable()
 #endif
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define HL_SSE2
+#endif
+
+// index of the lowest / highest set bit, x must not be 0
+#ifdef HL_VCC
+#	include <intrin.h>
+static HL_INLINE int hl_ctz( unsigned int x ) {
+	unsigned long r = 0;
+	_BitScanForward(&r,x);
+	return (int)r;
+}
+static HL_INLINE int hl_msb( unsigned int x ) {
+	unsigned long r = 0;
+	_BitScanReverse(&r,x);
+	return (int)r;
+}
+#else
+static HL_INLINE int hl_ctz( unsigned int x ) {
+	return __builtin_ctz(x);
+}
+static HL_INLINE int hl_msb( unsigned int x ) {
+	return 31 - __builtin_clz(x);
+}
+#endif
+
 // ---- TYPES -------------------------------------------
 
 typedef enum {
@@ -591,6 +617,7 @@ HL_API bool hl_safe_cast( hl_type *t, hl_type *to );
 HL_API varray *hl_alloc_array( hl_type *t, int size );
 HL_API vdynamic *hl_alloc_dynamic( hl_type *t );
 HL_API vdynamic *hl_alloc_dynbool( bool b );
+HL_API vdynamic *hl_alloc_dyni32( int v );
 HL_API vdynamic *hl_alloc_obj( hl_type *t );
 HL_API venum *hl_alloc_enum( hl_type *t, int index );
 HL_API vvirtual *hl_alloc_virtual( hl_type *t );
@@ -601,6 +628,7 @@ HL_API int hl_utf8_length( const vbyte *s, int pos );
 HL_API int hl_from_utf8( uchar *out, int outLen, const char *str );
 HL_API char *hl_to_utf8( const uchar *bytes );
 HL_API uchar *hl_to_utf16( const char *str );
+HL_API vbyte *hl_intern( const uchar *str, int len, int *hash );
 HL_API vdynamic *hl_virtual_make_value( vvirtual *v );
 HL_API hl_obj_field *hl_obj_field_fetch( hl_type *t, int fid );
 
@@ -620,6 +648,7 @@ HL_API void hl_setup_longjump( void *j );
 HL_API void hl_setup_exception( void *resolve_symbol, void *capture_stack );
 HL_API void hl_dump_stack( void );
 HL_API varray *hl_exception_stack( void );
+HL_API void hl_set_exception_stack_depth( int depth );
 HL_API bool hl_detect_debugger( void );
 
 HL_API vvirtual *hl_to_virtual( hl_type *vt, vdynamic *obj );
@@ -755,6 +784,10 @@ HL_API int hl_gc_get_memsize( void *ptr );
 HL_API void hl_blocking( bool b );
 HL_API bool hl_is_blocking( void );
 
+typedef void (*hl_weak_hook)( void );
+HL_API void hl_gc_add_weak_hook( hl_weak_hook hook );
+HL_API bool hl_gc_is_marked( void *ptr );
+
 typedef void (*hl_types_dump)( void (*)( void *, int) );
 HL_API void hl_gc_set_dump_types( hl_types_dump tdump );
 
@@ -785,9 +818,13 @@ HL_API void hl_buffer_char( hl_buffer *b, uchar c );
 HL_API void hl_buffer_str( hl_buffer *b, const uchar *str );
 HL_API void hl_buffer_cstr( hl_buffer *b, const char *str );
 HL_API void hl_buffer_str_sub( hl_buffer *b, const uchar *str, int len );
+HL_API void hl_buffer_reserve( hl_buffer *b, int len );
 HL_API int hl_buffer_length( hl_buffer *b );
+HL_API int hl_itoa( int i, uchar *out );
+HL_API int hl_dtoa( double d, uchar *out );
 HL_API uchar *hl_buffer_content( hl_buffer *b, int *len );
 HL_API uchar *hl_to_string( vdynamic *v );
+HL_API void hl_to_string_limits( int depth, int size );
 HL_API const uchar *hl_type_str( hl_type *t );
 HL_API void hl_throw_buffer( hl_buffer *b );
 
@@ -95,6 +95,10 @@ typedef struct {
 	hl_constant*constants;
 	hl_alloc	alloc;
 	hl_alloc	falloc;
+	// set by hl_code_read_inplace for lazy decoding
+	const unsigned char *data;
+	int			data_size;
+	int*		debug_pos;
 } hl_code;
 
 typedef struct {
@@ -104,6 +108,42 @@ typedef struct {
 } hl_debug_infos;
 
 typedef struct jit_ctx jit_ctx;
+typedef struct hl_symbol_index hl_symbol_index;
+
+#define HL_STARTUP_MAX_LIBS	64
+
+typedef struct {
+	const char *name;
+	double time;
+	int natives;
+} hl_startup_lib;
+
+// timings in seconds, filled while hl_startup points to it
+typedef struct {
+	double file_read;
+	double code_read;
+	double code_strings;
+	double code_types;
+	double code_functions;
+	double code_debug;
+	double optimize;
+	double module_alloc;
+	double natives;
+	double jit;
+	double jit_finalize;
+	double constants;
+	double entrypoint;
+	int nlibs;
+	hl_startup_lib libs[HL_STARTUP_MAX_LIBS];
+	int nfunctions;
+	double *functions;
+} hl_startup_profile;
+
+extern hl_startup_profile *hl_startup;
+HL_API double hl_sys_time( void );
+
+#define hl_startup_begin(t)			double t = hl_startup ? hl_sys_time() : 0.
+#define hl_startup_mark(t,field)	if( hl_startup ) { double __now = hl_sys_time(); hl_startup->field += __now - t; t = __now; }
 
 
 typedef struct {
@@ -126,11 +166,16 @@ typedef struct {
 	void *jit_code;
 	hl_code_hash *hash;
 	hl_debug_infos *jit_debug;
+	hl_symbol_index *symbols;
 	jit_ctx *jit_ctx;
+	bool jit_debugger;
 	hl_module_context ctx;
 } hl_module;
 
 hl_code *hl_code_read( const unsigned char *data, int size, char **error_msg );
+// strings and bytes are not copied : data must stay valid and writable as long as the code is used
+hl_code *hl_code_read_inplace( const unsigned char *data, int size, char **error_msg );
+void hl_code_optimize( hl_code *c, int level );
 
 hl_code_hash *hl_code_hash_alloc( hl_code *c );
 void hl_code_hash_finalize( hl_code_hash *h );
@@ -140,6 +185,7 @@ int hl_code_hash_type( hl_code_hash *h, hl_type *t );
 void hl_code_hash_remap_globals( hl_code_hash *hnew, hl_code_hash *hold );
 
 const uchar *hl_get_ustring( hl_code *c, int index );
+int *hl_get_debug_infos( hl_code *c, hl_function *f );
 const char* hl_op_name( int op );
 
 typedef unsigned char h_bool;
@@ -147,6 +193,7 @@ hl_module *hl_module_alloc( hl_code *code );
 int hl_module_init( hl_module *m, h_bool hot_reload );
 h_bool hl_module_patch( hl_module *m, hl_code *code );
 void hl_module_free( hl_module *m );
+void hl_module_fun_name( hl_function *f, char *out, int size );
 h_bool hl_module_debug( hl_module *m, int port, h_bool wait );
 
 void hl_profile_setup( int sample_count );
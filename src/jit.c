@@ -25,6 +25,11 @@
 #include <math.h>
 #include <hlmodule.h>
 
+#define OP(_,n) n,
+#define OP_BEGIN static int hl_op_nargs[] = {
+#define OP_END };
+#include "opcodes.h"
+
 #ifdef __arm__
 #	error "JIT does not support ARM processors, only x86 and x86-64 are supported, please use HashLink/C native compilation instead"
 #endif
@@ -109,6 +114,9 @@ typedef enum {
 	CVTSS2SI,
 	STMXCSR,
 	LDMXCSR,
+	// extensions
+	MOVSXD,
+	MOVZX8,
 	// 8-16 bits
 	MOV8,
 	CMP8,
@@ -216,9 +224,21 @@ struct vreg {
 	int size;
 	hl_type *t;
 	preg *current;
+	preg *pin;
 	preg stack;
 };
 
+typedef struct {
+	int id;
+	int start;
+	int end;
+	int weight;
+	int reg;
+	int region;
+	bool skip;
+	bool load;
+} pin_range;
+
 #define REG_AT(i)		(ctx->pregs + (i))
 
 #ifdef HL_64
@@ -306,7 +326,21 @@ struct jit_ctx {
 	int c2hl;
 	int hl2c;
 	int longjump;
+	int trapLanding;
+	int trapPos;
+	int trapCount;
+	int trapTable;
+	int *trapLandings;
 	void *static_functions[8];
+	bool globalRegs;
+	bool inlineCalls;
+	bool intrinsics;
+	pin_range *pins;
+	int pinCount;
+	int pinNext;
+	int pinSavePos;
+	int pinSaveMask;
+	pin_range *pinActive[REG_COUNT];
 };
 
 #define jit_exit() { hl_debug_break(); exit(-1); }
@@ -500,6 +534,9 @@ static opform OP_FORMS[_CPU_LAST] = {
 	{ "CVTSS2SI", 0xF30F2D },
 	{ "STMXCSR", 0, LONG_RM(0x0FAE,3) },
 	{ "LDMXCSR", 0, LONG_RM(0x0FAE,2) },
+	// extensions
+	{ "MOVSXD", 0x63 },
+	{ "MOVZX8", LONG_OP(0x0FB6) },
 	// 8 bits,
 	{ "MOV8", 0x8A, 0x88, 0, 0xB0, RM(0xC6,0) },
 	{ "CMP8", 0x3A, 0x38, 0, RM(0x80,7) },
@@ -944,7 +981,7 @@ static preg *alloc_reg( jit_ctx *ctx, preg_kind k ) {
 			const int count = RFPU_SCRATCH_COUNT;
 			for(i=0;i<count;i++) {
 				preg *p = PXMM((i + off)%count);
-				if( p->lock >= ctx->currentPos ) continue;
+				if( p->lock >= ctx->currentPos || ctx->pinActive[XMM((i + off)%count)] ) continue;
 				if( p->holds == NULL ) {
 					RLOCK(p);
 					return p;
@@ -952,7 +989,7 @@ static preg *alloc_reg( jit_ctx *ctx, preg_kind k ) {
 			}
 			for(i=0;i<count;i++) {
 				preg *p = PXMM((i + off)%count);
-				if( p->lock >= ctx->currentPos ) continue;
+				if( p->lock >= ctx->currentPos || ctx->pinActive[XMM((i + off)%count)] ) continue;
 				if( p->holds ) {
 					RLOCK(p);
 					p->holds->current = NULL;
@@ -1023,6 +1060,20 @@ static void reg_bind( vreg *r, preg *p ) {
 	p->holds = r;
 }
 
+static void pin_bind( vreg *r, preg *p ) {
+	if( p->holds && p->holds != r )
+		p->holds->current = NULL;
+	reg_bind(r,p);
+}
+
+static bool is_pin_of_other( jit_ctx *ctx, vreg *r, preg *p ) {
+	int id = (int)(p - ctx->pregs);
+	pin_range *pr;
+	if( id < 0 || id >= REG_COUNT ) return false;
+	pr = ctx->pinActive[id];
+	return pr && R(pr->id) != r;
+}
+
 static preg *alloc_cpu( jit_ctx *ctx, vreg *r, bool andLoad ) {
 	preg *p = fetch(r);
 	if( p->kind != RCPU ) {
@@ -1240,7 +1291,13 @@ static void store( jit_ctx *ctx, vreg *r, preg *v, bool bind ) {
 	v = copy(ctx,&r->stack,v,r->size);
 	if( IS_FLOAT(r) != (v->kind == RFPU) )
 		ASSERT(0);
-	if( bind && r->current != v && (v->kind == RCPU || v->kind == RFPU) ) {
+	if( r->pin ) {
+		// keep the pinned register in sync with the stack
+		if( v != r->pin ) copy(ctx,r->pin,v,r->size);
+		pin_bind(r,r->pin);
+		return;
+	}
+	if( bind && r->current != v && (v->kind == RCPU || v->kind == RFPU) && !is_pin_of_other(ctx,r,v) ) {
 		scratch(v);
 		r->current = v;
 		v->holds = r;
@@ -1314,13 +1371,497 @@ static void discard_regs( jit_ctx *ctx, bool native_call ) {
 	}
 	for(i=0;i<RFPU_COUNT;i++) {
 		preg *r = ctx->pregs + XMM(i);
-		if( r->holds ) {
+		if( r->holds && !ctx->pinActive[XMM(i)] ) {
 			r->holds->current = NULL;
 			r->holds = NULL;
 		}
 	}
 }
 
+/*
+	Global register allocation (HL_JIT_GLOBAL_REGS, 64 bits only)
+
+	The local allocator forgets all registers at each jump target and call, so a
+	loop reloads its counters and accumulators from the stack on every iteration.
+	When enabled, we compute a linear live range [start,end] for each numeric vreg,
+	extend it until every jump landing inside the range also comes from inside it,
+	and run a linear scan over these ranges. The spill cost of a range is the number
+	of loads it saves (uses that are the first access since a jump target or a call)
+	minus the moves it adds (writes, entry load, XMM reloads after calls), weighted
+	by loop depth. Allocated ranges keep their value in a dedicated register :
+	callee-saved CPU registers (saved in the frame) for integers and, on SysV,
+	XMM8-XMM15 for floats, reloaded after each call.
+
+	The stack slot stays authoritative : stores still write it, the pinned register
+	only saves the reloads. GC, stack traces and exceptions are unaffected. The pass
+	is disabled when a debugger is attached, since it can write locals.
+*/
+
+#ifdef HL_64
+#	ifdef HL_WIN_CALL
+static const int PIN_CPU_REGS[] = { Ebx, Esi, Edi, R12, R13, R14, R15 };
+#		define PIN_CPU_COUNT	7
+#		define PIN_FPU_COUNT	0
+#	else
+static const int PIN_CPU_REGS[] = { Ebx, R12, R13, R14, R15 };
+#		define PIN_CPU_COUNT	5
+#		define PIN_FPU_COUNT	8
+#	endif
+#else
+static const int PIN_CPU_REGS[] = { Ebx, Esi, Edi };
+#	define PIN_CPU_COUNT	0
+#	define PIN_FPU_COUNT	0
+#endif
+
+#define PIN_MIN_WEIGHT	8
+// a reload from the stack slot is often on the loop-carried dependency, a register move is almost free
+#define PIN_LOAD_COST	4
+#define PIN_MOVE_COST	1
+
+static void pin_use( pin_range *ranges, int nregs, int r, int pos, int w, int region, bool def ) {
+	pin_range *p;
+	if( (unsigned)r >= (unsigned)nregs ) return;
+	p = ranges + r;
+	if( p->skip ) return;
+	if( p->start < 0 ) {
+		p->start = pos;
+		p->load = !def;
+	} else if( !def && pos == p->start )
+		p->load = true;
+	p->end = pos;
+	if( def )
+		p->weight -= w * PIN_MOVE_COST; // copied to the register after the stack write
+	else if( p->region != region )
+		p->weight += w * PIN_LOAD_COST; // the local allocator would reload it
+	p->region = region;
+}
+
+static bool pin_is_call( hl_opcode *o ) {
+	switch( o->op ) {
+	case OCall0:
+	case OCall1:
+	case OCall2:
+	case OCall3:
+	case OCall4:
+	case OCallN:
+	case OCallMethod:
+	case OCallThis:
+	case OCallClosure:
+	case ONew:
+	case OToDyn:
+	case OToVirtual:
+	case OSafeCast:
+	case ODynGet:
+	case ODynSet:
+	case OMakeEnum:
+	case OEnumAlloc:
+	case OInstanceClosure:
+	case OVirtualClosure:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+	Returns the register written by the op (always p1), or -1 if it writes none.
+*/
+static int pin_def( hl_opcode *o ) {
+	switch( o->op ) {
+	case OSetGlobal:
+	case OSetField:
+	case OSetThis:
+	case ODynSet:
+	case OSetEnumField:
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case OSetArray:
+	case OSetref:
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+	case OJAlways:
+	case OLabel:
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case OSwitch:
+	case ONullCheck:
+	case OEndTrap:
+	case OAssert:
+	case ONop:
+	case OPrefetch:
+	case OAsm:
+		return -1;
+	default:
+		return o->p1;
+	}
+}
+
+static void pin_scan_op( pin_range *ranges, int nregs, hl_opcode *o, int pos, int w, int region ) {
+	int i, def = pin_def(o);
+	bool written = false;
+	// the first occurrence of the written register is the write, which happens after the reads
+#	define USE(r)	{ int _r = r; if( _r == def && !written ) written = true; else pin_use(ranges,nregs,_r,pos,w,region,false); }
+	switch( o->op ) {
+	case OJAlways:
+	case OLabel:
+	case OEndTrap:
+	case OAssert:
+	case ONop:
+		break;
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OCall0:
+	case OStaticClosure:
+	case OGetGlobal:
+	case OGetThis:
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case OSwitch:
+	case ONullCheck:
+	case OTrap:
+	case ONew:
+	case OType:
+	case OEnumAlloc:
+	case OPrefetch:
+		USE(o->p1);
+		break;
+	case OIncr:
+	case ODecr:
+		pin_use(ranges,nregs,o->p1,pos,w,region,false);
+		USE(o->p1);
+		break;
+	case OSetGlobal:
+	case OSetThis:
+		USE(o->p2);
+		break;
+	case OCall1:
+	case OInstanceClosure:
+	case OSetField:
+	case ODynSet:
+	case OSetEnumField:
+		USE(o->p1);
+		USE(o->p3);
+		break;
+	case OCall2:
+		USE(o->p1);
+		USE(o->p3);
+		USE((int)(int_val)o->extra);
+		break;
+	case OCall3:
+	case OCall4:
+		USE(o->p1);
+		USE(o->p3);
+		for(i=0;i<hl_op_nargs[o->op] - 3;i++)
+			USE(o->extra[i]);
+		break;
+	case OCallClosure:
+		USE(o->p2);
+		// fallthrough
+	case OCallN:
+	case OCallMethod:
+	case OCallThis:
+	case OMakeEnum:
+		USE(o->p1);
+		for(i=0;i<o->p3;i++)
+			USE(o->extra[i]);
+		break;
+	case OAdd:
+	case OSub:
+	case OMul:
+	case OSDiv:
+	case OUDiv:
+	case OSMod:
+	case OUMod:
+	case OShl:
+	case OSShr:
+	case OUShr:
+	case OAnd:
+	case OOr:
+	case OXor:
+	case OGetI8:
+	case OGetI16:
+	case OGetMem:
+	case OGetArray:
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case OSetArray:
+	case ORefOffset:
+		USE(o->p1);
+		USE(o->p2);
+		USE(o->p3);
+		break;
+	default:
+		// two registers : OMov, OField, ODynGet, OJSLt..OJNotEq, conversions, etc.
+		USE(o->p1);
+		USE(o->p2);
+		break;
+	}
+#	undef USE
+	// the result of a call is written after it
+	if( written ) pin_use(ranges,nregs,def,pos,w,pin_is_call(o) ? region + 1 : region,true);
+}
+
+static int pin_jump_target( hl_opcode *o, int pos ) {
+	switch( o->op ) {
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OTrap:
+		return pos + 1 + o->p2;
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+		return pos + 1 + o->p3;
+	case OJAlways:
+		return pos + 1 + o->p1;
+	default:
+		return -1;
+	}
+}
+
+static int pin_cmp_start( const void *a, const void *b ) {
+	return ((pin_range*)a)->start - ((pin_range*)b)->start;
+}
+
+static void pin_analyze( jit_ctx *ctx, hl_function *f ) {
+	int i, k, njumps = 0, ncands = 0, region = 0;
+	int *jumps, *depth, *calls;
+	bool *targets;
+	pin_range *ranges, *cands;
+	pin_range *owner[REG_COUNT];
+	ctx->pinCount = 0;
+	ctx->pinNext = 0;
+	ctx->pinSaveMask = 0;
+	if( !ctx->globalRegs || (PIN_CPU_COUNT == 0 && PIN_FPU_COUNT == 0) )
+		return;
+	ranges = (pin_range*)hl_malloc(&ctx->falloc,sizeof(pin_range) * (f->nregs + 1));
+	for(i=0;i<f->nregs;i++) {
+		pin_range *r = ranges + i;
+		r->id = i;
+		r->start = r->end = r->reg = r->region = -1;
+		r->weight = 0;
+		r->load = false;
+		switch( f->regs[i]->kind ) {
+		case HI32:
+		case HI64:
+			r->skip = PIN_CPU_COUNT == 0;
+			break;
+		case HF32:
+		case HF64:
+			r->skip = PIN_FPU_COUNT == 0;
+			break;
+		default:
+			r->skip = true;
+			break;
+		}
+	}
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		switch( o->op ) {
+		case OAsm:
+			// inline assembly can use any register
+			return;
+		case ORef:
+			// the stack address escapes
+			ranges[o->p2].skip = true;
+			break;
+		case OSwitch:
+			njumps += o->p2;
+			break;
+		default:
+			if( pin_jump_target(o,i) >= 0 ) njumps++;
+			break;
+		}
+	}
+	// loop depth of each op, using back edges
+	jumps = (int*)hl_malloc(&ctx->falloc,sizeof(int) * 2 * (njumps + 1));
+	depth = (int*)hl_zalloc(&ctx->falloc,sizeof(int) * (f->nops + 1));
+	calls = (int*)hl_zalloc(&ctx->falloc,sizeof(int) * (f->nops + 1));
+	targets = (bool*)hl_zalloc(&ctx->falloc,sizeof(bool) * (f->nops + 1));
+	njumps = 0;
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		int count = o->op == OSwitch ? o->p2 : 1;
+		for(k=0;k<count;k++) {
+			int target = o->op == OSwitch ? i + 1 + o->extra[k] : pin_jump_target(o,i);
+			if( target < 0 ) continue;
+			jumps[njumps<<1] = i;
+			jumps[(njumps<<1)|1] = target;
+			njumps++;
+			targets[target] = true;
+			if( target <= i ) {
+				depth[target]++;
+				depth[i+1]--;
+			}
+		}
+	}
+	// depth becomes the weight of each op, calls the weighted count of calls before it
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		int d;
+		if( i > 0 ) depth[i] += depth[i-1];
+		d = depth[i] > 3 ? 3 : depth[i];
+		if( targets[i] ) region++;
+		pin_scan_op(ranges,f->nregs,o,i,1 << (3 * d),region);
+		calls[i+1] = calls[i];
+		if( pin_is_call(o) ) {
+			calls[i+1] += 1 << (3 * d);
+			region++;
+		}
+	}
+	for(i=0;i<f->nops;i++) {
+		int d = depth[i] > 3 ? 3 : depth[i];
+		depth[i] = 1 << (3 * d);
+	}
+	cands = ranges;
+	for(i=0;i<f->nregs;i++) {
+		pin_range *r = ranges + i;
+		bool changed = true;
+		int start = r->start;
+		if( r->skip || r->weight < PIN_MIN_WEIGHT || r->start >= r->end ) continue;
+		// every jump into the range must come from the range, so the register is valid on all incoming edges
+		while( changed ) {
+			changed = false;
+			for(k=0;k<njumps;k++) {
+				int src = jumps[k<<1], target = jumps[(k<<1)|1];
+				if( target < r->start || target > r->end ) continue;
+				if( src < r->start ) { r->start = src; changed = true; }
+				if( src > r->end ) { r->end = src; changed = true; }
+			}
+		}
+		if( r->start != start ) r->load = true;
+		if( r->load ) r->weight -= depth[r->start] * PIN_LOAD_COST;
+		if( f->regs[i]->kind == HF32 || f->regs[i]->kind == HF64 )
+			r->weight -= (calls[r->end] - calls[r->start]) * PIN_LOAD_COST;
+		if( r->weight < PIN_MIN_WEIGHT ) continue;
+		cands[ncands++] = *r;
+	}
+	if( ncands == 0 )
+		return;
+	// linear scan over the ranges sorted by start : a register is freed when its range ends, and
+	// when none is left, the range with the lowest weight (the new one or an active one) is spilled
+	qsort(cands,ncands,sizeof(pin_range),pin_cmp_start);
+	memset(owner,0,sizeof(owner));
+	for(i=0;i<ncands;i++) {
+		pin_range *r = cands + i;
+		bool fpu = f->regs[r->id]->kind == HF32 || f->regs[r->id]->kind == HF64;
+		int count = fpu ? PIN_FPU_COUNT : PIN_CPU_COUNT;
+		int best = -1;
+		for(k=0;k<count;k++) {
+			int reg = fpu ? XMM(RFPU_COUNT - PIN_FPU_COUNT + k) : PIN_CPU_REGS[k];
+			if( owner[reg] && owner[reg]->end < r->start ) owner[reg] = NULL;
+			if( !owner[reg] ) {
+				best = reg;
+				break;
+			}
+			if( best < 0 || owner[reg]->weight < owner[best]->weight ) best = reg;
+		}
+		if( best < 0 ) continue;
+		if( owner[best] ) {
+			if( owner[best]->weight >= r->weight ) continue;
+			owner[best]->reg = -1;
+		}
+		r->reg = best;
+		owner[best] = r;
+	}
+	ctx->pins = (pin_range*)hl_malloc(&ctx->falloc,sizeof(pin_range) * ncands);
+	for(i=0;i<ncands;i++) {
+		pin_range *r = cands + i;
+		if( r->reg < 0 ) continue;
+		ctx->pins[ctx->pinCount++] = *r;
+		for(k=0;k<PIN_CPU_COUNT;k++)
+			if( r->reg == PIN_CPU_REGS[k] )
+				ctx->pinSaveMask |= 1 << k;
+	}
+}
+
+static void pin_enter( jit_ctx *ctx, int pos ) {
+	while( ctx->pinNext < ctx->pinCount && ctx->pins[ctx->pinNext].start == pos ) {
+		pin_range *r = ctx->pins + ctx->pinNext++;
+		vreg *v = R(r->id);
+		preg *p = REG_AT(r->reg);
+		if( r->load ) {
+			copy(ctx,p,fetch(v),v->size);
+			pin_bind(v,p);
+		} else
+			scratch(p); // written by the op at start
+		v->pin = p;
+		ctx->pinActive[r->reg] = r;
+	}
+}
+
+static void pin_sync( jit_ctx *ctx, int pos ) {
+	int i;
+	for(i=0;i<REG_COUNT;i++) {
+		pin_range *r = ctx->pinActive[i];
+		vreg *v;
+		preg *p;
+		if( !r ) continue;
+		v = R(r->id);
+		p = REG_AT(i);
+		if( r->end <= pos ) {
+			ctx->pinActive[i] = NULL;
+			v->pin = NULL;
+			scratch(p);
+		} else if( v->current != p ) {
+			// the value was written somewhere else (memory or another register)
+			copy(ctx,p,&v->stack,v->size);
+			pin_bind(v,p);
+		}
+	}
+}
+
+static void pin_reload( jit_ctx *ctx, bool fpu_only ) {
+	int i;
+	for(i=fpu_only ? RCPU_COUNT : 0;i<REG_COUNT;i++) {
+		pin_range *r = ctx->pinActive[i];
+		if( r ) copy(ctx,REG_AT(i),&R(r->id)->stack,R(r->id)->size);
+	}
+}
+
+static preg *pin_temp( jit_ctx *ctx, vreg *a, preg *pa, preg *pb, vreg *dst ) {
+	preg *tmp;
+	// don't write into the register of a pinned operand
+	if( pa != a->pin || dst == NULL || dst == a )
+		return pa;
+	if( pb->kind == RCPU || pb->kind == RFPU ) RLOCK(pb);
+	tmp = dst->pin && dst->pin != pb ? dst->pin : alloc_reg(ctx, pa->kind);
+	copy(ctx,tmp,pa,a->size);
+	return tmp;
+}
+
 static int pad_before_call( jit_ctx *ctx, int size ) {
 	int total = size + ctx->totalRegsSize + HL_WSIZE * 2; // EIP+EBP
 	if( total & 15 ) {
@@ -1518,6 +2059,8 @@ static void op_call( jit_ctx *ctx, preg *r, int size ) {
 		if( size >= 0 ) size += 32;
 	}
 	op32(ctx, CALL, r, UNUSED);
+	// XMM registers are not preserved by the callee
+	if( ctx->pinCount ) pin_reload(ctx,true);
 	if( size > 0 ) op64(ctx,ADD,PESP,pconst(&p,size));
 }
 
@@ -1532,11 +2075,247 @@ static void call_native( jit_ctx *ctx, void *nativeFun, int size ) {
 	discard_regs(ctx, true);
 }
 
+#ifdef HL_64
+/*
+	Intrinsics (64 bits only, disabled with HL_JIT_NO_INTRINSICS)
+
+	Calls to a few short std natives are replaced by inline code. Arguments are read
+	from their stack slots, which are always up to date, so the emitted code only
+	needs fixed registers and leaves the other register bindings untouched. When
+	the fast path does not apply (backward overlapping blit, lengths above a few
+	words where the libc versions are faster) the regular native call is made
+	instead; both paths leave the result in RAX.
+
+	Allocation natives are not handled : the GC allocator takes the global lock and
+	may start a collection, which can't be done from inline code.
+*/
+
+typedef void (*jit_intrinsic_emit)( jit_ctx *ctx, int findex, int *args );
+
+typedef struct {
+	const char *name;
+	const char *sign; // b = bytes, i = i32
+	jit_intrinsic_emit emit;
+} jit_intrinsic;
+
+#define INTRINSIC_COPY_MAX	32
+#define INTRINSIC_CMP_MAX	16
+
+static void intrinsic_begin( jit_ctx *ctx ) {
+	static const int used[] = { Eax, Ecx, Edx, Esi, Edi };
+	int i;
+	jit_buf(ctx);
+	for(i=0;i<5;i++)
+		if( !ctx->pinActive[used[i]] ) scratch(REG_AT(used[i]));
+	if( IS_WINCALL64 ) {
+		// callee saved, maybe pinned
+		op64(ctx,PUSH,REG_AT(Esi),UNUSED);
+		op64(ctx,PUSH,REG_AT(Edi),UNUSED);
+	}
+}
+
+static void intrinsic_end( jit_ctx *ctx ) {
+	if( IS_WINCALL64 ) {
+		op64(ctx,POP,REG_AT(Edi),UNUSED);
+		op64(ctx,POP,REG_AT(Esi),UNUSED);
+	}
+}
+
+static void intrinsic_arg( jit_ctx *ctx, CpuReg r, vreg *v ) {
+	op64(ctx,v->t->kind == HI32 ? MOVSXD : MOV,REG_AT(r),&v->stack);
+}
+
+static void intrinsic_addr( jit_ctx *ctx, CpuReg r, vreg *bytes, vreg *pos ) {
+	intrinsic_arg(ctx,r,bytes);
+	intrinsic_arg(ctx,Eax,pos);
+	op64(ctx,ADD,REG_AT(r),PEAX);
+}
+
+static void intrinsic_fallback( jit_ctx *ctx, int findex, int count, int *args ) {
+	int size;
+	intrinsic_end(ctx);
+	size = prepare_call_args(ctx,count,args,ctx->vregs,0);
+	call_native(ctx,ctx->m->functions_ptrs[findex],size);
+}
+
+static void intrinsic_blit( jit_ctx *ctx, int findex, int *args ) {
+	vreg *r = ctx->vregs;
+	preg p;
+	int jslow, jlong, jdone, jloop, jbytes, jend, jend2, loop;
+	intrinsic_begin(ctx);
+	intrinsic_addr(ctx,Edi,r + args[0],r + args[1]);
+	intrinsic_addr(ctx,Esi,r + args[2],r + args[3]);
+	intrinsic_arg(ctx,Ecx,r + args[4]);
+	// a forward copy is only wrong if dst starts inside src
+	op64(ctx,MOV,PEAX,REG_AT(Edi));
+	op64(ctx,SUB,PEAX,REG_AT(Esi));
+	op64(ctx,CMP,PEAX,REG_AT(Ecx));
+	XJump(JULt,jslow);
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,INTRINSIC_COPY_MAX));
+	XJump(JUGt,jlong);
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JULt,jbytes);
+	// copy 8 bytes at a time, the last 8 bytes are read first and written last
+	op64(ctx,MOV,REG_AT(Edx),pmem2(&p,Esi,Ecx,1,-8));
+	loop = BUF_POS();
+	op64(ctx,MOV,PEAX,pmem(&p,Esi,0));
+	op64(ctx,MOV,pmem(&p,Edi,0),PEAX);
+	op64(ctx,ADD,REG_AT(Esi),pconst(&p,8));
+	op64(ctx,ADD,REG_AT(Edi),pconst(&p,8));
+	op64(ctx,SUB,REG_AT(Ecx),pconst(&p,8));
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JUGte,jloop);
+	patch_jump_to(ctx,jloop,loop);
+	op64(ctx,MOV,pmem2(&p,Edi,Ecx,1,-8),REG_AT(Edx));
+	XJump_small(JAlways,jend);
+	patch_jump(ctx,jbytes);
+	loop = BUF_POS();
+	op64(ctx,TEST,REG_AT(Ecx),REG_AT(Ecx));
+	XJump_small(JZero,jend2);
+	op32(ctx,MOVZX8,PEAX,pmem(&p,Esi,0));
+	op32(ctx,MOV8,pmem(&p,Edi,0),PEAX);
+	op64(ctx,INC,REG_AT(Esi),UNUSED);
+	op64(ctx,INC,REG_AT(Edi),UNUSED);
+	op64(ctx,DEC,REG_AT(Ecx),UNUSED);
+	XJump_small(JAlways,jloop);
+	patch_jump_to(ctx,jloop,loop);
+	patch_jump(ctx,jend);
+	patch_jump(ctx,jend2);
+	intrinsic_end(ctx);
+	XJump(JAlways,jdone);
+	patch_jump(ctx,jslow);
+	patch_jump(ctx,jlong);
+	intrinsic_fallback(ctx,findex,5,args);
+	patch_jump(ctx,jdone);
+}
+
+static void intrinsic_compare( jit_ctx *ctx, int findex, int *args ) {
+	vreg *r = ctx->vregs;
+	preg p;
+	int jslow, jdone, jloop, jtail, jdiff, jeq, jfound, loop, tail;
+	intrinsic_begin(ctx);
+	intrinsic_addr(ctx,Esi,r + args[0],r + args[1]);
+	intrinsic_addr(ctx,Edi,r + args[2],r + args[3]);
+	intrinsic_arg(ctx,Ecx,r + args[4]);
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,INTRINSIC_CMP_MAX));
+	XJump(JUGt,jslow);
+	// compare 8 bytes at a time, then find the first different byte
+	loop = BUF_POS();
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JULt,jtail);
+	op64(ctx,MOV,PEAX,pmem(&p,Esi,0));
+	op64(ctx,CMP,PEAX,pmem(&p,Edi,0));
+	XJump_small(JNeq,jdiff);
+	op64(ctx,ADD,REG_AT(Esi),pconst(&p,8));
+	op64(ctx,ADD,REG_AT(Edi),pconst(&p,8));
+	op64(ctx,SUB,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JAlways,jloop);
+	patch_jump_to(ctx,jloop,loop);
+	patch_jump(ctx,jdiff);
+	op32(ctx,MOV,REG_AT(Ecx),pconst(&p,8));
+	patch_jump(ctx,jtail);
+	tail = BUF_POS();
+	op32(ctx,XOR,PEAX,PEAX);
+	op64(ctx,TEST,REG_AT(Ecx),REG_AT(Ecx));
+	XJump_small(JZero,jeq);
+	op32(ctx,MOVZX8,PEAX,pmem(&p,Esi,0));
+	op32(ctx,MOVZX8,REG_AT(Edx),pmem(&p,Edi,0));
+	op32(ctx,SUB,PEAX,REG_AT(Edx));
+	XJump_small(JNotZero,jfound);
+	op64(ctx,INC,REG_AT(Esi),UNUSED);
+	op64(ctx,INC,REG_AT(Edi),UNUSED);
+	op64(ctx,DEC,REG_AT(Ecx),UNUSED);
+	XJump_small(JAlways,jloop);
+	patch_jump_to(ctx,jloop,tail);
+	patch_jump(ctx,jeq);
+	patch_jump(ctx,jfound);
+	intrinsic_end(ctx);
+	XJump(JAlways,jdone);
+	patch_jump(ctx,jslow);
+	intrinsic_fallback(ctx,findex,5,args);
+	patch_jump(ctx,jdone);
+}
+
+static void intrinsic_fill( jit_ctx *ctx, int findex, int *args ) {
+	vreg *r = ctx->vregs;
+	preg p;
+	int jslow, jdone, jloop, jbytes, jend, jend2, loop;
+	intrinsic_begin(ctx);
+	intrinsic_addr(ctx,Edi,r + args[0],r + args[1]);
+	intrinsic_arg(ctx,Ecx,r + args[2]);
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,INTRINSIC_COPY_MAX));
+	XJump(JUGt,jslow);
+	// replicate the byte value in the 8 bytes of RAX
+	op32(ctx,MOVZX8,PEAX,&r[args[3]].stack);
+	op64(ctx,MOV,REG_AT(Edx),pconst64(&p,0x0101010101010101));
+	op64(ctx,IMUL,PEAX,REG_AT(Edx));
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JULt,jbytes);
+	// the last 8 bytes are written with an overlapping store
+	op64(ctx,MOV,pmem2(&p,Edi,Ecx,1,-8),PEAX);
+	loop = BUF_POS();
+	op64(ctx,MOV,pmem(&p,Edi,0),PEAX);
+	op64(ctx,ADD,REG_AT(Edi),pconst(&p,8));
+	op64(ctx,SUB,REG_AT(Ecx),pconst(&p,8));
+	op64(ctx,CMP,REG_AT(Ecx),pconst(&p,8));
+	XJump_small(JUGte,jloop);
+	patch_jump_to(ctx,jloop,loop);
+	XJump_small(JAlways,jend);
+	patch_jump(ctx,jbytes);
+	loop = BUF_POS();
+	op64(ctx,TEST,REG_AT(Ecx),REG_AT(Ecx));
+	XJump_small(JZero,jend2);
+	op32(ctx,MOV8,pmem(&p,Edi,0),PEAX);
+	op64(ctx,INC,REG_AT(Edi),UNUSED);
+	op64(ctx,DEC,REG_AT(Ecx),UNUSED);
+	XJump_small(JAlways,jloop);
+	patch_jump_to(ctx,jloop,loop);
+	patch_jump(ctx,jend);
+	patch_jump(ctx,jend2);
+	intrinsic_end(ctx);
+	XJump(JAlways,jdone);
+	patch_jump(ctx,jslow);
+	intrinsic_fallback(ctx,findex,4,args);
+	patch_jump(ctx,jdone);
+}
+
+static jit_intrinsic JIT_INTRINSICS[] = {
+	{ "bytes_blit", "bibii", intrinsic_blit },
+	{ "bytes_compare", "bibii", intrinsic_compare },
+	{ "bytes_fill", "biii", intrinsic_fill },
+};
+
+static bool op_intrinsic( jit_ctx *ctx, vreg *dst, int findex, int fid, int count, int *args ) {
+	hl_native *n = ctx->m->code->natives + (fid - ctx->m->code->nfunctions);
+	int i, k;
+	if( strcmp(n->lib,"std") != 0 )
+		return false;
+	for(i=0;i<sizeof(JIT_INTRINSICS)/sizeof(jit_intrinsic);i++) {
+		jit_intrinsic *in = JIT_INTRINSICS + i;
+		if( strcmp(n->name,in->name) != 0 ) continue;
+		if( (int)strlen(in->sign) != count ) return false;
+		for(k=0;k<count;k++)
+			if( ctx->vregs[args[k]].t->kind != (in->sign[k] == 'b' ? HBYTES : HI32) )
+				return false;
+		in->emit(ctx,findex,args);
+		discard_regs(ctx,true);
+		if( dst ) store_result(ctx,dst);
+		return true;
+	}
+	return false;
+}
+#endif
+
 static void op_call_fun( jit_ctx *ctx, vreg *dst, int findex, int count, int *args ) {
 	int fid = findex < 0 ? -1 : ctx->m->functions_indexes[findex];
 	bool isNative = fid >= ctx->m->code->nfunctions;
-	int size = prepare_call_args(ctx,count,args,ctx->vregs,0);
+	int size;
 	preg p;
+#	ifdef HL_64
+	if( isNative && ctx->intrinsics && op_intrinsic(ctx,dst,findex,fid,count,args) )
+		return;
+#	endif
+	size = prepare_call_args(ctx,count,args,ctx->vregs,0);
 	if( fid < 0 ) {
 		ASSERT(fid);
 	} else if( isNative ) {
@@ -1569,9 +2348,25 @@ static void op_call_fun( jit_ctx *ctx, vreg *dst, int findex, int count, int *ar
 
 static void op_enter( jit_ctx *ctx ) {
 	preg p;
+	int i, pos = ctx->pinSavePos;
 	op64(ctx, PUSH, PEBP, UNUSED);
 	op64(ctx, MOV, PEBP, PESP);
 	if( ctx->totalRegsSize ) op64(ctx, SUB, PESP, pconst(&p,ctx->totalRegsSize));
+	for(i=0;i<PIN_CPU_COUNT;i++)
+		if( ctx->pinSaveMask & (1 << i) ) {
+			pos += HL_WSIZE;
+			op64(ctx, MOV, pmem(&p,Ebp,-pos), REG_AT(PIN_CPU_REGS[i]));
+		}
+}
+
+static void restore_pinned( jit_ctx *ctx ) {
+	preg p;
+	int i, pos = ctx->pinSavePos;
+	for(i=0;i<PIN_CPU_COUNT;i++)
+		if( ctx->pinSaveMask & (1 << i) ) {
+			pos += HL_WSIZE;
+			op64(ctx, MOV, REG_AT(PIN_CPU_REGS[i]), pmem(&p,Ebp,-pos));
+		}
 }
 
 static void op_ret( jit_ctx *ctx, vreg *r ) {
@@ -1598,6 +2393,7 @@ static void op_ret( jit_ctx *ctx, vreg *r ) {
 			op64(ctx,MOV,PEAX,fetch(r));
 		break;
 	}
+	if( ctx->pinSaveMask ) restore_pinned(ctx);
 	if( ctx->totalRegsSize ) op64(ctx, ADD, PESP, pconst(&p, ctx->totalRegsSize));
 #	ifdef JIT_DEBUG
 	{
@@ -1708,6 +2504,7 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 				pa = alloc_reg(ctx, RCPU);
 				op(ctx,MOV,pa,fetch(a), is64);
 			}
+			pa = pin_temp(ctx, a, pa, REG_AT(Ecx), dst);
 			op(ctx,bop == OShl ? SHL : (bop == OUShr ? SHR : SAR), pa, UNUSED,is64);
 			if( dst ) store(ctx, dst, pa, true);
 			return pa;
@@ -1793,8 +2590,9 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RCPU,RCPU):
 		case ID2(RCPU,RSTACK):
+			pa = pin_temp(ctx, a, pa, pb, dst);
 			op32(ctx, o, pa, pb);
-			scratch(pa);
+			if( pa != a->pin ) scratch(pa);
 			out = pa;
 			break;
 		case ID2(RSTACK,RCPU):
@@ -1834,8 +2632,9 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RCPU,RCPU):
 		case ID2(RCPU,RSTACK):
+			pa = pin_temp(ctx, a, pa, pb, dst);
 			op64(ctx, o, pa, pb);
-			scratch(pa);
+			if( pa != a->pin ) scratch(pa);
 			out = pa;
 			break;
 		case ID2(RSTACK,RCPU):
@@ -1862,6 +2661,7 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 	case HF32:
 		pa = alloc_fpu(ctx, a, true);
 		pb = alloc_fpu(ctx, b, true);
+		pa = pin_temp(ctx, a, pa, pb, dst);
 		switch( ID2(pa->kind, pb->kind) ) {
 		case ID2(RFPU,RFPU):
 			op64(ctx,o,pa,pb);
@@ -1901,7 +2701,7 @@ static preg *op_binop( jit_ctx *ctx, vreg *dst, vreg *a, vreg *b, hl_op bop ) {
 				}
 				patch_jump(ctx,jnotnan);
 			}
-			scratch(pa);
+			if( pa != a->pin ) scratch(pa);
 			out = pa;
 			break;
 		default:
@@ -2627,6 +3427,130 @@ static void jit_longjump( jit_ctx *ctx ) {
 }
 #endif
 
+#ifdef HL_64
+/*
+	Exceptions (64 bits)
+
+	A function containing OTrap reserves a single hl_trap_ctx in its frame instead
+	of one setjmp buffer per try block. The prologue records rbp, rsp and the callee
+	saved registers, and each try block gets a state number : entering it saves the
+	previous state and filter in the slot of the new state, and links the record in
+	trap_current only if no other try of the frame is active. OEndTrap restores the
+	previous state from the slot.
+
+	The landing pads offsets are stored in a table after the function code. hl_throw
+	calls jit_throw_jump with the innermost record, which finds the landing pad of
+	the current state, restores the enclosing state and jumps there with the saved
+	registers. Records made by hl_trap in native code are still setjmp buffers and
+	are passed to longjmp.
+*/
+
+// the first two words of the buffer hold the record address and this magic
+#define JIT_TRAP_MAGIC		((int_val)0x4A49545452415053LL)
+
+typedef struct {
+	hl_trap_ctx trap;
+	hl_thread_info *thread;
+	int *table;
+	void *rbp;
+	void *rsp;
+	int_val state;
+	void *regs[PIN_CPU_COUNT];
+#	ifdef HL_WIN_CALL
+	double xmm[10];
+#	endif
+} jit_trap;
+
+typedef struct {
+	int_val parent;
+	vdynamic *tcheck;
+} jit_trap_slot;
+
+static void *jit_trap_landing_code = NULL;
+static void (*jit_trap_fallback)( jmp_buf, int ) = NULL;
+
+// buf is the start of the hl_trap_ctx, which is the start of the jit_trap for records made by the JIT
+static void jit_throw_jump( void *buf, int ret ) {
+	jit_trap *t = (jit_trap*)buf;
+	jit_trap_slot *slot;
+	void *self;
+	int_val magic;
+	int state;
+	memcpy(&self,buf,sizeof(void*));
+	memcpy(&magic,(char*)buf + HL_WSIZE,sizeof(int_val));
+	if( self != t || magic != JIT_TRAP_MAGIC ) {
+		jit_trap_fallback(buf,ret);
+		return;
+	}
+	state = (int)t->state;
+	slot = (jit_trap_slot*)(t + 1) + state;
+	// hl_throw has unlinked the record : relink it if an enclosing try of the frame is active
+	t->trap.tcheck = slot->tcheck;
+	t->state = slot->parent;
+	if( t->state >= 0 ) t->thread->trap_current = &t->trap;
+	((void (*)(jit_trap*,void*))jit_trap_landing_code)(t,(unsigned char*)t->table + t->table[state]);
+}
+
+static void jit_trap_landing( jit_ctx *ctx ) {
+	preg *t = REG_AT(CALL_REGS[0]);
+	jit_trap *tmp = NULL;
+	preg p;
+	int i;
+	op64(ctx,MOV,PEAX,REG_AT(CALL_REGS[1]));
+	for(i=0;i<PIN_CPU_COUNT;i++)
+		op64(ctx,MOV,REG_AT(PIN_CPU_REGS[i]),pmem(&p,t->id,(int)(int_val)&tmp->regs[i]));
+#	ifdef HL_WIN_CALL
+	for(i=0;i<10;i++)
+		op64(ctx,MOVSD,REG_AT(XMM(i+6)),pmem(&p,t->id,(int)(int_val)&tmp->xmm[i]));
+#	endif
+	op64(ctx,MOV,PEBP,pmem(&p,t->id,(int)(int_val)&tmp->rbp));
+	op64(ctx,MOV,PESP,pmem(&p,t->id,(int)(int_val)&tmp->rsp));
+	op64(ctx,JMP,PEAX,UNUSED);
+}
+
+static void trap_enter( jit_ctx *ctx, hl_thread_info *tinf ) {
+	jit_trap *t = NULL;
+	int base = -ctx->trapPos;
+	preg p;
+	int i;
+	for(i=0;i<PIN_CPU_COUNT;i++)
+		op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->regs[i]),REG_AT(PIN_CPU_REGS[i]));
+#	ifdef HL_WIN_CALL
+	for(i=0;i<10;i++)
+		op64(ctx,MOVSD,pmem(&p,Ebp,base + (int)(int_val)&t->xmm[i]),REG_AT(XMM(i+6)));
+#	endif
+	op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->rbp),PEBP);
+	op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->rsp),PESP);
+	scratch(PEAX);
+	op64(ctx,MOV,PEAX,pconst(&p,-1));
+	op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->state),PEAX);
+	op64(ctx,LEA,PEAX,pmem(&p,Ebp,base));
+	op64(ctx,MOV,pmem(&p,Ebp,base),PEAX);
+	op64(ctx,MOV,PEAX,pconst64(&p,JIT_TRAP_MAGIC));
+	op64(ctx,MOV,pmem(&p,Ebp,base + HL_WSIZE),PEAX);
+	op64(ctx,LEA,PEAX,pcodeaddr(&p,0));
+	ctx->trapTable = BUF_POS() - 4; // patched when the table is written
+	op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->table),PEAX);
+	if( tinf )
+		op64(ctx,MOV,PEAX,pconst64(&p,(int_val)tinf));
+	else
+		call_native(ctx,hl_get_thread,0);
+	op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->thread),PEAX);
+}
+
+static void trap_write_table( jit_ctx *ctx ) {
+	int i, pos;
+	jit_buf(ctx);
+	while( BUF_POS() & 3 ) B(0xCC);
+	pos = BUF_POS();
+	for(i=0;i<ctx->trapCount;i++) {
+		if( (i & 15) == 0 ) jit_buf(ctx);
+		W(ctx->trapLandings[i] - pos);
+	}
+	*(int*)(ctx->startBuf + ctx->trapTable) = pos - (ctx->trapTable + 4);
+}
+#endif
+
 static void jit_fail( uchar *msg ) {
 	if( msg == NULL ) {
 		hl_debug_break();
@@ -2700,10 +3624,25 @@ void hl_jit_init( jit_ctx *ctx, hl_module *m ) {
 	ctx->hl2c = jit_build(ctx, jit_hl2c);
 #	ifdef JIT_CUSTOM_LONGJUMP
 	ctx->longjump = jit_build(ctx, jit_longjump);
+#	endif
+#	ifdef HL_64
+	ctx->trapLanding = jit_build(ctx, jit_trap_landing);
 #	endif
 	ctx->static_functions[0] = (void*)(int_val)jit_build(ctx,jit_null_access);
 	ctx->static_functions[1] = (void*)(int_val)jit_build(ctx,jit_assert);
 	ctx->static_functions[2] = (void*)(int_val)jit_build(ctx,jit_null_field_access);
+	// inlined code can't be patched or stepped into
+	ctx->inlineCalls = m->hash == NULL && !m->jit_debugger;
+#	ifndef HL_CONSOLE
+	if( getenv("HL_JIT_NO_INLINE") ) ctx->inlineCalls = false;
+#	endif
+	ctx->intrinsics = true;
+#	ifndef HL_CONSOLE
+	if( getenv("HL_JIT_NO_INTRINSICS") ) ctx->intrinsics = false;
+#	endif
+#	if defined(HL_64) && !defined(HL_CONSOLE)
+	ctx->globalRegs = !m->jit_debugger && getenv("HL_JIT_GLOBAL_REGS") != NULL;
+#	endif
 }
 
 void hl_jit_reset( jit_ctx *ctx, hl_module *m ) {
@@ -2852,6 +3791,318 @@ static void make_dyn_cast( jit_ctx *ctx, vreg *dst, vreg *v ) {
 	store_result(ctx, dst);
 }
 
+/*
+	Inlining of small leaf functions
+
+	Before compiling a function, direct calls (OCall0..OCall4) to small straight-line
+	functions are replaced by the callee ops, with its registers renamed after the
+	caller ones. The function ops, registers and debug infos are updated so that
+	each inlined op keeps the file and line of the callee. Callees must not contain
+	jumps, calls or other ops that can call into the runtime (except null checks).
+	Disabled with hot reload (callees can change) and when the debugger is used.
+*/
+
+#define INLINE_MAX_OPS		8
+#define INLINE_BUDGET		256 // max extra ops per caller
+
+static bool inline_is_obj( hl_type *t ) {
+	return t->kind == HOBJ || t->kind == HSTRUCT;
+}
+
+static bool inline_can_op( hl_function *g, hl_opcode *o ) {
+	switch( o->op ) {
+	case OMov:
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OAdd:
+	case OSub:
+	case OMul:
+	case OSDiv:
+	case OUDiv:
+	case OUMod:
+	case OShl:
+	case OSShr:
+	case OUShr:
+	case OAnd:
+	case OOr:
+	case OXor:
+	case ONeg:
+	case ONot:
+	case OIncr:
+	case ODecr:
+	case OGetGlobal:
+	case OSetGlobal:
+	case OToSFloat:
+	case OToUFloat:
+	case OToInt:
+	case OUnsafeCast:
+	case ONullCheck:
+	case OGetI8:
+	case OGetI16:
+	case OGetMem:
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case ONop:
+		return true;
+	case OSMod:
+		// float modulo calls fmod
+		return g->regs[o->p1]->kind != HF32 && g->regs[o->p1]->kind != HF64;
+	case OField:
+		return inline_is_obj(g->regs[o->p2]);
+	case OSetField:
+		return inline_is_obj(g->regs[o->p1]);
+	case OGetThis:
+	case OSetThis:
+		return inline_is_obj(g->regs[0]);
+	default:
+		return false;
+	}
+}
+
+static hl_function *inline_target( jit_ctx *ctx, hl_function *f, hl_opcode *o ) {
+	hl_module *m = ctx->m;
+	hl_function *g;
+	int i, fid, nargs;
+	if( o->op < OCall0 || o->op > OCall4 )
+		return NULL;
+	fid = m->functions_indexes[o->p2];
+	if( fid >= m->code->nfunctions )
+		return NULL; // native
+	g = m->code->functions + fid;
+	nargs = o->op - OCall0;
+	if( g == f || g->nops > INLINE_MAX_OPS || g->type->fun->nargs != nargs || g->ops[g->nops-1].op != ORet )
+		return NULL;
+	for(i=0;i<g->nops-1;i++)
+		if( !inline_can_op(g,g->ops + i) )
+			return NULL;
+	// arguments and result are plain moves, they must have the same representation
+	for(i=0;i<nargs;i++) {
+		int r = i == 0 ? o->p3 : (i == 1 && nargs == 2 ? (int)(int_val)o->extra : o->extra[i-1]);
+		if( f->regs[r]->kind != g->regs[i]->kind )
+			return NULL;
+	}
+	if( f->regs[o->p1]->kind != HVOID && f->regs[o->p1]->kind != g->regs[g->ops[g->nops-1].p1]->kind )
+		return NULL;
+	return g;
+}
+
+static void inline_rename( hl_opcode *o, int base ) {
+	switch( o->op ) {
+	case OGetThis:
+		// this is the first callee register, no longer R(0)
+		o->op = OField;
+		o->p3 = o->p2;
+		o->p2 = 0;
+		break;
+	case OSetThis:
+		o->op = OSetField;
+		o->p3 = o->p2;
+		o->p2 = o->p1;
+		o->p1 = 0;
+		break;
+	default:
+		break;
+	}
+	switch( o->op ) {
+	case OSetGlobal:
+		o->p2 += base;
+		break;
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OIncr:
+	case ODecr:
+	case OGetGlobal:
+	case ONullCheck:
+	case ORet:
+		o->p1 += base;
+		break;
+	case OMov:
+	case ONeg:
+	case ONot:
+	case OToSFloat:
+	case OToUFloat:
+	case OToInt:
+	case OUnsafeCast:
+	case OField:
+		o->p1 += base;
+		o->p2 += base;
+		break;
+	case OSetField:
+		o->p1 += base;
+		o->p3 += base;
+		break;
+	case ONop:
+		break;
+	default:
+		o->p1 += base;
+		o->p2 += base;
+		o->p3 += base;
+		break;
+	}
+}
+
+static void inline_calls( jit_ctx *ctx, hl_function *f ) {
+	hl_code *c = ctx->m->code;
+	int i, k, extra = 0, nops = 0, nregs = f->nregs;
+	int *map;
+	hl_opcode *ops;
+	hl_type **regs;
+	hl_function **targets = NULL;
+	int *debug = NULL, *fdebug = NULL;
+	// select the calls to inline : debug infos are only decoded for these callees
+	for(i=0;i<f->nops;i++) {
+		hl_function *g = inline_target(ctx,f,f->ops + i);
+		if( g == NULL || extra + g->nops + g->type->fun->nargs > INLINE_BUDGET ) continue;
+		if( c->hasdebug && hl_get_debug_infos(c,g) == NULL ) continue;
+		if( targets == NULL ) targets = (hl_function**)hl_zalloc(&ctx->falloc,sizeof(hl_function*) * f->nops);
+		targets[i] = g;
+		extra += g->nops + g->type->fun->nargs;
+		nregs += g->nregs;
+	}
+	if( extra == 0 )
+		return;
+	map = (int*)hl_malloc(&ctx->falloc,sizeof(int) * (f->nops + 1));
+	ops = (hl_opcode*)hl_malloc(&c->falloc,sizeof(hl_opcode) * (f->nops + extra));
+	regs = (hl_type**)hl_malloc(&c->falloc,sizeof(hl_type*) * nregs);
+	if( c->hasdebug ) fdebug = hl_get_debug_infos(c,f);
+	if( fdebug ) debug = (int*)hl_malloc(&c->alloc,sizeof(int) * 2 * (f->nops + extra));
+	memcpy(regs,f->regs,sizeof(hl_type*) * f->nregs);
+	nregs = f->nregs;
+#	define EMIT(o,dpos,ddebug) { ops[nops] = o; if( debug ) { debug[nops<<1] = ddebug[(dpos)<<1]; debug[(nops<<1)|1] = ddebug[((dpos)<<1)|1]; } nops++; }
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		hl_function *g = targets[i];
+		map[i] = nops;
+		if( g ) {
+			int base = nregs, nargs = g->type->fun->nargs, start = nops;
+			hl_opcode tmp;
+			memcpy(regs + base,g->regs,sizeof(hl_type*) * g->nregs);
+			nregs += g->nregs;
+			for(k=0;k<nargs;k++) {
+				tmp.op = OMov;
+				tmp.p1 = base + k;
+				tmp.p2 = k == 0 ? o->p3 : (k == 1 && nargs == 2 ? (int)(int_val)o->extra : o->extra[k-1]);
+				tmp.p3 = 0;
+				tmp.extra = NULL;
+				EMIT(tmp,i,fdebug);
+			}
+			for(k=0;k<g->nops-1;k++) {
+				tmp = g->ops[k];
+				inline_rename(&tmp,base);
+				EMIT(tmp,k,g->debug);
+			}
+			if( regs[o->p1]->kind != HVOID ) {
+				tmp.op = OMov;
+				tmp.p1 = o->p1;
+				tmp.p2 = base + g->ops[g->nops-1].p1;
+				tmp.p3 = 0;
+				tmp.extra = NULL;
+				EMIT(tmp,g->nops-1,g->debug);
+			}
+			if( nops == start ) {
+				tmp.op = ONop;
+				tmp.p1 = tmp.p2 = tmp.p3 = 0;
+				tmp.extra = NULL;
+				EMIT(tmp,i,fdebug);
+			}
+			continue;
+		}
+		EMIT(*o,i,fdebug);
+	}
+#	undef EMIT
+	map[f->nops] = nops;
+	// relocate jumps
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = ops + map[i];
+		int pos = map[i] + 1;
+		switch( o->op ) {
+		case OJTrue:
+		case OJFalse:
+		case OJNull:
+		case OJNotNull:
+		case OTrap:
+			o->p2 = map[i + 1 + o->p2] - pos;
+			break;
+		case OJSLt:
+		case OJSGte:
+		case OJSGt:
+		case OJSLte:
+		case OJULt:
+		case OJUGte:
+		case OJNotLt:
+		case OJNotGte:
+		case OJEq:
+		case OJNotEq:
+			o->p3 = map[i + 1 + o->p3] - pos;
+			break;
+		case OJAlways:
+			o->p1 = map[i + 1 + o->p1] - pos;
+			break;
+		case OSwitch:
+			{
+				int *cases = (int*)hl_malloc(&c->falloc,sizeof(int) * o->p2);
+				for(k=0;k<o->p2;k++)
+					cases[k] = map[i + 1 + o->extra[k]] - pos;
+				o->extra = cases;
+				o->p3 = map[i + 1 + o->p3] - pos;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	f->ops = ops;
+	f->nops = nops;
+	f->regs = regs;
+	f->nregs = nregs;
+	if( debug ) f->debug = debug;
+}
+
+static void op_trap_filter( jit_ctx *ctx, hl_opcode *o, int opCount, vreg *dst, preg *treg ) {
+	hl_function *f = ctx->f;
+	hl_module *m = ctx->m;
+	preg p;
+	/*
+		This is a bit hackshish : we want to detect the type of exception filtered by the catch so we check the following
+		sequence of HL opcodes:
+
+		trap E,@catch
+		...
+		@catch:
+		global R, _
+		call _, ???(R,E)
+
+		??? is expected to be hl.BaseType.check
+	*/
+	hl_opcode *next = f->ops + opCount + 1 + o->p2;
+	hl_opcode *next2 = f->ops + opCount + 2 + o->p2;
+	if( next->op == OGetGlobal && next2->op == OCall2 && next2->p3 == next->p1 && dst->stack.id == (int)(int_val)next2->extra ) {
+		hl_type *gt = m->code->globals[next->p2];
+		while( gt->kind == HOBJ && gt->obj->super ) gt = gt->obj->super;
+		if( gt->kind == HOBJ && gt->obj->nfields && gt->obj->fields[0].t->kind == HTYPE ) {
+			void *addr = m->globals_data + m->globals_indexes[next->p2];
+#	ifdef HL_64
+			op64(ctx,MOV,treg,pconst64(&p,(int_val)addr));
+			op64(ctx,MOV,treg,pmem(&p,treg->id,0));
+#	else
+			op64(ctx,MOV,treg,paddr(&p,addr));
+#	endif
+		} else
+			op64(ctx,MOV,treg,pconst(&p,0));
+	} else {
+		op64(ctx,MOV,treg,pconst(&p,0));
+	}
+}
+
 int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 	int i, size = 0, opCount;
 	int codePos = BUF_POS();
@@ -2860,7 +4111,9 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 	int *debug32 = NULL;
 	call_regs cregs = {0};
 	hl_thread_info *tinf = NULL;
+	int trapIndex = 0;
 	preg p;
+	if( ctx->inlineCalls ) inline_calls(ctx,f);
 	ctx->f = f;
 	ctx->allocOffset = 0;
 	if( f->nregs > ctx->maxRegs ) {
@@ -2887,10 +4140,13 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		r->t = f->regs[i];
 		r->size = hl_type_size(r->t);
 		r->current = NULL;
+		r->pin = NULL;
 		r->stack.holds = NULL;
 		r->stack.id = i;
 		r->stack.kind = RSTACK;
 	}
+	R(f->nregs)->pin = NULL;
+	pin_analyze(ctx,f);
 	size = 0;
 	int argsSize = 0;
 	for(i=0;i<nargs;i++) {
@@ -2913,6 +4169,22 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		size += hl_pad_size(size,r->t); // align local vars
 		r->stackPos = -size;
 	}
+	// callee-saved registers used by pinned vregs
+	ctx->pinSavePos = size;
+	for(i=0;i<PIN_CPU_COUNT;i++)
+		if( ctx->pinSaveMask & (1 << i) ) size += HL_WSIZE;
+#	ifdef HL_64
+	// exception record and one slot per try block
+	ctx->trapCount = 0;
+	for(i=0;i<f->nops;i++)
+		if( f->ops[i].op == OTrap ) ctx->trapCount++;
+	if( ctx->trapCount ) {
+		size += sizeof(jit_trap) + ctx->trapCount * sizeof(jit_trap_slot);
+		size += (-size) & 15;
+		ctx->trapPos = size;
+		ctx->trapLandings = (int*)hl_malloc(&ctx->falloc,sizeof(int) * ctx->trapCount);
+	}
+#	endif
 #	ifdef HL_64
 	size += (-size) & 15; // align on 16 bytes
 #	else
@@ -2937,6 +4209,15 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		}
 	}
 #	endif
+#	ifdef HL_64
+	if( ctx->trapCount ) {
+#		ifndef HL_THREADS
+		tinf = hl_get_thread();
+#		endif
+		trap_enter(ctx,tinf);
+	}
+#	endif
+	if( ctx->pinCount ) pin_enter(ctx,0);
 	if( ctx->m->code->hasdebug ) {
 		debug16 = (unsigned short*)malloc(sizeof(unsigned short) * (f->nops + 1));
 		debug16[0] = (unsigned short)(BUF_POS() - codePos);
@@ -3098,10 +4379,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			register_jump(ctx,jump,(opCount + 1) + o->p1);
 			break;
 		case OToDyn:
-			if( ra->t->kind == HBOOL ) {
+			if( ra->t->kind == HBOOL || ra->t->kind == HI32 ) {
 				int size = begin_native_call(ctx, 1);
 				set_native_arg(ctx, fetch(ra));
-				call_native(ctx, hl_alloc_dynbool, size);
+				call_native(ctx, ra->t->kind == HBOOL ? (void*)hl_alloc_dynbool : (void*)hl_alloc_dyni32, size);
 				store(ctx, dst, PEAX, true);
 			} else {
 				int_val rt = (int_val)ra->t;
@@ -4105,6 +5386,52 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			}
 			break;
 		case OTrap:
+#			ifdef HL_64
+			{
+				int jnested, jlinked, jenter, jtrap;
+				jit_trap *t = NULL;
+				hl_thread_info *ti = NULL;
+				int base = -ctx->trapPos;
+				int slot = base + (int)sizeof(jit_trap) + trapIndex * (int)sizeof(jit_trap_slot);
+				preg *rcx = REG_AT(Ecx), *rdx = REG_AT(Edx);
+				discard_regs(ctx,true);
+				// save the enclosing state and filter
+				op64(ctx,MOV,rcx,pmem(&p,Ebp,base + (int)(int_val)&t->state));
+				op64(ctx,MOV,pmem(&p,Ebp,slot),rcx);
+				op64(ctx,MOV,rdx,pmem(&p,Ebp,base + (int)(int_val)&t->trap.tcheck));
+				op64(ctx,MOV,pmem(&p,Ebp,slot + HL_WSIZE),rdx);
+				op64(ctx,MOV,PEAX,pconst(&p,trapIndex));
+				op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->state),PEAX);
+				op_trap_filter(ctx,o,opCount,dst,PEAX);
+				// the record is seen as a single trap : it catches everything unless an enclosing try of the frame has the same filter
+				op64(ctx,CMP,rcx,pconst(&p,-1));
+				XJump_small(JEq,jnested);
+				op64(ctx,CMP,rdx,PEAX);
+				XJump_small(JEq,jlinked);
+				op64(ctx,XOR,PEAX,PEAX);
+				patch_jump(ctx,jlinked);
+				patch_jump(ctx,jnested);
+				op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->trap.tcheck),PEAX);
+				op64(ctx,CMP,rcx,pconst(&p,-1));
+				XJump_small(JNeq,jlinked);
+				op64(ctx,MOV,PEAX,pmem(&p,Ebp,base + (int)(int_val)&t->thread));
+				op64(ctx,MOV,rdx,pmem(&p,Eax,(int)(int_val)&ti->trap_current));
+				op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->trap.prev),rdx);
+				op64(ctx,LEA,rdx,pmem(&p,Ebp,base));
+				op64(ctx,MOV,pmem(&p,Eax,(int)(int_val)&ti->trap_current),rdx);
+				patch_jump(ctx,jlinked);
+				XJump(JAlways,jenter);
+				// landing pad, registers are restored by jit_throw_jump
+				ctx->trapLandings[trapIndex++] = BUF_POS();
+				op64(ctx,MOV,PEAX,pmem(&p,Ebp,base + (int)(int_val)&t->thread));
+				op64(ctx,MOV,PEAX,pmem(&p,Eax,(int)(int_val)&ti->exc_value));
+				store(ctx,dst,PEAX,false);
+				if( ctx->pinCount ) pin_reload(ctx,false);
+				jtrap = do_jump(ctx,OJAlways,false);
+				register_jump(ctx,jtrap,(opCount + 1) + o->p2);
+				patch_jump(ctx,jenter);
+			}
+#			else
 			{
 				int size, jenter, jtrap;
 				int offset = 0;
@@ -4136,36 +5463,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 				op64(ctx,MOV,trap,PESP);
 				op64(ctx,MOV,pmem(&p,treg->id,offset),trap);
 
-				/*
-					This is a bit hackshish : we want to detect the type of exception filtered by the catch so we check the following
-					sequence of HL opcodes:
-
-					trap E,@catch
-					...
-					@catch:
-					global R, _
-					call _, ???(R,E)
-
-					??? is expected to be hl.BaseType.check
-				*/
-				hl_opcode *next = f->ops + opCount + 1 + o->p2;
-				hl_opcode *next2 = f->ops + opCount + 2 + o->p2;
-				if( next->op == OGetGlobal && next2->op == OCall2 && next2->p3 == next->p1 && dst->stack.id == (int)(int_val)next2->extra ) {
-					hl_type *gt = m->code->globals[next->p2];
-					while( gt->kind == HOBJ && gt->obj->super ) gt = gt->obj->super;
-					if( gt->kind == HOBJ && gt->obj->nfields && gt->obj->fields[0].t->kind == HTYPE ) {
-						void *addr = m->globals_data + m->globals_indexes[next->p2];
-#						ifdef HL_64
-						op64(ctx,MOV,treg,pconst64(&p,(int_val)addr));
-						op64(ctx,MOV,treg,pmem(&p,treg->id,0));
-#						else
-						op64(ctx,MOV,treg,paddr(&p,addr));
-#						endif
-					} else
-						op64(ctx,MOV,treg,pconst(&p,0));
-				} else {
-					op64(ctx,MOV,treg,pconst(&p,0));
-				}
+				op_trap_filter(ctx,o,opCount,dst,treg);
 				op64(ctx,MOV,pmem(&p,Esp,(int)(int_val)&t->tcheck),treg);
 
 				size = begin_native_call(ctx, 1);
@@ -4182,13 +5480,39 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 					op64(ctx,MOV,PEAX,pmem(&p, Eax, 0));
 				}
 				store(ctx,dst,PEAX,false);
+				if( ctx->pinCount ) pin_reload(ctx,false);
 
 				jtrap = do_jump(ctx,OJAlways,false);
 				register_jump(ctx,jtrap,(opCount + 1) + o->p2);
 				patch_jump(ctx,jenter);
 			}
+#			endif
 			break;
 		case OEndTrap:
+#			ifdef HL_64
+			{
+				int jlinked;
+				jit_trap *t = NULL;
+				hl_thread_info *ti = NULL;
+				int base = -ctx->trapPos;
+				preg *rcx = REG_AT(Ecx);
+				scratch(PEAX);
+				scratch(rcx);
+				// restore the enclosing state from the slot of the current one
+				op64(ctx,MOV,PEAX,pmem(&p,Ebp,base + (int)(int_val)&t->state));
+				op64(ctx,SHL,PEAX,pconst(&p,4));
+				op64(ctx,MOV,rcx,pmem2(&p,Ebp,Eax,1,base + (int)sizeof(jit_trap)));
+				op64(ctx,MOV,PEAX,pmem2(&p,Ebp,Eax,1,base + (int)sizeof(jit_trap) + HL_WSIZE));
+				op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->trap.tcheck),PEAX);
+				op64(ctx,MOV,pmem(&p,Ebp,base + (int)(int_val)&t->state),rcx);
+				op64(ctx,CMP,rcx,pconst(&p,-1));
+				XJump_small(JNeq,jlinked);
+				op64(ctx,MOV,PEAX,pmem(&p,Ebp,base + (int)(int_val)&t->thread));
+				op64(ctx,MOV,rcx,pmem(&p,Ebp,base + (int)(int_val)&t->trap.prev));
+				op64(ctx,MOV,pmem(&p,Eax,(int)(int_val)&ti->trap_current),rcx);
+				patch_jump(ctx,jlinked);
+			}
+#			else
 			{
 				int trap_size = (sizeof(hl_trap_ctx) + 15) & 0xFFF0;
 				hl_trap_ctx *tmp = NULL;
@@ -4221,6 +5545,7 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 #				endif
 				op64(ctx,ADD,PESP,pconst(&p,trap_size));
 			}
+#			endif
 			break;
 		case OEnumIndex:
 			{
@@ -4364,9 +5689,11 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 			jit_error(hl_op_name(o->op));
 			break;
 		}
+		if( ctx->pinCount ) pin_sync(ctx,opCount);
 		// we are landing at this position, assume we have lost our registers
 		if( ctx->opsPos[opCount+1] == -1 )
 			discard_regs(ctx,true);
+		if( ctx->pinCount ) pin_enter(ctx,opCount + 1);
 		ctx->opsPos[opCount+1] = BUF_POS();
 
 		// write debug infos
@@ -4390,6 +5717,10 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		}
 		ctx->jumps = NULL;
 	}
+#	ifdef HL_64
+	if( ctx->trapCount ) trap_write_table(ctx);
+	ctx->trapCount = 0;
+#	endif
 	// add nops padding
 	jit_nops(ctx);
 	// clear regs
@@ -4397,7 +5728,11 @@ int hl_jit_function( jit_ctx *ctx, hl_module *m, hl_function *f ) {
 		preg *r = REG_AT(i);
 		r->holds = NULL;
 		r->lock = 0;
+		ctx->pinActive[i] = NULL;
 	}
+	ctx->pins = NULL;
+	ctx->pinCount = 0;
+	ctx->pinSaveMask = 0;
 	// save debug infos
 	{
 		int fid = (int)(f - m->code->functions);
@@ -4459,8 +5794,14 @@ void *hl_jit_code( jit_ctx *ctx, hl_module *m, int *codesize, hl_debug_infos **d
 		call_jit_c2hl = code + ctx->c2hl;
 		call_jit_hl2c = code + ctx->hl2c;
 		hl_setup_callbacks2(callback_c2hl, get_wrapper, 1);
-#		ifdef JIT_CUSTOM_LONGJUMP
-		hl_setup_longjump(code + ctx->longjump);
+#		ifdef HL_64
+		jit_trap_landing_code = code + ctx->trapLanding;
+#			ifdef JIT_CUSTOM_LONGJUMP
+		jit_trap_fallback = (void (*)(jmp_buf,int))(code + ctx->longjump);
+#			else
+		jit_trap_fallback = longjmp;
+#			endif
+		hl_setup_longjump(jit_throw_jump);
 #		endif
 		int i;
 		for(i=0;i<sizeof(ctx->static_functions)/sizeof(void*);i++)
@@ -32,6 +32,11 @@ typedef uchar pchar;
 #define PSTR(x) USTR(x)
 #else
 #	include <sys/stat.h>
+#	if defined(HL_LINUX) || defined(HL_MAC)
+#		include <sys/mman.h>
+#		include <fcntl.h>
+#		include <unistd.h>
+#	endif
 typedef char pchar;
 #define pprintf printf
 #define pfopen fopen
@@ -60,11 +65,62 @@ static int pfiletime( pchar *file )	{
 #endif
 }
 
+static int opt_level = 1;
+static bool map_code = true;
+
+/*
+	Map the bytecode file in memory so hl_code_read_inplace can reference the
+	strings and bytes without copying them. The mapping is private (writes to
+	constant bytes are not seen by the file) and is never released since the
+	JIT embeds pointers to these constants.
+*/
+static char *map_file( const pchar *file, int *size ) {
+#if defined(HL_LINUX) || defined(HL_MAC)
+	struct stat st;
+	void *data;
+	int fd = open(file, O_RDONLY);
+	if( fd < 0 )
+		return NULL;
+	if( fstat(fd, &st) < 0 || st.st_size == 0 || st.st_size > 0x7FFFFFFF ) {
+		close(fd);
+		return NULL;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if( data == MAP_FAILED )
+		return NULL;
+	*size = (int)st.st_size;
+	return (char*)data;
+#else
+	return NULL;
+#endif
+}
+
+static void unmap_file( char *data, int size ) {
+#if defined(HL_LINUX) || defined(HL_MAC)
+	munmap(data, size);
+#endif
+}
+
 static hl_code *load_code( const pchar *file, char **error_msg, bool print_errors ) {
 	hl_code *code;
-	FILE *f = pfopen(file,"rb");
+	FILE *f;
 	int pos, size;
-	char *fdata;
+	hl_startup_begin(t);
+	char *fdata = map_code ? map_file(file, &size) : NULL;
+	if( fdata ) {
+		hl_startup_mark(t,file_read);
+		code = hl_code_read_inplace((unsigned char*)fdata, size, error_msg);
+		hl_startup_mark(t,code_read);
+		if( code == NULL )
+			unmap_file(fdata, size);
+		else {
+			hl_code_optimize(code, opt_level);
+			hl_startup_mark(t,optimize);
+		}
+		return code;
+	}
+	f = pfopen(file,"rb");
 	if( f == NULL ) {
 		if( print_errors ) pprintf("File not found '%s'\n",file);
 		return NULL;
@@ -83,8 +139,14 @@ static hl_code *load_code( const pchar *file, char **error_msg, bool print_error
 		pos += r;
 	}
 	fclose(f);
+	hl_startup_mark(t,file_read);
 	code = hl_code_read((unsigned char*)fdata, size, error_msg);
 	free(fdata);
+	hl_startup_mark(t,code_read);
+	if( code ) {
+		hl_code_optimize(code, opt_level);
+		hl_startup_mark(t,optimize);
+	}
 	return code;
 }
 
@@ -103,6 +165,99 @@ static bool check_reload( main_context *m ) {
 	return changed;
 }
 
+#define STARTUP_TOP	10
+#define STARTUP_MS(v)	((v) * 1000.)
+
+static int startup_top( hl_startup_profile *p, int *top ) {
+	int i, k, count = 0;
+	for(i=0;i<p->nfunctions;i++) {
+		double v = p->functions[i];
+		if( count == STARTUP_TOP && v <= p->functions[top[count-1]] )
+			continue;
+		k = count < STARTUP_TOP ? count++ : count - 1;
+		while( k > 0 && p->functions[top[k-1]] < v ) {
+			top[k] = top[k-1];
+			k--;
+		}
+		top[k] = i;
+	}
+	return count;
+}
+
+static void startup_json_string( FILE *f, const char *s ) {
+	fputc('"',f);
+	while( *s ) {
+		char c = *s++;
+		if( c == '"' || c == '\\' )
+			fputc('\\',f);
+		if( (unsigned char)c >= 0x20 ) fputc(c,f);
+	}
+	fputc('"',f);
+}
+
+static void startup_report( hl_startup_profile *p, hl_module *m, const pchar *json_file ) {
+	int top[STARTUP_TOP];
+	int ntop = p->functions ? startup_top(p,top) : 0;
+	char name[256];
+	int i;
+	if( json_file ) {
+		FILE *f = pfopen(json_file,"wb");
+		if( f == NULL ) {
+			fprintf(stderr,"Could not write startup profile\n");
+			return;
+		}
+		fprintf(f,"{\n");
+#		define JFIELD(n,v)	fprintf(f,"\t\"%s\": %.3f,\n",n,STARTUP_MS(v))
+		JFIELD("file_read",p->file_read);
+		JFIELD("code_read",p->code_read);
+		JFIELD("code_strings",p->code_strings);
+		JFIELD("code_types",p->code_types);
+		JFIELD("code_functions",p->code_functions);
+		JFIELD("code_debug",p->code_debug);
+		JFIELD("optimize",p->optimize);
+		JFIELD("module_alloc",p->module_alloc);
+		JFIELD("natives",p->natives);
+		JFIELD("jit",p->jit);
+		JFIELD("jit_finalize",p->jit_finalize);
+		JFIELD("constants",p->constants);
+		JFIELD("entrypoint",p->entrypoint);
+#		undef JFIELD
+		fprintf(f,"\t\"functions\": %d,\n\t\"libs\": [",p->nfunctions);
+		for(i=0;i<p->nlibs;i++) {
+			fprintf(f,"%s\n\t\t{ \"name\": ",i ? "," : "");
+			startup_json_string(f,p->libs[i].name);
+			fprintf(f,", \"natives\": %d, \"time\": %.3f }",p->libs[i].natives,STARTUP_MS(p->libs[i].time));
+		}
+		fprintf(f,"\n\t],\n\t\"slowest\": [");
+		for(i=0;i<ntop;i++) {
+			hl_module_fun_name(m->code->functions + top[i],name,sizeof(name));
+			fprintf(f,"%s\n\t\t{ \"name\": ",i ? "," : "");
+			startup_json_string(f,name);
+			fprintf(f,", \"time\": %.3f }",STARTUP_MS(p->functions[top[i]]));
+		}
+		fprintf(f,"\n\t]\n}\n");
+		fclose(f);
+		return;
+	}
+	fprintf(stderr,"Startup profile (ms)\n");
+	fprintf(stderr,"  file read     %10.3f\n",STARTUP_MS(p->file_read));
+	fprintf(stderr,"  code read     %10.3f  (strings %.3f, types %.3f, functions %.3f, debug %.3f)\n",STARTUP_MS(p->code_read),STARTUP_MS(p->code_strings),STARTUP_MS(p->code_types),STARTUP_MS(p->code_functions),STARTUP_MS(p->code_debug));
+	fprintf(stderr,"  optimize      %10.3f\n",STARTUP_MS(p->optimize));
+	fprintf(stderr,"  module alloc  %10.3f\n",STARTUP_MS(p->module_alloc));
+	fprintf(stderr,"  natives       %10.3f\n",STARTUP_MS(p->natives));
+	for(i=0;i<p->nlibs;i++)
+		fprintf(stderr,"    %-12s%10.3f  (%d natives)\n",p->libs[i].name,STARTUP_MS(p->libs[i].time),p->libs[i].natives);
+	fprintf(stderr,"  jit           %10.3f  (%d functions)\n",STARTUP_MS(p->jit),p->nfunctions);
+	fprintf(stderr,"  jit finalize  %10.3f\n",STARTUP_MS(p->jit_finalize));
+	fprintf(stderr,"  constants     %10.3f\n",STARTUP_MS(p->constants));
+	fprintf(stderr,"  entrypoint    %10.3f  (since process start)\n",STARTUP_MS(p->entrypoint));
+	if( ntop ) fprintf(stderr,"  slowest functions to JIT\n");
+	for(i=0;i<ntop;i++) {
+		hl_module_fun_name(m->code->functions + top[i],name,sizeof(name));
+		fprintf(stderr,"    %10.3f  %s\n",STARTUP_MS(p->functions[top[i]]),name);
+	}
+}
+
 #ifdef HL_VCC
 // this allows some runtime detection to switch to high performance mode
 __declspec(dllexport) DWORD NvOptimusEnablement = 1;
@@ -145,6 +300,10 @@ int main(int argc, pchar *argv[]) {
 	bool debug_wait = false;
 	bool hot_reload = false;
 	int profile_count = -1;
+	bool startup_profile = false;
+	pchar *startup_json = NULL;
+	hl_startup_profile startup;
+	double start_time = hl_sys_time();
 	main_context ctx;
 	bool isExc = false;
 	int first_boot_arg = -1;
@@ -171,6 +330,16 @@ int main(int argc, pchar *argv[]) {
 			hot_reload = true;
 			continue;
 		}
+		if( pcompare(arg,PSTR("--startup-profile")) == 0 ) {
+			startup_profile = true;
+			continue;
+		}
+		if( pcompare(arg,PSTR("--startup-profile-json")) == 0 ) {
+			if( argc-- == 0 ) break;
+			startup_profile = true;
+			startup_json = *argv++;
+			continue;
+		}
 		if( pcompare(arg,PSTR("--profile")) == 0 ) {
 			if( argc-- == 0 ) break;
 			profile_count = ptoi(*argv++);
@@ -202,18 +371,37 @@ int main(int argc, pchar *argv[]) {
 			argc = first_boot_arg;
 		}
 	}
+	{
+		char *level = getenv("HL_OPT_LEVEL");
+		if( level ) opt_level = atoi(level);
+		// keep the bytecode as compiled for the debugger and hot reload
+		if( debug_port > 0 || hot_reload ) opt_level = 0;
+		// the file will be rewritten while the mapping is still used
+		if( hot_reload ) map_code = false;
+	}
 	hl_global_init();
 	hl_sys_init((void**)argv,argc,file);
 	hl_register_thread(&ctx);
 	ctx.file = file;
+	if( startup_profile ) {
+		memset(&startup,0,sizeof(startup));
+		hl_startup = &startup;
+	}
 	ctx.code = load_code(file, &error_msg, true);
 	if( ctx.code == NULL ) {
 		if( error_msg ) printf("%s\n", error_msg);
 		return 1;
 	}
-	ctx.m = hl_module_alloc(ctx.code);
+	{
+		hl_startup_begin(t);
+		ctx.m = hl_module_alloc(ctx.code);
+		hl_startup_mark(t,module_alloc);
+	}
 	if( ctx.m == NULL )
 		return 2;
+	// breakpoints can't be set in inlined functions, and locals written by the
+	// debugger must not be kept in registers
+	ctx.m->jit_debugger = debug_port > 0;
 	if( !hl_module_init(ctx.m,hot_reload) )
 		return 3;
 	if( hot_reload ) {
@@ -229,6 +417,12 @@ int main(int argc, pchar *argv[]) {
 	cl.fun = ctx.m->functions_ptrs[ctx.m->code->entrypoint];
 	cl.hasValue = 0;
 	setup_handler();
+	if( hl_startup ) {
+		hl_startup->entrypoint = hl_sys_time() - start_time;
+		startup_report(hl_startup,ctx.m,startup_json);
+		free(hl_startup->functions);
+		hl_startup = NULL;
+	}
 	hl_profile_setup(profile_count);
 	ctx.ret = hl_dyn_call_safe(&cl,NULL,0,&isExc);
 	hl_profile_end();
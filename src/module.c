@@ -38,56 +38,266 @@ HL_API void hl_prim_not_loaded( const uchar *err );
 static hl_module **cur_modules = NULL;
 static int modules_count = 0;
 
-static bool module_resolve_pos( hl_module *m, void *addr, int *fidx, int *fpos ) {
-	int code_pos = ((int)(int_val)((unsigned char*)addr - (unsigned char*)m->jit_code));
-	int min, max;
-	hl_debug_infos *dbg;
-	hl_function *fdebug;
+hl_startup_profile *hl_startup = NULL;
+
+/*
+	Symbols index : a sorted array of the functions code positions, built
+	with the module, and for each function a delta-encoded table of its
+	(code offset, op, file, line) runs, built on first lookup. A checkpoint
+	every SYMBOL_CHECK runs keeps lookups short in large functions, and
+	formatted symbols are cached per run so repeated frames are not
+	formatted again.
+*/
+#define SYMBOL_CHECK	16
+
+typedef struct {
+	int pos;
+	int op;
+	int file;
+	int line;
+	int offset;
+} symbol_check;
+
+typedef struct {
+	int nruns;
+	unsigned char *runs;
+	symbol_check *checks;
+	uchar **names;
+} symbol_lines;
+
+struct hl_symbol_index {
+	int count;
+	int *starts;
+	int *fidx;
+	symbol_lines **lines;
+};
+
+static void symbols_write( unsigned char **p, unsigned int v ) {
+	unsigned char *b = *p;
+	while( v >= 0x80 ) {
+		*b++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*b++ = (unsigned char)v;
+	*p = b;
+}
+
+static unsigned int symbols_read( unsigned char **p ) {
+	unsigned char *b = *p;
+	unsigned int v = 0;
+	int shift = 0;
+	while( *b & 0x80 ) {
+		v |= (*b++ & 0x7F) << shift;
+		shift += 7;
+	}
+	v |= *b++ << shift;
+	*p = b;
+	return v;
+}
+
+static void module_free_symbols( hl_module *m ) {
+	hl_symbol_index *s = m->symbols;
+	int i;
+	if( s == NULL ) return;
+	for(i=0;i<s->count;i++) {
+		symbol_lines *l = s->lines[i];
+		int k;
+		if( l == NULL ) continue;
+		for(k=0;k<l->nruns;k++)
+			free(l->names[k]);
+		free(l);
+	}
+	free(s->starts);
+	free(s->fidx);
+	free(s->lines);
+	free(s);
+	m->symbols = NULL;
+}
+
+static void module_build_symbols( hl_module *m ) {
+	hl_symbol_index *s;
+	int i, count = 0;
 	if( m->jit_debug == NULL )
+		return;
+	for(i=0;i<m->code->nfunctions;i++)
+		if( m->jit_debug[i].offsets ) count++;
+	s = (hl_symbol_index*)malloc(sizeof(hl_symbol_index));
+	if( s == NULL ) return;
+	s->count = 0;
+	s->starts = (int*)malloc(sizeof(int) * count);
+	s->fidx = (int*)malloc(sizeof(int) * count);
+	s->lines = (symbol_lines**)calloc(count,sizeof(symbol_lines*));
+	m->symbols = s;
+	if( count && (!s->starts || !s->fidx || !s->lines) ) {
+		module_free_symbols(m);
+		return;
+	}
+	for(i=0;i<m->code->nfunctions;i++) {
+		hl_debug_infos *dbg = m->jit_debug + i;
+		int k = s->count++;
+		if( !dbg->offsets ) {
+			s->count--;
+			continue;
+		}
+		// functions are usually emitted in order, keep it sorted otherwise
+		while( k > 0 && s->starts[k-1] > dbg->start ) {
+			s->starts[k] = s->starts[k-1];
+			s->fidx[k] = s->fidx[k-1];
+			k--;
+		}
+		s->starts[k] = dbg->start;
+		s->fidx[k] = i;
+	}
+}
+
+static symbol_lines *module_symbol_lines( hl_module *m, int index ) {
+	hl_symbol_index *s = m->symbols;
+	symbol_lines *l = s->lines[index];
+	int fidx = s->fidx[index];
+	hl_debug_infos *dbg = m->jit_debug + fidx;
+	hl_function *f = m->code->functions + fidx;
+	int *debug;
+	unsigned char *tmp, *p;
+	symbol_check *checks;
+	int i, nruns = 0, nchecks, size;
+	int prev_pos = 0, prev_op = 0, prev_line = 0, prev_file = -1;
+	if( l )
+		return l;
+	debug = hl_get_debug_infos(m->code,f);
+	if( debug == NULL || f->nops == 0 )
+		return NULL;
+	tmp = (unsigned char*)malloc(f->nops * 20);
+	checks = (symbol_check*)malloc(sizeof(symbol_check) * ((f->nops + SYMBOL_CHECK - 1) / SYMBOL_CHECK));
+	if( tmp == NULL || checks == NULL ) {
+		free(tmp);
+		free(checks);
+		return NULL;
+	}
+	p = tmp;
+	for(i=0;i<f->nops;i++) {
+		int file = debug[i<<1] & 0x7FFFFFFF;
+		int line = debug[(i<<1)|1];
+		int pos = dbg->large ? ((int*)dbg->offsets)[i] : ((unsigned short*)dbg->offsets)[i];
+		int dline;
+		if( i > 0 && file == prev_file && line == prev_line )
+			continue;
+		dline = line - prev_line;
+		symbols_write(&p, pos - prev_pos);
+		symbols_write(&p, ((i - prev_op) << 1) | (file != prev_file ? 1 : 0));
+		symbols_write(&p, (unsigned int)((dline << 1) ^ (dline >> 31)));
+		if( file != prev_file ) symbols_write(&p, file);
+		if( nruns % SYMBOL_CHECK == 0 ) {
+			symbol_check *c = checks + nruns / SYMBOL_CHECK;
+			c->pos = pos;
+			c->op = i;
+			c->file = file;
+			c->line = line;
+			c->offset = (int)(p - tmp);
+		}
+		prev_pos = pos;
+		prev_op = i;
+		prev_line = line;
+		prev_file = file;
+		nruns++;
+	}
+	size = (int)(p - tmp);
+	nchecks = (nruns + SYMBOL_CHECK - 1) / SYMBOL_CHECK;
+	l = (symbol_lines*)malloc(sizeof(symbol_lines) + sizeof(symbol_check) * nchecks + sizeof(uchar*) * nruns + size);
+	if( l == NULL ) {
+		free(tmp);
+		free(checks);
+		return NULL;
+	}
+	l->nruns = nruns;
+	l->checks = (symbol_check*)(l + 1);
+	l->names = (uchar**)(l->checks + nchecks);
+	l->runs = (unsigned char*)(l->names + nruns);
+	memcpy(l->checks, checks, sizeof(symbol_check) * nchecks);
+	memset(l->names, 0, sizeof(uchar*) * nruns);
+	memcpy(l->runs, tmp, size);
+	free(tmp);
+	free(checks);
+	hl_global_lock(true);
+	if( s->lines[index] ) {
+		free(l);
+		l = s->lines[index];
+	} else
+		s->lines[index] = l;
+	hl_global_lock(false);
+	return l;
+}
+
+static bool module_resolve_pos( hl_module *m, void *addr, int *index, int *run, int *fpos, int *file, int *line ) {
+	hl_symbol_index *s = m->symbols;
+	int code_pos = ((int)(int_val)((unsigned char*)addr - (unsigned char*)m->jit_code));
+	int min, max, k, end;
+	int pos, op, cur_line, cur_file;
+	unsigned char *p;
+	symbol_check *c;
+	symbol_lines *l;
+	if( s == NULL )
 		return false;
 	// lookup function from code pos
 	min = 0;
-	max = m->code->nfunctions;
+	max = s->count;
 	while( min < max ) {
 		int mid = (min + max) >> 1;
-		hl_debug_infos *p = m->jit_debug + mid;
-		if( p->start <= code_pos )
+		if( s->starts[mid] <= code_pos )
 			min = mid + 1;
 		else
 			max = mid;
 	}
 	if( min == 0 )
 		return false; // hl_callback
-	do {
-		min--;
-		*fidx = min;
-		dbg = m->jit_debug + min;
-		fdebug = m->code->functions + min;
-	} while( !dbg->offsets );
-	// lookup inside function
+	*index = --min;
+	l = module_symbol_lines(m,min);
+	if( l == NULL )
+		return false;
+	// lookup checkpoint then decode the following runs
+	code_pos -= s->starts[min];
 	min = 0;
-	max = fdebug->nops;
-	code_pos -= dbg->start;
+	max = (l->nruns + SYMBOL_CHECK - 1) / SYMBOL_CHECK;
 	while( min < max ) {
 		int mid = (min + max) >> 1;
-		int offset = dbg->large ? ((int*)dbg->offsets)[mid] : ((unsigned short*)dbg->offsets)[mid];
-		if( offset <= code_pos )
+		if( l->checks[mid].pos <= code_pos )
 			min = mid + 1;
 		else
 			max = mid;
 	}
 	if( min == 0 )
 		return false; // ???
-	*fpos = min - 1;
+	c = l->checks + (--min);
+	k = min * SYMBOL_CHECK;
+	pos = c->pos;
+	op = c->op;
+	cur_file = c->file;
+	cur_line = c->line;
+	p = l->runs + c->offset;
+	end = k + SYMBOL_CHECK;
+	if( end > l->nruns ) end = l->nruns;
+	while( ++k < end ) {
+		unsigned int d, z;
+		pos += symbols_read(&p);
+		if( pos > code_pos ) break;
+		d = symbols_read(&p);
+		z = symbols_read(&p);
+		op += d >> 1;
+		cur_line += (int)(z >> 1) ^ -(int)(z & 1);
+		if( d & 1 ) cur_file = symbols_read(&p);
+	}
+	*run = k - 1;
+	*fpos = op;
+	*file = cur_file;
+	*line = cur_line;
 	return true;
 }
 
 uchar *hl_module_resolve_symbol_full( void *addr, uchar *out, int *outSize, int **r_debug_addr ) {
-	int *debug_addr;
 	int file, line;
 	int pos = 0;
-	int fidx, fpos;
+	int index, run, fpos;
 	hl_function *fdebug;
+	uchar *name;
 	int i;
 	hl_module *m = NULL;
 	for(i=0;i<modules_count;i++) {
@@ -96,28 +306,44 @@ uchar *hl_module_resolve_symbol_full( void *addr, uchar *out, int *outSize, int
 	}
 	if( i == modules_count )
 		return NULL;
-	if( !module_resolve_pos(m,addr,&fidx,&fpos) )
+	if( !module_resolve_pos(m,addr,&index,&run,&fpos,&file,&line) )
 		return NULL;
-	// extract debug info
-	fdebug = m->code->functions + fidx;
-	debug_addr = fdebug->debug + ((fpos&0xFFFF) * 2);
-	file = debug_addr[0];
-	line = debug_addr[1];
+	fdebug = m->code->functions + m->symbols->fidx[index];
 	if( r_debug_addr ) {
+		int *debug_addr = fdebug->debug + ((fpos&0xFFFF) * 2);
 		*r_debug_addr = debug_addr;
-		if( file < 0 ) return NULL; // already cached
+		if( debug_addr[0] < 0 ) return NULL; // already cached
 	}
 	if( !out )
 		return NULL;
-	int size = *outSize;
-	if( fdebug->obj )
-		pos += usprintf(out,size - pos,USTR("%s.%s("),fdebug->obj->name,fdebug->field.name);
-	else if( fdebug->field.ref )
-		pos += usprintf(out,size - pos,USTR("%s.~%s.%d("),fdebug->field.ref->obj->name, fdebug->field.ref->field.name, fdebug->ref);
-	else
-		pos += usprintf(out,size - pos,USTR("fun$%d("),fdebug->findex);
-	pos += hl_from_utf8(out + pos,size - pos,m->code->debugfiles[file&0x7FFFFFFF]);
-	pos += usprintf(out + pos, size - pos, USTR(":%d)"), line);
+	name = m->symbols->lines[index]->names[run];
+	if( name == NULL ) {
+		uchar tmp[512];
+		int size = sizeof(tmp) / sizeof(uchar);
+		if( fdebug->obj )
+			pos += usprintf(tmp,size - pos,USTR("%s.%s("),fdebug->obj->name,fdebug->field.name);
+		else if( fdebug->field.ref )
+			pos += usprintf(tmp,size - pos,USTR("%s.~%s.%d("),fdebug->field.ref->obj->name, fdebug->field.ref->field.name, fdebug->ref);
+		else
+			pos += usprintf(tmp,size - pos,USTR("fun$%d("),fdebug->findex);
+		pos += hl_from_utf8(tmp + pos,size - pos,m->code->debugfiles[file]);
+		pos += usprintf(tmp + pos, size - pos, USTR(":%d)"), line);
+		name = (uchar*)malloc(sizeof(uchar) * (pos + 1));
+		if( name == NULL ) return NULL;
+		memcpy(name, tmp, sizeof(uchar) * (pos + 1));
+		hl_global_lock(true);
+		if( m->symbols->lines[index]->names[run] ) {
+			free(name);
+			name = m->symbols->lines[index]->names[run];
+			pos = (int)ustrlen(name);
+		} else
+			m->symbols->lines[index]->names[run] = name;
+		hl_global_lock(false);
+	} else
+		pos = (int)ustrlen(name);
+	if( pos >= *outSize ) pos = *outSize - 1;
+	memcpy(out, name, sizeof(uchar) * pos);
+	out[pos] = 0;
 	*outSize = pos;
 	return out;
 }
@@ -126,82 +352,83 @@ static uchar *module_resolve_symbol( void *addr, uchar *out, int *outSize ) {
 	return hl_module_resolve_symbol_full(addr,out,outSize,NULL);
 }
 
+static bool module_code_range( hl_module *m, void **start, void **end ) {
+	unsigned char *code = m->jit_code;
+	int code_size = m->codesize;
+	if( m->jit_debug ) {
+		int s = m->jit_debug[0].start;
+		code += s;
+		code_size -= s;
+	}
+	*start = code;
+	*end = code + code_size;
+	return code_size > 0;
+}
+
+static bool module_is_code( void *addr ) {
+	int i;
+	for(i=0;i<modules_count;i++) {
+		void *start, *end;
+		if( module_code_range(cur_modules[i],&start,&end) && addr >= start && addr < end )
+			return true;
+	}
+	return false;
+}
+
 int hl_module_capture_stack_range( void *stack_top, void **stack_ptr, void **out, int size ) {
-#if defined(HL_64) && defined(HL_WIN)
-#else
-	void *stack_bottom = stack_ptr;
-#endif
 	int count = 0;
-	if( modules_count == 1 ) {
-		hl_module *m = cur_modules[0];
-		unsigned char *code = m->jit_code;
-		int code_size = m->codesize;
-		if( m->jit_debug ) {
-			int s = m->jit_debug[0].start;
-			code += s;
-			code_size -= s;
-		}
-		while( stack_ptr < (void**)stack_top ) {
+	int i;
+	// bounds of all the JIT code, which is exact when there is a single module
+	void *code_min = NULL, *code_max = NULL;
+	for(i=0;i<modules_count;i++) {
+		void *start, *end;
+		if( !module_code_range(cur_modules[i],&start,&end) ) continue;
+		if( code_min == NULL || start < code_min ) code_min = start;
+		if( end > code_max ) code_max = end;
+	}
+#	define IS_CODE(addr)	((addr) >= code_min && (addr) < code_max && (modules_count == 1 || module_is_code(addr)))
 #if defined(HL_64) && defined(HL_WIN)
-			void *module_addr = *stack_ptr++; // EIP
-			if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
+	while( stack_ptr < (void**)stack_top ) {
+		void *module_addr = *stack_ptr++; // EIP
+		if( IS_CODE(module_addr) ) {
+			if( out ) {
+				if( count == size ) break;
+				out[count++] = module_addr;
+			} else
+				count++;
+		}
+	}
+#else
+	/*
+		Scan the native frames until we find a saved EBP followed by a return
+		address into JIT code, then follow the EBP chain for as long as it
+		stays valid : JIT functions always setup a frame pointer. If we reach
+		a native frame (callback) the chain breaks and we resume scanning.
+	*/
+	void **stack_bottom = stack_ptr;
+	while( stack_ptr < (void**)stack_top ) {
+		void **frame = (void**)*stack_ptr; // EBP
+		if( frame > stack_bottom && frame < (void**)stack_top && IS_CODE(stack_ptr[1]) ) {
+			frame = stack_ptr;
+			while( true ) {
+				void **next = (void**)frame[0];
 				if( out ) {
-					if( count == size ) break;
-					out[count++] = module_addr;
+					if( count == size ) return count;
+					out[count++] = frame[1];
 				} else
 					count++;
-			}
-#else
-			void *stack_addr = *stack_ptr++; // EBP
-			if( stack_addr > stack_bottom && stack_addr < stack_top ) {
-				void *module_addr = *stack_ptr; // EIP
-				if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
-					if( out ) {
-						if( count == size ) break;
-						out[count++] = module_addr;
-					} else {
-						count++;
-					}
-				}
-			}
-#endif
-		}
-	} else {
-		while( stack_ptr < (void**)stack_top ) {
-#if defined(HL_64) && defined(HL_WIN)
-			void *module_addr = *stack_ptr++; // EIP
-			{
-#else
-			void *stack_addr = *stack_ptr++; // EBP
-			if( stack_addr > stack_bottom && stack_addr < stack_top ) {
-				void *module_addr = *stack_ptr; // EIP
-#endif
-				int i;
-				for(i=0;i<modules_count;i++) {
-					hl_module *m = cur_modules[i];
-					unsigned char *code = m->jit_code;
-					int code_size = m->codesize;
-					if( module_addr >= (void*)code && module_addr < (void*)(code + code_size) ) {
-						if( out && count == size ) {
-							stack_ptr = stack_top;
-							break;
-						}
-						if( m->jit_debug ) {
-							int s = m->jit_debug[0].start;
-							code += s;
-							code_size -= s;
-							if( module_addr < (void*)code || module_addr >= (void*)(code + code_size) ) continue;
-						}
-						if( out )
-							out[count++] = module_addr;
-						else
-							count++;
-						break;
-					}
+				if( next <= frame || next >= (void**)stack_top || !IS_CODE(next[1]) ) {
+					stack_ptr = frame + 2;
+					break;
 				}
+				frame = next;
 			}
+			continue;
 		}
+		stack_ptr++;
 	}
+#endif
+#	undef IS_CODE
 	return count;
 }
 
@@ -481,6 +708,7 @@ h_bool hl_module_init_vtune( hl_module *m ) {
 	for(i=0;i<m->code->nfunctions;i++) {
 		hl_function *f = m->code->functions + i;
 		void *faddr = m->functions_ptrs[f->findex];
+		if( !hl_get_debug_infos(m->code,f) ) continue;
 
 		iJIT_Method_Load jm = {0};
 		char out[256];
@@ -533,11 +761,210 @@ h_bool hl_module_init_vtune( hl_module *m ) {
 }
 #endif
 
+void hl_module_fun_name( hl_function *f, char *out, int size ) {
+	char obj[128], field[128];
+	if( f->obj ) {
+		utostr(obj,sizeof(obj),f->obj->name);
+		utostr(field,sizeof(field),f->field.name);
+		snprintf(out,size,"%s.%s",obj,field);
+	} else if( f->field.ref ) {
+		utostr(obj,sizeof(obj),f->field.ref->obj->name);
+		utostr(field,sizeof(field),f->field.ref->field.name);
+		snprintf(out,size,"%s.~%s.%d",obj,field,f->ref);
+	} else
+		snprintf(out,size,"fun$%d",f->findex);
+}
+
+#if defined(HL_LINUX) && !defined(HL_CONSOLE)
+/*
+	Linux perf integration (HL_PERF_MAP environment variable)
+
+	1 : append "start size name" for each JIT function to /tmp/perf-<pid>.map,
+	    which perf reads to symbolize samples in JIT code.
+	2 : also write /tmp/jit-<pid>.dump in the jitdump format (code bytes and line
+	    tables), to be merged with `perf inject --jit` so that `perf report` and
+	    `perf annotate` show Haxe source lines. Record with `perf record -k mono`.
+*/
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define JITDUMP_MAGIC		0x4A695444
+#define JIT_CODE_LOAD		0
+#define JIT_CODE_DEBUG_INFO	2
+
+static int perf_mode = -1;
+static FILE *perf_map = NULL;
+static FILE *perf_dump = NULL;
+static unsigned long long perf_code_index = 0;
+
+typedef struct {
+	unsigned char *addr;
+	int fidx;
+} perf_fun;
+
+static unsigned long long perf_timestamp() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void perf_u32( unsigned int v ) {
+	fwrite(&v,4,1,perf_dump);
+}
+
+static void perf_u64( unsigned long long v ) {
+	fwrite(&v,8,1,perf_dump);
+}
+
+static void perf_init() {
+	char *mode = getenv("HL_PERF_MAP");
+	char path[64];
+	perf_mode = mode ? atoi(mode) : 0;
+	if( perf_mode <= 0 )
+		return;
+	sprintf(path,"/tmp/perf-%d.map",(int)getpid());
+	perf_map = fopen(path,"a");
+	if( perf_mode < 2 )
+		return;
+	sprintf(path,"/tmp/jit-%d.dump",(int)getpid());
+	perf_dump = fopen(path,"w+");
+	if( perf_dump == NULL )
+		return;
+	// perf record finds the dump file through this executable mapping
+	if( mmap(NULL,sysconf(_SC_PAGESIZE),PROT_READ|PROT_EXEC,MAP_PRIVATE,fileno(perf_dump),0) == MAP_FAILED ) {
+		fclose(perf_dump);
+		perf_dump = NULL;
+		return;
+	}
+	perf_u32(JITDUMP_MAGIC);
+	perf_u32(1); // version
+	perf_u32(40); // header size
+#	if defined(__aarch64__)
+	perf_u32(183); // EM_AARCH64
+#	elif defined(HL_64)
+	perf_u32(62); // EM_X86_64
+#	else
+	perf_u32(3); // EM_386
+#	endif
+	perf_u32(0);
+	perf_u32((unsigned int)getpid());
+	perf_u64(perf_timestamp());
+	perf_u64(0); // flags
+}
+
+static int perf_cmp_fun( const void *a, const void *b ) {
+	unsigned char *pa = ((perf_fun*)a)->addr, *pb = ((perf_fun*)b)->addr;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+static void perf_dump_lines( hl_module *m, hl_function *f, hl_debug_infos *dbg, unsigned char *addr ) {
+	int i, count = 0, size = 32, curline = -1, curfile = -1;
+	if( !hl_get_debug_infos(m->code,f) || !dbg->offsets )
+		return;
+	for(i=0;i<f->nops;i++) {
+		int file = f->debug[i<<1] & 0x7FFFFFFF, line = f->debug[(i<<1)|1];
+		if( file == curfile && line == curline ) continue;
+		curfile = file;
+		curline = line;
+		size += 16 + (int)strlen(m->code->debugfiles[file]) + 1;
+		count++;
+	}
+	perf_u32(JIT_CODE_DEBUG_INFO);
+	perf_u32(size);
+	perf_u64(perf_timestamp());
+	perf_u64((unsigned long long)(int_val)addr);
+	perf_u64(count);
+	curline = curfile = -1;
+	for(i=0;i<f->nops;i++) {
+		int file = f->debug[i<<1] & 0x7FFFFFFF, line = f->debug[(i<<1)|1];
+		int offset = dbg->large ? ((int*)dbg->offsets)[i] : ((unsigned short*)dbg->offsets)[i];
+		const char *fname = m->code->debugfiles[file];
+		if( file == curfile && line == curline ) continue;
+		curfile = file;
+		curline = line;
+		perf_u64((unsigned long long)(int_val)(addr + offset));
+		perf_u32(line);
+		perf_u32(0); // discriminator
+		fwrite(fname,1,strlen(fname) + 1,perf_dump);
+	}
+}
+
+static void hl_module_init_perf( hl_module *m ) {
+	unsigned char *code = (unsigned char*)m->jit_code, *end;
+	perf_fun *funs;
+	int i, count = 0;
+	if( perf_mode < 0 ) perf_init();
+	if( perf_map == NULL || code == NULL )
+		return;
+	funs = (perf_fun*)malloc(sizeof(perf_fun) * m->code->nfunctions);
+	for(i=0;i<m->code->nfunctions;i++) {
+		unsigned char *addr = (unsigned char*)m->functions_ptrs[m->code->functions[i].findex];
+		// skip functions kept from a previous module (hot reload)
+		if( addr < code || addr >= code + m->codesize ) continue;
+		funs[count].addr = addr;
+		funs[count].fidx = i;
+		count++;
+	}
+	qsort(funs,count,sizeof(perf_fun),perf_cmp_fun);
+	// the code block is rounded up to a page and zero filled after the last function
+	end = code + m->codesize;
+	while( end > code && end[-1] == 0 ) end--;
+	for(i=0;i<count;i++) {
+		hl_function *f = m->code->functions + funs[i].fidx;
+		unsigned char *addr = funs[i].addr;
+		int size = (int)((i + 1 < count ? funs[i+1].addr : end) - addr);
+		char name[300];
+		hl_module_fun_name(f,name,sizeof(name));
+		fprintf(perf_map,"%llx %x %s\n",(unsigned long long)(int_val)addr,size,name);
+		if( perf_dump ) {
+			int nlen = (int)strlen(name) + 1;
+			if( m->jit_debug ) perf_dump_lines(m,f,m->jit_debug + funs[i].fidx,addr);
+			perf_u32(JIT_CODE_LOAD);
+			perf_u32(16 + 8 + 8 * 4 + nlen + size);
+			perf_u64(perf_timestamp());
+			perf_u32((unsigned int)getpid());
+			perf_u32((unsigned int)syscall(SYS_gettid));
+			perf_u64((unsigned long long)(int_val)addr);
+			perf_u64((unsigned long long)(int_val)addr);
+			perf_u64(size);
+			perf_u64(perf_code_index++);
+			fwrite(name,1,nlen,perf_dump);
+			fwrite(addr,1,size,perf_dump);
+		}
+	}
+	free(funs);
+	fflush(perf_map);
+	if( perf_dump ) fflush(perf_dump);
+}
+#endif
+
+static hl_startup_lib *startup_lib( const char *name ) {
+	hl_startup_profile *p = hl_startup;
+	int i;
+	for(i=0;i<p->nlibs;i++)
+		if( strcmp(p->libs[i].name,name) == 0 )
+			return p->libs + i;
+	if( p->nlibs == HL_STARTUP_MAX_LIBS )
+		return NULL;
+	p->libs[p->nlibs].name = name;
+	return p->libs + p->nlibs++;
+}
+
+static void startup_lib_time( hl_startup_lib *l, double *t ) {
+	double now = hl_sys_time();
+	if( l ) l->time += now - *t;
+	*t = now;
+}
+
 static void hl_module_init_natives( hl_module *m ) {
 	char tmp[256];
 	int i;
 	void *libHandler = NULL;
 	const char *curlib = NULL, *sign;
+	hl_startup_lib *plib = NULL;
+	hl_startup_begin(t);
 	for(i=0;i<m->code->nnatives;i++) {
 		hl_native *n = m->code->natives + i;
 		const char *lib = n->lib;
@@ -547,8 +974,13 @@ static void hl_module_init_natives( hl_module *m ) {
 		if( is_opt ) lib++;
 		if( curlib != lib ) {
 			curlib = lib;
+			if( hl_startup ) {
+				startup_lib_time(plib,&t);
+				plib = startup_lib(lib);
+			}
 			libHandler = resolve_library(lib, is_opt);
 		}
+		if( plib ) plib->natives++;
 		if( libHandler == DISABLED_LIB_PTR ) {
 			m->functions_ptrs[n->findex] = disabled_primitive;
 			continue;
@@ -573,6 +1005,7 @@ static void hl_module_init_natives( hl_module *m ) {
 		if( sign && memcmp(sign,tmp,strlen(sign)+1) != 0 )
 			hl_fatal4("Invalid signature for function %s@%s : %s required but %s found in hdll",n->lib,n->name,tmp,sign);
 	}
+	if( hl_startup ) startup_lib_time(plib,&t);
 }
 
 static void hl_module_init_constant( hl_module *m, hl_constant *c ) {
@@ -654,13 +1087,20 @@ int hl_module_init( hl_module *m, h_bool hot_reload ) {
 	}
 	// inits
 	if( hot_reload ) m->hash = hl_code_hash_alloc(m->code);
+	hl_startup_begin(t);
 	hl_module_init_natives(m);
+	hl_startup_mark(t,natives);
 	hl_module_init_indexes(m);
 	// JIT
 	ctx = hl_jit_alloc();
 	if( ctx == NULL )
 		return 0;
 	hl_jit_init(ctx, m);
+	if( hl_startup ) {
+		hl_startup->nfunctions = m->code->nfunctions;
+		hl_startup->functions = (double*)calloc(m->code->nfunctions,sizeof(double));
+		t = hl_sys_time();
+	}
 	for(i=0;i<m->code->nfunctions;i++) {
 		hl_function *f = m->code->functions + i;
 		int fpos = hl_jit_function(ctx, m, f);
@@ -669,20 +1109,32 @@ int hl_module_init( hl_module *m, h_bool hot_reload ) {
 			return 0;
 		}
 		m->functions_ptrs[f->findex] = (void*)(int_val)fpos;
+		if( hl_startup && hl_startup->functions ) {
+			double now = hl_sys_time();
+			hl_startup->functions[i] = now - t;
+			hl_startup->jit += now - t;
+			t = now;
+		}
 	}
 	m->jit_code = hl_jit_code(ctx, m, &m->codesize, &m->jit_debug, NULL);
+	module_build_symbols(m);
 	for(i=0;i<m->code->nfunctions;i++) {
 		hl_function *f = m->code->functions + i;
 		m->functions_ptrs[f->findex] = ((unsigned char*)m->jit_code) + ((int_val)m->functions_ptrs[f->findex]);
 	}
+	hl_startup_mark(t,jit_finalize);
 	// INIT constants
 	for(i=0;i<m->code->nconstants;i++) {
 		hl_constant *c = m->code->constants + i;
 		hl_module_init_constant(m, c);
 	}
+	hl_startup_mark(t,constants);
 
 #	ifdef HL_VTUNE
 	hl_module_init_vtune(m);
+#	endif
+#	if defined(HL_LINUX) && !defined(HL_CONSOLE)
+	hl_module_init_perf(m);
 #	endif
 	hl_module_add(m);
 	hl_setup_exception(module_resolve_symbol, module_capture_stack);
@@ -858,6 +1310,7 @@ h_bool hl_module_patch( hl_module *m1, hl_code *c ) {
 			}
 		}
 	}
+	module_build_symbols(m2);
 
 	hl_jit_free(ctx,true);
 
@@ -879,6 +1332,9 @@ h_bool hl_module_patch( hl_module *m1, hl_code *c ) {
 		hl_jit_patch_method(m1->functions_ptrs[f1->findex], m1->functions_ptrs + f1->findex);
 		m1->functions_ptrs[f1->findex] = ptr;
 	}
+#	if defined(HL_LINUX) && !defined(HL_CONSOLE)
+	hl_module_init_perf(m2);
+#	endif
 	for(i=0;i<m1->code->ntypes;i++) {
 		hl_type *t = m1->code->types + i;
 		if( t->kind == HOBJ || t->kind == HSTRUCT ) hl_flush_proto(t);
@@ -915,6 +1371,7 @@ void hl_module_free( hl_module *m ) {
 	free(m->ctx.functions_types);
 	free(m->globals_indexes);
 	free(m->globals_data);
+	module_free_symbols(m);
 	if( m->jit_debug ) {
 		int i;
 		for(i=0;i<m->code->nfunctions;i++)
@@ -0,0 +1,798 @@
+/*
+ * Copyright (C)2015-2016 Haxe Foundation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include "hlmodule.h"
+
+#define OP(_,n) n,
+#define OP_BEGIN static int hl_op_nargs[] = {
+#define OP_END };
+#include "opcodes.h"
+
+/*
+	Bytecode optimizer, run between hl_code_read and the JIT.
+
+	Ops are never inserted or moved : an op that is removed becomes ONop, so jump
+	offsets and debug infos stay valid without any remapping.
+
+	level 1 : copy propagation inside basic blocks, unboxing of OSafeCast applied
+	          to a value boxed by OToDyn in the same block, redundant ONullCheck
+	          removal (forward dataflow over basic blocks) and dead store
+	          elimination (backward liveness), which drops the boxes no longer used.
+	level 2 : + folding of integer ops and conditional jumps with constant operands.
+
+	Registers whose address is taken by ORef are never touched.
+*/
+
+typedef struct {
+	hl_code *code;
+	hl_function *f;
+	hl_alloc alloc;
+	int words;
+	int nblocks;
+	int *block_start;	// nblocks + 1
+	int *block_of;		// op -> block
+	int *succ;			// block -> first successor index
+	int *succs;
+	int *npreds;
+	int **preds;
+	bool *handler;
+	bool *escaped;
+	bool has_trap;
+	int ints_size;
+	int *copies;		// reg -> source of the copy or -1
+	int *copy_srcs;		// reg -> number of copies of it
+	int *touched;		// regs set in copies/known for the current block
+	int ntouched;
+	int *consts;
+	bool *known;
+	unsigned int *live;
+} opt_ctx;
+
+typedef void (*opt_reg_fun)( opt_ctx *ctx, int *r );
+
+#define BIT_GET(set,r)	((set)[(r)>>5] & (1u << ((r)&31)))
+#define BIT_SET(set,r)	(set)[(r)>>5] |= 1u << ((r)&31)
+#define BIT_CLR(set,r)	(set)[(r)>>5] &= ~(1u << ((r)&31))
+
+static void opt_uses( opt_ctx *ctx, hl_opcode *o, opt_reg_fun f ) {
+	int i, tmp;
+	switch( o->op ) {
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OGetGlobal:
+	case OStaticClosure:
+	case ONew:
+	case OType:
+	case OEnumAlloc:
+	case OJAlways:
+	case OLabel:
+	case OEndTrap:
+	case OAssert:
+	case ONop:
+	case OTrap:
+	case OCall0:
+		break;
+	case OIncr:
+	case ODecr:
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case ONullCheck:
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OSwitch:
+	case OPrefetch:
+		f(ctx,&o->p1);
+		break;
+	case OGetThis:
+		tmp = 0;
+		f(ctx,&tmp);
+		break;
+	case OSetThis:
+		tmp = 0;
+		f(ctx,&tmp);
+		f(ctx,&o->p2);
+		break;
+	case OInstanceClosure:
+	case OCall1:
+		f(ctx,&o->p3);
+		break;
+	case OSetField:
+	case ODynSet:
+	case OSetEnumField:
+		f(ctx,&o->p1);
+		f(ctx,&o->p3);
+		break;
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+	case OSetref:
+		f(ctx,&o->p1);
+		f(ctx,&o->p2);
+		break;
+	case OAdd:
+	case OSub:
+	case OMul:
+	case OSDiv:
+	case OUDiv:
+	case OSMod:
+	case OUMod:
+	case OShl:
+	case OSShr:
+	case OUShr:
+	case OAnd:
+	case OOr:
+	case OXor:
+	case OGetI8:
+	case OGetI16:
+	case OGetMem:
+	case OGetArray:
+	case ORefOffset:
+		f(ctx,&o->p2);
+		f(ctx,&o->p3);
+		break;
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case OSetArray:
+		f(ctx,&o->p1);
+		f(ctx,&o->p2);
+		f(ctx,&o->p3);
+		break;
+	case OCall2:
+		f(ctx,&o->p3);
+		tmp = (int)(int_val)o->extra;
+		f(ctx,&tmp);
+		o->extra = (int*)(int_val)tmp;
+		break;
+	case OCall3:
+	case OCall4:
+		f(ctx,&o->p3);
+		for(i=0;i<hl_op_nargs[o->op] - 3;i++)
+			f(ctx,o->extra + i);
+		break;
+	case OCallThis:
+		tmp = 0;
+		f(ctx,&tmp);
+		// fallthrough
+	case OCallN:
+	case OCallMethod:
+	case OMakeEnum:
+		for(i=0;i<o->p3;i++)
+			f(ctx,o->extra + i);
+		break;
+	case OCallClosure:
+		f(ctx,&o->p2);
+		for(i=0;i<o->p3;i++)
+			f(ctx,o->extra + i);
+		break;
+	default:
+		// OMov, conversions, OField, ODynGet, OVirtualClosure, OArraySize, ORef, etc.
+		f(ctx,&o->p2);
+		break;
+	}
+}
+
+static int opt_def( hl_opcode *o ) {
+	switch( o->op ) {
+	case OSetGlobal:
+	case OSetField:
+	case OSetThis:
+	case ODynSet:
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+	case OJAlways:
+	case OLabel:
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case OSwitch:
+	case ONullCheck:
+	case OEndTrap:
+	case OSetI8:
+	case OSetI16:
+	case OSetMem:
+	case OSetArray:
+	case OSetref:
+	case OSetEnumField:
+	case OAssert:
+	case ONop:
+	case OPrefetch:
+	case OAsm:
+		return -1;
+	default:
+		return o->p1;
+	}
+}
+
+static bool opt_is_pure( hl_opcode *o ) {
+	switch( o->op ) {
+	case OMov:
+	case OInt:
+	case OFloat:
+	case OBool:
+	case OBytes:
+	case OString:
+	case ONull:
+	case OAdd:
+	case OSub:
+	case OMul:
+	case OSDiv:
+	case OUDiv:
+	case OSMod:
+	case OUMod:
+	case OShl:
+	case OSShr:
+	case OUShr:
+	case OAnd:
+	case OOr:
+	case OXor:
+	case ONeg:
+	case ONot:
+	case OToSFloat:
+	case OToUFloat:
+	case OToInt:
+	case OUnsafeCast:
+	case OGetGlobal:
+	case OToDyn:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static int opt_jump_target( hl_opcode *o, int pos ) {
+	switch( o->op ) {
+	case OJTrue:
+	case OJFalse:
+	case OJNull:
+	case OJNotNull:
+	case OTrap:
+		return pos + 1 + o->p2;
+	case OJSLt:
+	case OJSGte:
+	case OJSGt:
+	case OJSLte:
+	case OJULt:
+	case OJUGte:
+	case OJNotLt:
+	case OJNotGte:
+	case OJEq:
+	case OJNotEq:
+		return pos + 1 + o->p3;
+	case OJAlways:
+		return pos + 1 + o->p1;
+	default:
+		return -1;
+	}
+}
+
+static bool opt_ends_block( hl_opcode *o ) {
+	switch( o->op ) {
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case OSwitch:
+		return true;
+	default:
+		return opt_jump_target(o,0) >= 0;
+	}
+}
+
+static bool opt_falls_through( hl_opcode *o ) {
+	switch( o->op ) {
+	case ORet:
+	case OThrow:
+	case ORethrow:
+	case OJAlways:
+		return false;
+	default:
+		return true;
+	}
+}
+
+static void opt_build_blocks( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	bool *leader = (bool*)hl_zalloc(&ctx->alloc,sizeof(bool) * (f->nops + 1));
+	int i, k, b, nsucc = 0;
+	leader[0] = true;
+	ctx->has_trap = false;
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		if( o->op == OSwitch ) {
+			for(k=0;k<o->p2;k++)
+				leader[i + 1 + o->extra[k]] = true;
+			nsucc += o->p2;
+		} else {
+			int t = opt_jump_target(o,i);
+			if( t >= 0 ) {
+				leader[t] = true;
+				nsucc++;
+			}
+		}
+		if( o->op == OTrap ) ctx->has_trap = true;
+		if( opt_ends_block(o) ) leader[i+1] = true;
+		nsucc++;
+	}
+	ctx->nblocks = 0;
+	for(i=0;i<f->nops;i++)
+		if( leader[i] ) ctx->nblocks++;
+	ctx->block_start = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (ctx->nblocks + 1));
+	ctx->block_of = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (f->nops + 1));
+	b = -1;
+	for(i=0;i<f->nops;i++) {
+		if( leader[i] ) ctx->block_start[++b] = i;
+		ctx->block_of[i] = b;
+	}
+	ctx->block_start[ctx->nblocks] = f->nops;
+	ctx->block_of[f->nops] = -1;
+	// successors
+	ctx->succ = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (ctx->nblocks + 1));
+	ctx->succs = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (nsucc + 1));
+	ctx->npreds = (int*)hl_zalloc(&ctx->alloc,sizeof(int) * ctx->nblocks);
+	ctx->handler = (bool*)hl_zalloc(&ctx->alloc,sizeof(bool) * ctx->nblocks);
+	nsucc = 0;
+	for(b=0;b<ctx->nblocks;b++) {
+		int last = ctx->block_start[b+1] - 1;
+		hl_opcode *o = f->ops + last;
+		ctx->succ[b] = nsucc;
+		if( o->op == OSwitch ) {
+			for(k=0;k<o->p2;k++)
+				ctx->succs[nsucc++] = ctx->block_of[last + 1 + o->extra[k]];
+		} else {
+			int t = opt_jump_target(o,last);
+			if( t >= 0 ) {
+				if( o->op == OTrap )
+					ctx->handler[ctx->block_of[t]] = true;
+				else
+					ctx->succs[nsucc++] = ctx->block_of[t];
+			}
+		}
+		if( opt_falls_through(o) && last + 1 < f->nops )
+			ctx->succs[nsucc++] = b + 1;
+	}
+	ctx->succ[ctx->nblocks] = nsucc;
+	// predecessors
+	for(i=0;i<nsucc;i++)
+		ctx->npreds[ctx->succs[i]]++;
+	ctx->preds = (int**)hl_malloc(&ctx->alloc,sizeof(int*) * ctx->nblocks);
+	for(b=0;b<ctx->nblocks;b++) {
+		ctx->preds[b] = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (ctx->npreds[b] + 1));
+		ctx->npreds[b] = 0;
+	}
+	for(b=0;b<ctx->nblocks;b++)
+		for(k=ctx->succ[b];k<ctx->succ[b+1];k++) {
+			int s = ctx->succs[k];
+			ctx->preds[s][ctx->npreds[s]++] = b;
+		}
+}
+
+// --- redundant null checks
+
+static bool opt_is_alloc( hl_opcode *o ) {
+	switch( o->op ) {
+	case ONew:
+	case OString:
+	case OBytes:
+	case OMakeEnum:
+	case OEnumAlloc:
+	case OStaticClosure:
+	case OInstanceClosure:
+	case OVirtualClosure:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void opt_null_transfer( opt_ctx *ctx, hl_opcode *o, unsigned int *set ) {
+	int d = opt_def(o);
+	bool nonnull = false;
+	if( d >= 0 ) {
+		nonnull = opt_is_alloc(o) || (o->op == OMov && BIT_GET(set,o->p2)) || (o->op == OToDyn && !hl_is_ptr(ctx->f->regs[o->p2]));
+		BIT_CLR(set,d);
+	}
+	if( o->op == ONullCheck )
+		d = o->p1, nonnull = true;
+	if( nonnull && !ctx->escaped[d] )
+		BIT_SET(set,d);
+}
+
+static int opt_null_checks( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	int words = ctx->words;
+	unsigned int *out = (unsigned int*)hl_malloc(&ctx->alloc,sizeof(int) * words * ctx->nblocks);
+	unsigned int *cur = (unsigned int*)hl_malloc(&ctx->alloc,sizeof(int) * words);
+	int b, i, k, count = 0;
+	bool changed = true;
+	memset(out,0xFF,sizeof(int) * words * ctx->nblocks);
+	while( changed ) {
+		changed = false;
+		for(b=0;b<ctx->nblocks;b++) {
+			unsigned int *bout = out + b * words;
+			if( b == 0 || ctx->handler[b] || ctx->npreds[b] == 0 )
+				memset(cur,0,sizeof(int) * words);
+			else {
+				memcpy(cur,out + ctx->preds[b][0] * words,sizeof(int) * words);
+				for(k=1;k<ctx->npreds[b];k++) {
+					unsigned int *p = out + ctx->preds[b][k] * words;
+					for(i=0;i<words;i++) cur[i] &= p[i];
+				}
+			}
+			for(i=ctx->block_start[b];i<ctx->block_start[b+1];i++)
+				opt_null_transfer(ctx,f->ops + i,cur);
+			if( memcmp(cur,bout,sizeof(int) * words) != 0 ) {
+				memcpy(bout,cur,sizeof(int) * words);
+				changed = true;
+			}
+		}
+	}
+	// remove the checks on registers already known as not null
+	for(b=0;b<ctx->nblocks;b++) {
+		if( b == 0 || ctx->handler[b] || ctx->npreds[b] == 0 )
+			memset(cur,0,sizeof(int) * words);
+		else {
+			memcpy(cur,out + ctx->preds[b][0] * words,sizeof(int) * words);
+			for(k=1;k<ctx->npreds[b];k++) {
+				unsigned int *p = out + ctx->preds[b][k] * words;
+				for(i=0;i<words;i++) cur[i] &= p[i];
+			}
+		}
+		for(i=ctx->block_start[b];i<ctx->block_start[b+1];i++) {
+			hl_opcode *o = f->ops + i;
+			if( o->op == ONullCheck && BIT_GET(cur,o->p1) ) {
+				o->op = ONop;
+				count++;
+				continue;
+			}
+			opt_null_transfer(ctx,o,cur);
+		}
+	}
+	return count;
+}
+
+// --- copy propagation
+
+static void opt_rewrite_copy( opt_ctx *ctx, int *r ) {
+	int c = ctx->copies[*r];
+	if( c >= 0 ) *r = c;
+}
+
+static void opt_copy_kill( opt_ctx *ctx, int r ) {
+	int c = ctx->copies[r];
+	if( c >= 0 ) {
+		ctx->copy_srcs[c]--;
+		ctx->copies[r] = -1;
+	}
+}
+
+static void opt_copy_propagation( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	int b, i, k;
+	for(i=0;i<f->nregs;i++) {
+		ctx->copies[i] = -1;
+		ctx->copy_srcs[i] = 0;
+	}
+	for(b=0;b<ctx->nblocks;b++) {
+		ctx->ntouched = 0;
+		for(i=ctx->block_start[b];i<ctx->block_start[b+1];i++) {
+			hl_opcode *o = f->ops + i;
+			int d;
+			if( o->op != OIncr && o->op != ODecr )
+				opt_uses(ctx,o,opt_rewrite_copy);
+			d = opt_def(o);
+			if( d < 0 ) continue;
+			opt_copy_kill(ctx,d);
+			if( ctx->copy_srcs[d] )
+				for(k=0;k<ctx->ntouched;k++)
+					if( ctx->copies[ctx->touched[k]] == d )
+						opt_copy_kill(ctx,ctx->touched[k]);
+			if( o->op == OMov && o->p2 != d && f->regs[o->p2] == f->regs[d] && !ctx->escaped[d] && !ctx->escaped[o->p2] ) {
+				ctx->copies[d] = o->p2;
+				ctx->copy_srcs[o->p2]++;
+				ctx->touched[ctx->ntouched++] = d;
+			}
+		}
+		for(k=0;k<ctx->ntouched;k++)
+			opt_copy_kill(ctx,ctx->touched[k]);
+	}
+}
+
+// --- boxes
+
+static int opt_unbox( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	int b, i, k, count = 0;
+	for(b=0;b<ctx->nblocks;b++) {
+		for(i=ctx->block_start[b];i<ctx->block_start[b+1];i++) {
+			hl_opcode *o = f->ops + i;
+			int d = o->p1, v = o->p2;
+			if( o->op != OToDyn || hl_is_ptr(f->regs[v]) || ctx->escaped[d] || ctx->escaped[v] ) continue;
+			// until one of them is written, casting the box back gives the boxed value
+			for(k=i+1;k<ctx->block_start[b+1];k++) {
+				hl_opcode *o2 = f->ops + k;
+				int w;
+				if( o2->op == OSafeCast && o2->p2 == d && f->regs[o2->p1]->kind == f->regs[v]->kind ) {
+					o2->op = OMov;
+					o2->p2 = v;
+					count++;
+				}
+				w = opt_def(o2);
+				if( w == d || w == v ) break;
+			}
+		}
+	}
+	return count;
+}
+
+// --- dead stores
+
+static void opt_mark_live( opt_ctx *ctx, int *r ) {
+	BIT_SET(ctx->live,*r);
+}
+
+static void opt_live_transfer( opt_ctx *ctx, hl_opcode *o, unsigned int *live ) {
+	int d = opt_def(o);
+	if( d >= 0 && o->op != OIncr && o->op != ODecr ) BIT_CLR(live,d);
+	ctx->live = live;
+	opt_uses(ctx,o,opt_mark_live);
+}
+
+static int opt_dead_stores( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	int words = ctx->words;
+	unsigned int *in = (unsigned int*)hl_zalloc(&ctx->alloc,sizeof(int) * words * ctx->nblocks);
+	unsigned int *cur = (unsigned int*)hl_malloc(&ctx->alloc,sizeof(int) * words);
+	int b, i, k, count = 0;
+	bool changed = true;
+	while( changed ) {
+		changed = false;
+		for(b=ctx->nblocks-1;b>=0;b--) {
+			unsigned int *bin = in + b * words;
+			memset(cur,0,sizeof(int) * words);
+			for(k=ctx->succ[b];k<ctx->succ[b+1];k++) {
+				unsigned int *s = in + ctx->succs[k] * words;
+				for(i=0;i<words;i++) cur[i] |= s[i];
+			}
+			for(i=ctx->block_start[b+1]-1;i>=ctx->block_start[b];i--)
+				opt_live_transfer(ctx,f->ops + i,cur);
+			if( memcmp(cur,bin,sizeof(int) * words) != 0 ) {
+				memcpy(bin,cur,sizeof(int) * words);
+				changed = true;
+			}
+		}
+	}
+	for(b=0;b<ctx->nblocks;b++) {
+		memset(cur,0,sizeof(int) * words);
+		for(k=ctx->succ[b];k<ctx->succ[b+1];k++) {
+			unsigned int *s = in + ctx->succs[k] * words;
+			for(i=0;i<words;i++) cur[i] |= s[i];
+		}
+		for(i=ctx->block_start[b+1]-1;i>=ctx->block_start[b];i--) {
+			hl_opcode *o = f->ops + i;
+			int d = opt_def(o);
+			if( d >= 0 && !ctx->escaped[d] && !BIT_GET(cur,d) && opt_is_pure(o) ) {
+				o->op = ONop;
+				count++;
+				continue;
+			}
+			opt_live_transfer(ctx,o,cur);
+		}
+	}
+	return count;
+}
+
+// --- constant folding
+
+static int opt_int_index( opt_ctx *ctx, int v ) {
+	hl_code *c = ctx->code;
+	int i;
+	for(i=0;i<c->nints;i++)
+		if( c->ints[i] == v )
+			return i;
+	if( c->nints >= ctx->ints_size ) {
+		int *ints;
+		ctx->ints_size = c->nints < 8 ? 16 : c->nints * 2;
+		ints = (int*)hl_malloc(&c->alloc,sizeof(int) * ctx->ints_size);
+		memcpy(ints,c->ints,sizeof(int) * c->nints);
+		c->ints = ints;
+	}
+	c->ints[c->nints] = v;
+	return c->nints++;
+}
+
+static bool opt_eval_jump( hl_op op, int a, int b ) {
+	switch( op ) {
+	case OJSLt: return a < b;
+	case OJSGte: return a >= b;
+	case OJSGt: return a > b;
+	case OJSLte: return a <= b;
+	case OJULt: return (unsigned)a < (unsigned)b;
+	case OJUGte: return (unsigned)a >= (unsigned)b;
+	case OJNotLt: return !(a < b);
+	case OJNotGte: return !(a >= b);
+	case OJEq: return a == b;
+	case OJNotEq: return a != b;
+	default: return false;
+	}
+}
+
+static int opt_fold_constants( opt_ctx *ctx ) {
+	hl_function *f = ctx->f;
+	int b, i, k, count = 0;
+	memset(ctx->known,0,sizeof(bool) * f->nregs);
+	for(b=0;b<ctx->nblocks;b++) {
+		ctx->ntouched = 0;
+		for(i=ctx->block_start[b];i<ctx->block_start[b+1];i++) {
+			hl_opcode *o = f->ops + i;
+			int d;
+			switch( o->op ) {
+			case OAdd:
+			case OSub:
+			case OMul:
+			case OAnd:
+			case OOr:
+			case OXor:
+			case OShl:
+			case OSShr:
+			case OUShr:
+				if( f->regs[o->p1]->kind == HI32 && ctx->known[o->p2] && ctx->known[o->p3] ) {
+					unsigned int a = (unsigned)ctx->consts[o->p2], v = (unsigned)ctx->consts[o->p3];
+					switch( o->op ) {
+					case OAdd: v = a + v; break;
+					case OSub: v = a - v; break;
+					case OMul: v = a * v; break;
+					case OAnd: v = a & v; break;
+					case OOr: v = a | v; break;
+					case OXor: v = a ^ v; break;
+					case OShl: v = a << (v & 31); break;
+					case OSShr: v = (unsigned)((int)a >> (v & 31)); break;
+					default: v = a >> (v & 31); break;
+					}
+					o->op = OInt;
+					o->p2 = opt_int_index(ctx,(int)v);
+					count++;
+				}
+				break;
+			case OJSLt:
+			case OJSGte:
+			case OJSGt:
+			case OJSLte:
+			case OJULt:
+			case OJUGte:
+			case OJNotLt:
+			case OJNotGte:
+			case OJEq:
+			case OJNotEq:
+				if( ctx->known[o->p1] && ctx->known[o->p2] ) {
+					if( opt_eval_jump(o->op,ctx->consts[o->p1],ctx->consts[o->p2]) ) {
+						o->op = OJAlways;
+						o->p1 = o->p3;
+					} else
+						o->op = ONop;
+					count++;
+				}
+				break;
+			case OJTrue:
+			case OJFalse:
+				if( ctx->known[o->p1] ) {
+					if( (ctx->consts[o->p1] != 0) == (o->op == OJTrue) ) {
+						o->op = OJAlways;
+						o->p1 = o->p2;
+					} else
+						o->op = ONop;
+					count++;
+				}
+				break;
+			default:
+				break;
+			}
+			d = opt_def(o);
+			if( d < 0 ) continue;
+			ctx->known[d] = false;
+			if( ctx->escaped[d] ) continue;
+			if( o->op == OInt && f->regs[d]->kind == HI32 ) {
+				ctx->known[d] = true;
+				ctx->consts[d] = ctx->code->ints[o->p2];
+				ctx->touched[ctx->ntouched++] = d;
+			} else if( o->op == OBool && f->regs[d]->kind == HBOOL ) {
+				ctx->known[d] = true;
+				ctx->consts[d] = o->p2;
+				ctx->touched[ctx->ntouched++] = d;
+			}
+		}
+		for(k=0;k<ctx->ntouched;k++)
+			ctx->known[ctx->touched[k]] = false;
+	}
+	return count;
+}
+
+static void opt_function( opt_ctx *ctx, hl_function *f, int level ) {
+	int i;
+	if( f->nops == 0 ) return;
+	ctx->f = f;
+	ctx->words = (f->nregs + 31) >> 5;
+	if( ctx->words == 0 ) ctx->words = 1;
+	ctx->escaped = (bool*)hl_zalloc(&ctx->alloc,sizeof(bool) * (f->nregs + 1));
+	for(i=0;i<f->nops;i++) {
+		hl_opcode *o = f->ops + i;
+		if( o->op == OAsm ) return; // registers can be used directly
+		if( o->op == ORef ) ctx->escaped[o->p2] = true;
+	}
+	ctx->copies = (int*)hl_malloc(&ctx->alloc,sizeof(int) * f->nregs);
+	ctx->copy_srcs = (int*)hl_malloc(&ctx->alloc,sizeof(int) * f->nregs);
+	ctx->touched = (int*)hl_malloc(&ctx->alloc,sizeof(int) * (f->nops + 1));
+	if( level >= 2 ) {
+		ctx->known = (bool*)hl_malloc(&ctx->alloc,sizeof(bool) * f->nregs);
+		ctx->consts = (int*)hl_malloc(&ctx->alloc,sizeof(int) * f->nregs);
+		opt_build_blocks(ctx);
+		// branches might have changed : recompute the blocks
+		if( opt_fold_constants(ctx) ) opt_build_blocks(ctx);
+	} else
+		opt_build_blocks(ctx);
+	opt_copy_propagation(ctx);
+	opt_unbox(ctx);
+	opt_null_checks(ctx);
+	// a catch block can read any register written inside the trap
+	if( !ctx->has_trap ) {
+		int pass;
+		for(pass=0;pass<2;pass++)
+			if( !opt_dead_stores(ctx) ) break;
+	}
+}
+
+void hl_code_optimize( hl_code *c, int level ) {
+	opt_ctx ctx;
+	int i;
+	if( level <= 0 ) return;
+	memset(&ctx,0,sizeof(ctx));
+	ctx.code = c;
+	for(i=0;i<c->nfunctions;i++) {
+		hl_alloc_init(&ctx.alloc);
+		opt_function(&ctx,c->functions + i,level);
+		hl_free(&ctx.alloc);
+	}
+}
@@ -27,63 +27,52 @@
 #	define PR_I64 USTR("%lld")
 #endif
 
-typedef struct _stringitem {
-	uchar *str;
-	int size;
-	int len;
-	struct _stringitem *next;
-} * stringitem;
+/*
+	The buffer is a single UCS2 block growing geometrically, with one extra
+	char kept for the terminator so hl_buffer_content can hand the block
+	over as is when it is mostly full. Once handed over, the block is owned
+	by the result and the next write moves to a new one.
+*/
 
 struct hl_buffer {
-	int totlen;
-	int blen;
-	stringitem data;
+	uchar *data;
+	int len;
+	int size;
 };
 
+#define BUFFER_MIN_SIZE	64
+#define BUFFER_MAX_SIZE	0x3FFFFFF0
+
 HL_PRIM hl_buffer *hl_alloc_buffer() {
 	hl_buffer *b = (hl_buffer*)hl_gc_alloc_raw(sizeof(hl_buffer));
-	b->totlen = 0;
-	b->blen = 16;
 	b->data = NULL;
+	b->len = 0;
+	b->size = 0;
 	return b;
 }
 
-static void buffer_append_new( hl_buffer *b, const uchar *s, int len ) {
-	int size;
-	stringitem it;
-	while( b->totlen >= (b->blen << 2) )
-		b->blen <<= 1;
-	size = (len < b->blen)?b->blen:len;
-	it = (stringitem)hl_gc_alloc_raw(sizeof(struct _stringitem));
-	it->str = (uchar*)hl_gc_alloc_noptr(size<<1);
-	memcpy(it->str,s,len<<1);
-	it->size = size;
-	it->len = len;
-	it->next = b->data;
-	b->data = it;
+static void buffer_grow( hl_buffer *b, int len ) {
+	int size = b->size < BUFFER_MIN_SIZE ? BUFFER_MIN_SIZE : b->size;
+	uchar *data;
+	if( len > BUFFER_MAX_SIZE - b->len ) hl_error("Buffer too large");
+	while( size < b->len + len )
+		size = size > (BUFFER_MAX_SIZE >> 1) ? BUFFER_MAX_SIZE : size << 1;
+	data = (uchar*)hl_gc_alloc_noptr((size + 1) << 1);
+	if( b->len ) memcpy(data,b->data,b->len << 1);
+	b->data = data;
+	b->size = size;
+}
+
+HL_PRIM void hl_buffer_reserve( hl_buffer *b, int len ) {
+	if( b->size - b->len < len ) buffer_grow(b,len);
 }
 
 HL_PRIM void hl_buffer_str_sub( hl_buffer *b, const uchar *s, int len ) {
-	stringitem it;
-	int offset = 0;
 	if( s == NULL || len <= 0 )
 		return;
-	b->totlen += len;
-	it = b->data;
-	if( it ) {
-		int free = it->size - it->len;
-		if( free >= len ) {
-			memcpy(it->str + it->len,s,len<<1);
-			it->len += len;
-			return;
-		} else {
-			memcpy(it->str + it->len,s,free<<1);
-			it->len += free;
-			offset = free;
-			len -= free;
-		}
-	}
-	buffer_append_new(b,s + offset,len);
+	if( b->size - b->len < len ) buffer_grow(b,len);
+	memcpy(b->data + b->len,s,len<<1);
+	b->len += len;
 }
 
 HL_PRIM void hl_buffer_str( hl_buffer *b, const uchar *s ) {
@@ -93,71 +82,185 @@ HL_PRIM void hl_buffer_str( hl_buffer *b, const uchar *s ) {
 HL_PRIM void hl_buffer_cstr( hl_buffer *b, const char *s ) {
 	if( s ) {
 		int len = (int)hl_utf8_length((vbyte*)s,0);
-		uchar *out = (uchar*)malloc(sizeof(uchar)*(len+1));
-		hl_from_utf8(out,len,s);
-		hl_buffer_str_sub(b,out,len);
-		free(out);
+		if( len <= 0 ) return;
+		if( b->size - b->len < len ) buffer_grow(b,len);
+		hl_from_utf8(b->data + b->len,len,s);
+		b->len += len;
 	} else hl_buffer_str_sub(b,USTR("NULL"),4);
 }
 
 HL_PRIM void hl_buffer_char( hl_buffer *b, uchar c ) {
-	stringitem it;
-	b->totlen++;
-	it = b->data;
-	if( it && it->len != it->size ) {
-		it->str[it->len++] = c;
-		return;
-	}
-	buffer_append_new(b,(uchar*)&c,1);
+	if( b->len == b->size ) buffer_grow(b,1);
+	b->data[b->len++] = c;
 }
 
 HL_PRIM uchar *hl_buffer_content( hl_buffer *b, int *len ) {
-	uchar *buf = (uchar*)hl_gc_alloc_noptr((b->totlen+1)<<1);
-	stringitem it = b->data;
-	uchar *s = ((uchar*)buf) + b->totlen;
-	*s = 0;
-	while( it != NULL ) {
-		stringitem tmp;
-		s -= it->len;
-		memcpy(s,it->str,it->len<<1);
-		tmp = it->next;
-		it = tmp;
+	uchar *buf;
+	if( len ) *len = b->len;
+	if( b->data && b->size - b->len <= (b->size >> 2) ) {
+		// at least 3/4 full : give the block away and copy on next write
+		buf = b->data;
+		buf[b->len] = 0;
+		b->size = b->len;
+		return buf;
 	}
-	if( len ) *len = b->totlen;
+	buf = (uchar*)hl_gc_alloc_noptr((b->len+1)<<1);
+	if( b->len ) memcpy(buf,b->data,b->len<<1);
+	buf[b->len] = 0;
 	return buf;
 }
 
 int hl_buffer_length( hl_buffer *b ) {
-	return b->totlen;
+	return b->len;
 }
 
-typedef struct vlist {
+/*
+	Values are printed without recursion : each array, object or enum being
+	printed has a frame on an explicit stack, holding the index of the next
+	element to print. Objects with a frame are also kept in a small hash set,
+	so a reference back to one of them prints "..." in constant time.
+
+	hl_to_string_limits (or HL_TOSTRING_DEPTH / HL_TOSTRING_SIZE) can bound
+	the nesting depth and the number of chars printed by a single value,
+	which is mostly useful when logging large structures. Both default to 0,
+	meaning no limit.
+*/
+
+typedef struct {
 	vdynamic *v;
-	struct vlist *next;
-} vlist;
+	int *order;
+	int index;
+	int count;
+} vframe;
+
+typedef struct {
+	hl_buffer *b;
+	vframe *frames;
+	vdynamic **set;
+	int depth;
+	int max_frames;
+	int set_mask;
+} vprinter;
+
+#define PRINT_FRAMES	32
+#define PRINT_SET		64
+
+static int to_string_depth = -1;
+static int to_string_size = 0;
+static int string_hash = 0;
+
+HL_PRIM void hl_to_string_limits( int depth, int size ) {
+	to_string_depth = depth < 0 ? 0 : depth;
+	to_string_size = size < 0 ? 0 : size;
+}
+
+static void to_string_init_limits() {
+	int depth = 0, size = 0;
+#	ifndef HL_CONSOLE
+	char *env = getenv("HL_TOSTRING_DEPTH");
+	if( env ) depth = atoi(env);
+	env = getenv("HL_TOSTRING_SIZE");
+	if( env ) size = atoi(env);
+#	endif
+	hl_to_string_limits(depth,size);
+}
 
-static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack );
+static unsigned int print_hash( vprinter *p, vdynamic *v ) {
+	unsigned int h = (unsigned int)((int_val)v >> 4) * 0x9E3779B1;
+	return (h ^ (h >> 16)) & p->set_mask;
+}
+
+static bool print_visited( vprinter *p, vdynamic *v ) {
+	unsigned int i = print_hash(p,v);
+	while( p->set[i] ) {
+		if( p->set[i] == v ) return true;
+		i = (i + 1) & p->set_mask;
+	}
+	return false;
+}
+
+static void print_set_add( vprinter *p, vdynamic *v ) {
+	unsigned int i = print_hash(p,v);
+	while( p->set[i] )
+		i = (i + 1) & p->set_mask;
+	p->set[i] = v;
+}
+
+static void print_set_remove( vprinter *p, vdynamic *v ) {
+	unsigned int i = print_hash(p,v), j;
+	while( p->set[i] != v )
+		i = (i + 1) & p->set_mask;
+	// backward shift the entries of the same probe run
+	j = i;
+	while( true ) {
+		unsigned int k;
+		j = (j + 1) & p->set_mask;
+		if( !p->set[j] ) break;
+		k = print_hash(p,p->set[j]);
+		if( i <= j ? (i < k && k <= j) : (i < k || k <= j) ) continue;
+		p->set[i] = p->set[j];
+		i = j;
+	}
+	p->set[i] = NULL;
+}
+
+static bool print_enter( vprinter *p, vdynamic *v, int count ) {
+	vframe *f;
+	if( print_visited(p,v) || (to_string_depth && p->depth >= to_string_depth) ) {
+		hl_buffer_str_sub(p->b,USTR("..."),3);
+		return false;
+	}
+	if( p->depth == p->max_frames ) {
+		vframe *frames = (vframe*)hl_gc_alloc_raw(sizeof(vframe) * p->max_frames * 2);
+		memcpy(frames,p->frames,sizeof(vframe) * p->depth);
+		p->frames = frames;
+		p->max_frames <<= 1;
+	}
+	if( (p->depth + 1) * 2 > p->set_mask + 1 ) {
+		int size = (p->set_mask + 1) << 1, i;
+		p->set = (vdynamic**)hl_gc_alloc_noptr(sizeof(vdynamic*) * size);
+		memset(p->set,0,sizeof(vdynamic*) * size);
+		p->set_mask = size - 1;
+		for(i=0;i<p->depth;i++)
+			print_set_add(p,p->frames[i].v);
+	}
+	print_set_add(p,v);
+	f = p->frames + p->depth++;
+	f->v = v;
+	f->order = NULL;
+	f->index = 0;
+	f->count = count;
+	return true;
+}
+
+// numbers are formatted in place, at the end of the buffer
+static uchar *print_reserve( hl_buffer *b ) {
+	if( b->size - b->len < 32 ) buffer_grow(b,32);
+	return b->data + b->len;
+}
+
+static void print_value( vprinter *p, vdynamic *v );
 
-static void hl_buffer_addr( hl_buffer *b, void *data, hl_type *t, vlist *stack ) {
-	uchar buf[32];
+static void print_addr( vprinter *p, void *data, hl_type *t ) {
+	hl_buffer *b = p->b;
 	switch( t->kind ) {
 	case HUI8:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),(int)*(unsigned char*)data));
+		b->len += hl_itoa(*(unsigned char*)data,print_reserve(b));
 		break;
 	case HUI16:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),(int)*(unsigned short*)data));
+		b->len += hl_itoa(*(unsigned short*)data,print_reserve(b));
 		break;
 	case HI32:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),*(int*)data));
+		b->len += hl_itoa(*(int*)data,print_reserve(b));
 		break;
 	case HI64:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,PR_I64,*(int64*)data));
+		b->len += usprintf(print_reserve(b),32,PR_I64,*(int64*)data);
 		break;
 	case HF32:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%.9f"),*(float*)data));
+		b->len += usprintf(print_reserve(b),32,USTR("%.9f"),*(float*)data);
 		break;
 	case HF64:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%.17g"),*(double*)data));
+		b->len += hl_dtoa(*(double*)data,print_reserve(b));
 		break;
 	case HBYTES:
 		hl_buffer_str(b,*(uchar**)data);
@@ -169,7 +272,7 @@ static void hl_buffer_addr( hl_buffer *b, void *data, hl_type *t, vlist *stack )
 			vdynamic tmp;
 			tmp.t = t;
 			tmp.v.ptr = *(void**)data;
-			hl_buffer_rec(b, tmp.v.ptr ? &tmp : NULL, stack);
+			print_value(p, tmp.v.ptr ? &tmp : NULL);
 		}
 		break;
 	case HBOOL:
@@ -179,13 +282,13 @@ static void hl_buffer_addr( hl_buffer *b, void *data, hl_type *t, vlist *stack )
 			hl_buffer_str_sub(b,USTR("false"),5);
 		break;
 	default:
-		hl_buffer_rec(b, *(vdynamic**)data, stack);
+		print_value(p, *(vdynamic**)data);
 		break;
 	}
 }
 
-static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
-	uchar buf[32];
+static void print_value( vprinter *p, vdynamic *v ) {
+	hl_buffer *b = p->b;
 	if( v == NULL ) {
 		hl_buffer_str_sub(b,USTR("null"),4);
 		return;
@@ -195,22 +298,22 @@ static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
 		hl_buffer_str_sub(b,USTR("void"),4);
 		break;
 	case HUI8:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),v->v.ui8));
+		b->len += hl_itoa(v->v.ui8,print_reserve(b));
 		break;
 	case HUI16:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),v->v.ui16));
+		b->len += hl_itoa(v->v.ui16,print_reserve(b));
 		break;
 	case HI32:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%d"),v->v.i));
+		b->len += hl_itoa(v->v.i,print_reserve(b));
 		break;
 	case HI64:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,PR_I64,v->v.i64));
+		b->len += usprintf(print_reserve(b),32,PR_I64,v->v.i64);
 		break;
 	case HF32:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%.9f"),v->v.f));
+		b->len += usprintf(print_reserve(b),32,USTR("%.9f"),v->v.f);
 		break;
 	case HF64:
-		hl_buffer_str_sub(b,buf,usprintf(buf,32,USTR("%.17g"),v->v.d));
+		b->len += hl_dtoa(v->v.d,print_reserve(b));
 		break;
 	case HBOOL:
 		if( v->v.b )
@@ -223,11 +326,11 @@ static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
 		break;
 	case HFUN:
 		hl_buffer_str_sub(b,USTR("function#"),9);
-		hl_buffer_str_sub(b, buf, usprintf(buf, 32, _PTR_FMT,(int_val)v));
+		b->len += usprintf(print_reserve(b),32,_PTR_FMT,(int_val)v);
 		break;
 	case HMETHOD:
 		hl_buffer_str_sub(b,USTR("method#"),7);
-		hl_buffer_str_sub(b, buf, usprintf(buf, 32, _PTR_FMT,(int_val)v->v.ptr));
+		b->len += usprintf(print_reserve(b),32,_PTR_FMT,(int_val)v->v.ptr);
 		break;
 	case HOBJ:
 	case HSTRUCT:
@@ -241,30 +344,8 @@ static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
 		}
 		break;
 	case HARRAY:
-		{
-			int i;
-			varray *a = (varray*)v;
-			hl_type *at = a->at;
-			int stride = hl_type_size(at);
-			vlist l;
-			vlist *vtmp = stack;
-			while( vtmp != NULL ) {
-				if( vtmp->v == v ) {
-					hl_buffer_str_sub(b,USTR("..."),3);
-					return;
-				}
-				vtmp = vtmp->next;
-			}
-			l.v = v;
-			l.next = stack;
+		if( print_enter(p,v,((varray*)v)->size) )
 			hl_buffer_char(b,'[');
-			for(i=0;i<a->size;i++) {
-				if( i )
-					hl_buffer_str_sub(b,USTR(", "),2);
-				hl_buffer_addr(b,hl_aptr(a,char) + i * stride,at,&l);
-			}
-			hl_buffer_char(b,']');
-		}
 		break;
 	case HTYPE:
 		hl_buffer_str(b, hl_type_str((hl_type*)v->v.ptr));
@@ -275,50 +356,26 @@ static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
 	case HVIRTUAL:
 		{
 			vvirtual *vv = (vvirtual*)v;
-			int i;
-			vlist l;
-			vlist *vtmp = stack;
 			if( vv->value ) {
-				hl_buffer_rec(b, vv->value, stack);
+				print_value(p, vv->value);
 				return;
 			}
-			while( vtmp != NULL ) {
-				if( vtmp->v == v ) {
-					hl_buffer_str_sub(b,USTR("..."),3);
-					return;
-				}
-				vtmp = vtmp->next;
-			}
-			l.v = v;
-			l.next = stack;
-			hl_buffer_char(b, '{');
-			for(i=0;i<vv->t->virt->nfields;i++) {
-				hl_field_lookup *f = vv->t->virt->lookup + i;
-				if( i ) hl_buffer_str_sub(b,USTR(", "),2);
-				hl_buffer_str(b,(uchar*)hl_field_name(f->hashed_name));
-				hl_buffer_str_sub(b,USTR(" : "),3);
-				hl_buffer_addr(b, (char*)v + vv->t->virt->indexes[f->field_index], f->t, &l);
-			}
-			hl_buffer_char(b, '}');
+			if( print_enter(p,v,vv->t->virt->nfields) )
+				hl_buffer_char(b, '{');
 		}
 		break;
 	case HDYNOBJ:
 		{
 			vdynobj *o = (vdynobj*)v;
 			int i;
-			vlist l;
-			vlist *vtmp = stack;
 			hl_field_lookup *f;
-			while( vtmp != NULL ) {
-				if( vtmp->v == v ) {
-					hl_buffer_str_sub(b,USTR("..."),3);
-					return;
-				}
-				vtmp = vtmp->next;
+			vframe *fr;
+			if( print_visited(p,v) ) {
+				hl_buffer_str_sub(b,USTR("..."),3);
+				return;
 			}
-			l.v = v;
-			l.next = stack;
-			f = hl_lookup_find(o->lookup,o->nfields,hl_hash_gen(USTR("__string"),false));
+			if( !string_hash ) string_hash = hl_hash_gen(USTR("__string"),false);
+			f = hl_lookup_find(o->lookup,o->nfields,string_hash);
 			if( f && f->t->kind == HFUN && f->t->fun->nargs == 0 && f->t->fun->ret->kind == HBYTES ) {
 				vclosure *v = (vclosure*)o->values[f->field_index&HL_DYNOBJ_INDEX_MASK];
 				if( v ) {
@@ -326,68 +383,132 @@ static void hl_buffer_rec( hl_buffer *b, vdynamic *v, vlist *stack ) {
 					break;
 				}
 			}
+			if( !print_enter(p,v,o->nfields) )
+				break;
 			hl_buffer_char(b, '{');
-			int tmp[128];
-			int *indexes = o->nfields <= 128 ? tmp : (int*)hl_gc_alloc_noptr(sizeof(int) * o->nfields);
+			if( o->nfields == 0 )
+				break;
+			// print fields in declaration order
+			fr = p->frames + p->depth - 1;
+			fr->order = (int*)hl_gc_alloc_noptr(sizeof(int) * o->nfields);
 			for(i=0;i<o->nfields;i++) {
 				hl_field_lookup *f = o->lookup + i;
-				indexes[((unsigned)f->field_index)>>HL_DYNOBJ_INDEX_SHIFT] = i;
+				fr->order[((unsigned)f->field_index)>>HL_DYNOBJ_INDEX_SHIFT] = i;
 			}
-			for(i=0;i<o->nfields;i++) {
-				hl_field_lookup *f = o->lookup + indexes[i];
-				if( i ) hl_buffer_str_sub(b,USTR(", "),2);
-				hl_buffer_str(b,(uchar*)hl_field_name(f->hashed_name));
-				hl_buffer_str_sub(b,USTR(" : "),3);
-				hl_buffer_addr(b, hl_is_ptr(f->t) ? (void*)(o->values + (f->field_index&HL_DYNOBJ_INDEX_MASK)) : (void*)(o->raw_data + (f->field_index&HL_DYNOBJ_INDEX_MASK)), f->t, &l);
-			}
-			hl_buffer_char(b, '}');
 		}
 		break;
 	case HABSTRACT:
 		hl_buffer_char(b, '~');
 		hl_buffer_str(b, v->t->abs_name);
 		hl_buffer_char(b, ':');
-		hl_buffer_str_sub(b, buf, usprintf(buf, 32, _PTR_FMT,(int_val)v->v.ptr));
+		b->len += usprintf(print_reserve(b),32,_PTR_FMT,(int_val)v->v.ptr);
 		break;
 	case HENUM:
 		{
-			int i;
-			vlist l;
-			vlist *vtmp = stack;
 			hl_enum_construct *c = v->t->tenum->constructs + ((venum*)v)->index;
 			if( !c->nparams ) {
 				hl_buffer_str(b, c->name);
 				break;
 			}
-			while( vtmp != NULL ) {
-				if( vtmp->v == v ) {
-					hl_buffer_str_sub(b,USTR("..."),3);
-					return;
-				}
-				vtmp = vtmp->next;
+			if( print_visited(p,v) ) {
+				hl_buffer_str_sub(b,USTR("..."),3);
+				return;
 			}
-			l.v = v;
-			l.next = stack;
 			hl_buffer_str(b, c->name);
-			hl_buffer_char(b,'(');
-			for(i=0;i<c->nparams;i++) {
-				if( i ) hl_buffer_char(b,',');
-				hl_buffer_addr(b,(char*)v + c->offsets[i],c->params[i], &l);
-			}
-			hl_buffer_char(b,')');
+			if( print_enter(p,v,c->nparams) )
+				hl_buffer_char(b,'(');
 		}
 		break;
 	case HNULL:
 		hl_buffer_str_sub(b, USTR("_null_"), 6);
 		break;
 	default:
-		hl_buffer_str_sub(b, buf, usprintf(buf, 32, _PTR_FMT USTR("H"),(int_val)v));
+		b->len += usprintf(print_reserve(b),32,_PTR_FMT USTR("H"),(int_val)v);
+		break;
+	}
+}
+
+static void print_next( vprinter *p, vframe *f ) {
+	hl_buffer *b = p->b;
+	vdynamic *v = f->v;
+	int i = f->index++;
+	switch( v->t->kind ) {
+	case HARRAY:
+		{
+			varray *a = (varray*)v;
+			if( i ) hl_buffer_str_sub(b,USTR(", "),2);
+			print_addr(p,hl_aptr(a,char) + i * hl_type_size(a->at),a->at);
+		}
+		break;
+	case HVIRTUAL:
+		{
+			vvirtual *vv = (vvirtual*)v;
+			hl_field_lookup *f = vv->t->virt->lookup + i;
+			if( i ) hl_buffer_str_sub(b,USTR(", "),2);
+			hl_buffer_str(b,(uchar*)hl_field_name(f->hashed_name));
+			hl_buffer_str_sub(b,USTR(" : "),3);
+			print_addr(p, (char*)v + vv->t->virt->indexes[f->field_index], f->t);
+		}
+		break;
+	case HDYNOBJ:
+		{
+			vdynobj *o = (vdynobj*)v;
+			hl_field_lookup *fl = o->lookup + f->order[i];
+			if( i ) hl_buffer_str_sub(b,USTR(", "),2);
+			hl_buffer_str(b,(uchar*)hl_field_name(fl->hashed_name));
+			hl_buffer_str_sub(b,USTR(" : "),3);
+			print_addr(p, hl_is_ptr(fl->t) ? (void*)(o->values + (fl->field_index&HL_DYNOBJ_INDEX_MASK)) : (void*)(o->raw_data + (fl->field_index&HL_DYNOBJ_INDEX_MASK)), fl->t);
+		}
+		break;
+	case HENUM:
+		{
+			hl_enum_construct *c = v->t->tenum->constructs + ((venum*)v)->index;
+			if( i ) hl_buffer_char(b,',');
+			print_addr(p,(char*)v + c->offsets[i],c->params[i]);
+		}
+		break;
+	default:
 		break;
 	}
 }
 
 HL_PRIM void hl_buffer_val( hl_buffer *b, vdynamic *v ) {
-	hl_buffer_rec(b,v,NULL);
+	vframe frames[PRINT_FRAMES];
+	vdynamic *set[PRINT_SET];
+	vprinter p;
+	int start = b->len;
+	if( to_string_depth < 0 ) to_string_init_limits();
+	p.b = b;
+	p.frames = frames;
+	p.set = set;
+	p.depth = 0;
+	p.max_frames = PRINT_FRAMES;
+	p.set_mask = PRINT_SET - 1;
+	memset(set,0,sizeof(set));
+	print_value(&p,v);
+	while( p.depth ) {
+		vframe *f = p.frames + p.depth - 1;
+		if( to_string_size && b->len - start > to_string_size ) {
+			b->len = start + to_string_size;
+			hl_buffer_str_sub(b,USTR("..."),3);
+			return;
+		}
+		if( f->index < f->count ) {
+			print_next(&p,f);
+			continue;
+		}
+		switch( f->v->t->kind ) {
+		case HARRAY: hl_buffer_char(b,']'); break;
+		case HENUM: hl_buffer_char(b,')'); break;
+		default: hl_buffer_char(b,'}'); break;
+		}
+		print_set_remove(&p,f->v);
+		p.depth--;
+	}
+	if( to_string_size && b->len - start > to_string_size ) {
+		b->len = start + to_string_size;
+		hl_buffer_str_sub(b,USTR("..."),3);
+	}
 }
 
 HL_PRIM uchar *hl_to_string( vdynamic *v ) {
@@ -400,3 +521,5 @@ HL_PRIM uchar *hl_to_string( vdynamic *v ) {
 	hl_buffer_char(b,0);
 	return hl_buffer_content(b,NULL);
 }
+
+DEFINE_PRIM(_VOID, to_string_limits, _I32 _I32);
@@ -20,6 +20,7 @@
  * DEALINGS IN THE SOFTWARE.
  */
 #include <hl.h>
+#include <float.h>
 
 HL_PRIM vbyte *hl_alloc_bytes( int size ) {
 	return (vbyte*)hl_gc_alloc_noptr(size);
@@ -39,132 +40,319 @@ HL_PRIM int hl_bytes_compare( vbyte *a, int apos, vbyte *b, int bpos, int len )
 	return memcmp(a+apos,b+bpos,len);
 }
 
+#ifdef HL_SSE2
+#	include <emmintrin.h>
+#endif
+
 HL_PRIM int hl_bytes_compare16( vbyte *a, vbyte *b, int len ) {
 	unsigned short *s1 = (unsigned short *)a;
 	unsigned short *s2 = (unsigned short *)b;
-	int i;
-	for(i=0;i<len;i++)
+	int i = 0;
+#	ifdef HL_SSE2
+	// skip equal blocks of 8 chars, then diff the first unequal pair
+	while( len - i >= 8 ) {
+		__m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((__m128i*)(s1 + i)),_mm_loadu_si128((__m128i*)(s2 + i)));
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(eq) ^ 0xFFFF;
+		if( mask ) {
+			i += hl_ctz(mask) >> 1;
+			return ((int)s1[i]) - ((int)s2[i]);
+		}
+		i += 8;
+	}
+#	endif
+	for(;i<len;i++)
 		if( s1[i] != s2[i] )
 			return ((int)s1[i]) - ((int)s2[i]);
 	return 0;
 }
 
-typedef unsigned char byte;
-static void *
-memfind_rb (const void  *in_block,      /*  Block containing data            */
-            size_t       block_size,    /*  Size of block in bytes           */
-            const void  *in_pattern,    /*  Pattern to search for            */
-            size_t       pattern_size,  /*  Size of pattern block            */
-            size_t      *shift,         /*  Shift table (search buffer)      */
-            bool        *repeat_find)   /*  TRUE: search buffer already init */
-{
-    size_t
-        byte_nbr,                       /*  Distance through block           */
-        match_size;                     /*  Size of matched part             */
-    const byte
-        *match_base = NULL,             /*  Base of match of pattern         */
-        *match_ptr  = NULL,             /*  Point within current match       */
-        *limit      = NULL;             /*  Last potiental match point       */
-    const byte
-        *block   = (byte *) in_block,   /*  Concrete pointer to block data   */
-        *pattern = (byte *) in_pattern; /*  Concrete pointer to search value */
-
-    if (block == NULL || pattern == NULL || shift == NULL)
-        return (NULL);
-
-    /*  Pattern must be smaller or equal in size to string                   */
-    if (block_size < pattern_size)
-        return (NULL);                  /*  Otherwise it's not found         */
-
-    if (pattern_size == 0)              /*  Empty patterns match at start    */
-        return ((void *)block);
-
-    /*  Build the shift table unless we're continuing a previous search      */
-
-    /*  The shift table determines how far to shift before trying to match   */
-    /*  again, if a match at this point fails.  If the byte after where the  */
-    /*  end of our pattern falls is not in our pattern, then we start to     */
-    /*  match again after that byte; otherwise we line up the last occurence */
-    /*  of that byte in our pattern under that byte, and try match again.    */
-
-    if (!repeat_find || !*repeat_find)
-      {
-        for (byte_nbr = 0; byte_nbr < 256; byte_nbr++)
-            shift [byte_nbr] = pattern_size + 1;
-        for (byte_nbr = 0; byte_nbr < pattern_size; byte_nbr++)
-            shift [(byte) pattern [byte_nbr]] = pattern_size - byte_nbr;
-
-        if (repeat_find)
-            *repeat_find = true;
-      }
-
-    /*  Search for the block, each time jumping up by the amount             */
-    /*  computed in the shift table                                          */
-
-    limit = block + (block_size - pattern_size + 1);
-
-    for (match_base = block;
-         match_base < limit;
-         match_base += shift [*(match_base + pattern_size)])
-      {
-        match_ptr  = match_base;
-        match_size = 0;
-
-        /*  Compare pattern until it all matches, or we find a difference    */
-        while (*match_ptr++ == pattern [match_size++])
-          {
-            /*  If we found a match, return the start address                */
-            if (match_size >= pattern_size)
-              return ((void*)(match_base));
-
-          }
-      }
-    return NULL;
+static inline unsigned int read16( const vbyte *p ) {
+	unsigned short v;
+	memcpy(&v,p,2);
+	return v;
 }
 
-HL_PRIM int hl_bytes_find( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
-	size_t searchbuf [256];
-	bool repeat_find = false;
-	vbyte *found = (vbyte*)memfind_rb(where + pos,len,which+wpos,wlen,searchbuf,&repeat_find);
-	if( found == NULL ) return -1;
-	return (int)(size_t)(found - where);
+/*
+	Substring search : candidates are the offsets where both the first and
+	the last unit of the pattern match, found 16 bytes at a time, and are then
+	checked with memcmp. With 2-byte units only even offsets are candidates,
+	so a UCS2 match never straddles two chars. Returns -1 if not found.
+*/
+static int find_first( const vbyte *s, int len, const vbyte *p, int plen, int unit ) {
+	int i = 0;
+	if( plen > len ) return -1;
+	if( plen == 0 ) return 0;
+#	ifdef HL_SSE2
+	{
+		int last = plen - unit;
+		unsigned int keep = unit == 1 ? 0xFFFF : 0x5555;
+		__m128i first = unit == 1 ? _mm_set1_epi8((char)p[0]) : _mm_set1_epi16((short)read16(p));
+		__m128i lastv = unit == 1 ? _mm_set1_epi8((char)p[last]) : _mm_set1_epi16((short)read16(p + last));
+		while( i + last + 16 <= len ) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(s + i + last));
+			__m128i eq = unit == 1 ? _mm_and_si128(_mm_cmpeq_epi8(a,first),_mm_cmpeq_epi8(b,lastv)) : _mm_and_si128(_mm_cmpeq_epi16(a,first),_mm_cmpeq_epi16(b,lastv));
+			unsigned int mask = _mm_movemask_epi8(eq) & keep;
+			while( mask ) {
+				int k = i + hl_ctz(mask);
+				if( memcmp(s + k,p,plen) == 0 )
+					return k;
+				mask &= mask - 1;
+			}
+			i += 16;
+		}
+	}
+#	endif
+	if( unit == 1 ) {
+		while( i + plen <= len ) {
+			const vbyte *c = (const vbyte*)memchr(s + i,p[0],len - plen + 1 - i);
+			if( c == NULL ) break;
+			i = (int)(c - s);
+			if( memcmp(c,p,plen) == 0 )
+				return i;
+			i++;
+		}
+		return -1;
+	}
+	for(;i + plen <= len;i += unit)
+		if( s[i] == p[0] && memcmp(s + i,p,plen) == 0 )
+			return i;
+	return -1;
 }
 
-HL_PRIM int hl_bytes_rfind( vbyte *where, int len, vbyte *which, int wlen ) {
-	if( wlen > len ) return -1;
-	if( wlen == 0 ) return len; // at end
-	int pos = len - wlen;
-	while( pos >= 0 ) {
-		if( memcmp(where+pos,which,wlen) == 0 )
-			return pos;
-		pos--;
+// same as find_first, from the end ; an empty pattern matches at len
+static int find_last( const vbyte *s, int len, const vbyte *p, int plen, int unit ) {
+	int i;
+	if( plen > len ) return -1;
+	if( plen == 0 ) return len;
+	i = len - plen;
+	i -= i & (unit - 1);
+#	ifdef HL_SSE2
+	{
+		int last = plen - unit;
+		unsigned int keep = unit == 1 ? 0xFFFF : 0x5555;
+		__m128i first = unit == 1 ? _mm_set1_epi8((char)p[0]) : _mm_set1_epi16((short)read16(p));
+		__m128i lastv = unit == 1 ? _mm_set1_epi8((char)p[last]) : _mm_set1_epi16((short)read16(p + last));
+		while( i >= 16 - unit ) {
+			// block of the 16 candidates ending at i
+			int j = i - (16 - unit);
+			__m128i a = _mm_loadu_si128((const __m128i*)(s + j));
+			__m128i b = _mm_loadu_si128((const __m128i*)(s + j + last));
+			__m128i eq = unit == 1 ? _mm_and_si128(_mm_cmpeq_epi8(a,first),_mm_cmpeq_epi8(b,lastv)) : _mm_and_si128(_mm_cmpeq_epi16(a,first),_mm_cmpeq_epi16(b,lastv));
+			unsigned int mask = _mm_movemask_epi8(eq) & keep;
+			while( mask ) {
+				int bit = hl_msb(mask);
+				if( memcmp(s + j + bit,p,plen) == 0 )
+					return j + bit;
+				mask &= ~(1u << bit);
+			}
+			i = j - unit;
+		}
 	}
+#	endif
+	for(;i >= 0;i -= unit)
+		if( s[i] == p[0] && memcmp(s + i,p,plen) == 0 )
+			return i;
 	return -1;
 }
 
+// offset of the first unit of s which is one of the count units of set, or -1
+static int find_any( const vbyte *s, int len, const vbyte *set, int count, int unit ) {
+	int i = 0, k;
+	if( count <= 0 ) return -1;
+#	ifdef HL_SSE2
+	if( count <= 8 ) {
+		__m128i v[8];
+		unsigned int keep = unit == 1 ? 0xFFFF : 0x5555;
+		for(k=0;k<count;k++)
+			v[k] = unit == 1 ? _mm_set1_epi8((char)set[k]) : _mm_set1_epi16((short)read16(set + (k << 1)));
+		while( i + 16 <= len ) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+			__m128i eq = _mm_setzero_si128();
+			unsigned int mask;
+			for(k=0;k<count;k++)
+				eq = _mm_or_si128(eq,unit == 1 ? _mm_cmpeq_epi8(a,v[k]) : _mm_cmpeq_epi16(a,v[k]));
+			mask = _mm_movemask_epi8(eq) & keep;
+			if( mask )
+				return i + hl_ctz(mask);
+			i += 16;
+		}
+	}
+#	endif
+	if( unit == 1 ) {
+		unsigned char map[256];
+		memset(map,0,sizeof(map));
+		for(k=0;k<count;k++)
+			map[set[k]] = 1;
+		for(;i<len;i++)
+			if( map[s[i]] )
+				return i;
+		return -1;
+	}
+	for(;i + 2 <= len;i += 2) {
+		unsigned int c = read16(s + i);
+		for(k=0;k<count;k++)
+			if( c == read16(set + (k << 1)) )
+				return i;
+	}
+	return -1;
+}
+
+HL_PRIM int hl_bytes_find( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
+	int k = find_first(where + pos,len,which + wpos,wlen,1);
+	return k < 0 ? -1 : pos + k;
+}
+
+HL_PRIM int hl_bytes_rfind( vbyte *where, int len, vbyte *which, int wlen ) {
+	return find_last(where,len,which,wlen,1);
+}
+
+// same as hl_bytes_find/rfind but only matches whole UCS2 chars, lengths are in bytes
+HL_PRIM int hl_bytes_find16( vbyte *where, int pos, int len, vbyte *which, int wpos, int wlen ) {
+	int k = find_first(where + pos,len,which + wpos,wlen,2);
+	return k < 0 ? -1 : pos + k;
+}
+
+HL_PRIM int hl_bytes_rfind16( vbyte *where, int len, vbyte *which, int wlen ) {
+	return find_last(where,len,which,wlen,2);
+}
+
+// position of the first byte of where[pos,pos+len] which is one of the count bytes of set
+HL_PRIM int hl_bytes_find_any( vbyte *where, int pos, int len, vbyte *set, int count ) {
+	int k = find_any(where + pos,len,set,count,1);
+	return k < 0 ? -1 : pos + k;
+}
+
+// same for UCS2 : len is in bytes, count in chars
+HL_PRIM int hl_bytes_find_any16( vbyte *where, int pos, int len, vbyte *set, int count ) {
+	int k = find_any(where + pos,len,set,count,2);
+	return k < 0 ? -1 : pos + k;
+}
+
 HL_PRIM void hl_bytes_fill( vbyte *bytes, int pos, int len, int value ) {
 	memset(bytes+pos,value,len);
 }
 
 
-static int ms_gcd( int m, int n ) {
- 	while( n != 0 ) {
-		int t = m % n;
-		m=n; n=t;
+#define MS_INSERT			12
+#define PDQ_INSERT			24
+#define PDQ_NINTHER			128
+#define PDQ_PARTIAL_LIMIT	8
+#define NATIVE_INSERT		64
+#define SORT_MAX_THREADS	16
+#define SORT_PARALLEL_MIN	(1 << 16)
+
+typedef void (*sort_job)( void *param );
+
+#ifdef HL_THREADS
+typedef struct {
+	sort_job job;
+	void *param;
+	hl_semaphore *wake;
+	hl_semaphore *done;
+} sort_worker;
+
+// runs the jobs it is woken for, until it is woken without one
+static void sort_worker_main( sort_worker *w ) {
+	while( true ) {
+		hl_semaphore_acquire(w->wake);
+		if( w->job == NULL ) break;
+		w->job(w->param);
+		hl_semaphore_release(w->done);
+	}
+	hl_semaphore_release(w->done);
+}
+#endif
+
+/*
+	The threads of a sort are started once and run all its passes. They are
+	unknown to the GC, as jobs only touch memory already allocated by the caller.
+*/
+typedef struct {
+	int count;
+#	ifdef HL_THREADS
+	hl_semaphore *done;
+	sort_worker workers[SORT_MAX_THREADS];
+#	endif
+} sort_pool;
+
+// starts up to count - 1 workers, the current thread being the last one
+static void sort_pool_start( sort_pool *p, int count ) {
+	p->count = 0;
+#	ifdef HL_THREADS
+	p->done = NULL;
+	if( count <= 1 ) return;
+	p->done = hl_semaphore_alloc(0);
+	while( p->count < count - 1 ) {
+		sort_worker *w = p->workers + p->count;
+		w->wake = hl_semaphore_alloc(0);
+		w->done = p->done;
+		if( !hl_thread_start(sort_worker_main,w,false) ) {
+			hl_semaphore_free(w->wake);
+			break;
+		}
+		p->count++;
+	}
+#	endif
+}
+
+// runs job on count params of the given size, the ones without a worker in the current thread
+static void sort_pool_run( sort_pool *p, sort_job job, void *params, int size, int count ) {
+	int i, n = count - 1 < p->count ? count - 1 : p->count;
+#	ifdef HL_THREADS
+	for(i=0;i<n;i++) {
+		sort_worker *w = p->workers + i;
+		w->job = job;
+		w->param = (char*)params + (i + 1) * size;
+		hl_semaphore_release(w->wake);
+	}
+#	endif
+	job(params);
+	for(i=n+1;i<count;i++)
+		job((char*)params + i * size);
+#	ifdef HL_THREADS
+	for(i=0;i<n;i++)
+		hl_semaphore_acquire(p->done);
+#	endif
+}
+
+static void sort_pool_stop( sort_pool *p ) {
+#	ifdef HL_THREADS
+	int i;
+	for(i=0;i<p->count;i++) {
+		p->workers[i].job = NULL;
+		hl_semaphore_release(p->workers[i].wake);
 	}
- 	return m;
+	for(i=0;i<p->count;i++)
+		hl_semaphore_acquire(p->done);
+	for(i=0;i<p->count;i++)
+		hl_semaphore_free(p->workers[i].wake);
+	if( p->done ) hl_semaphore_free(p->done);
+#	endif
+}
+
+static inline uint64 f64_sort_key( double d ) {
+	uint64 b;
+	memcpy(&b,&d,sizeof(double));
+	// negative values have all their bits flipped to sort backwards
+	return (b >> 63) ? ~b : b | (1ULL << 63);
 }
 
 #define TSORT int
+#define TKEY unsigned int
+#define TKEY_OF(v)	((unsigned int)(v) ^ 0x80000000)
 #define TID(t)	t##_i32
 #include "sort.h"
 #define TSORT double
+#define TKEY uint64
+#define TKEY_OF(v)	f64_sort_key(v)
 #define TID(t)	t##_f64
 #include "sort.h"
 
 HL_PRIM void hl_bsort_i32( vbyte *bytes, int pos, int len, vclosure *cmp ) {
 	m_sort_i32 m;
 	m.arr = (int*)(bytes + pos);
+	m.tmp = len > MS_INSERT ? (int*)hl_gc_alloc_noptr((len >> 1) * sizeof(int)) : NULL;
 	m.c = cmp;
 	merge_sort_rec_i32(&m,0,len);
 }
@@ -172,59 +360,315 @@ HL_PRIM void hl_bsort_i32( vbyte *bytes, int pos, int len, vclosure *cmp ) {
 HL_PRIM void hl_bsort_f64( vbyte *bytes, int pos, int len, vclosure *cmp ) {
 	m_sort_f64 m;
 	m.arr = (double*)(bytes + pos);
+	m.tmp = len > MS_INSERT ? (double*)hl_gc_alloc_noptr((len >> 1) * sizeof(double)) : NULL;
 	m.c = cmp;
 	merge_sort_rec_f64(&m,0,len);
 }
 
+HL_PRIM void hl_bsort_unstable_i32( vbyte *bytes, int pos, int len, vclosure *cmp ) {
+	m_sort_i32 m;
+	m.arr = (int*)(bytes + pos);
+	m.tmp = NULL;
+	m.c = cmp;
+	pdq_sort_i32(&m,len);
+}
+
+HL_PRIM void hl_bsort_unstable_f64( vbyte *bytes, int pos, int len, vclosure *cmp ) {
+	m_sort_f64 m;
+	m.arr = (double*)(bytes + pos);
+	m.tmp = NULL;
+	m.c = cmp;
+	pdq_sort_f64(&m,len);
+}
+
+/*
+	Sorts without comparator, using up to threads threads for large arrays.
+	Floats are sorted by their bits : -0 comes before 0, and NaNs are put
+	at both ends depending on their sign bit.
+*/
+HL_PRIM void hl_bsort_native_i32( vbyte *bytes, int pos, int len, bool desc, int threads ) {
+	native_sort_i32((int*)(bytes + pos),len,desc,threads);
+}
+
+HL_PRIM void hl_bsort_native_f64( vbyte *bytes, int pos, int len, bool desc, int threads ) {
+	native_sort_f64((double*)(bytes + pos),len,desc,threads);
+}
+
 static inline bool is_space_char(uchar c) {
 	return c == 32 || (c > 8 && c < 14);
 }
 
+/*
+	Decimal to double conversion, following the Eisel-Lemire algorithm
+	(https://github.com/fastfloat/fast_float). The 128-bit truncated powers
+	of 5 are rebuilt from one base every 26 exponents, with a 2-bit correction.
+*/
+
+#include "pow5.h"
+
+#define POW10_MIN	(-342)
+#define POW10_MAX	308
+#define POW10_STEP	POW5_TABLE_SIZE
+
+static const uint64 POW10_SPLIT[26][2] = {
+	{ 0xEEF453D6923BD65AULL, 0x113FAA2906A13B3FULL },
+	{ 0x9A6BB0AA55653B2DULL, 0x47B233C92125366EULL },
+	{ 0xC795830D75038C1DULL, 0xD59DF5B9EF6A2417ULL },
+	{ 0x80FA687F881C7F8EULL, 0x7CE66634BC9D0B99ULL },
+	{ 0xA6B34AD8C9DFC06FULL, 0xF42FAA48C0EA481EULL },
+	{ 0xD77485CB25823AC7ULL, 0x7D633293366B828BULL },
+	{ 0x8B3C113C38F9F37EULL, 0xDE83BC408DD3DD04ULL },
+	{ 0xB3F4E093DB73A093ULL, 0x59ED216765690F56ULL },
+	{ 0xE896A0D7E51E1566ULL, 0x77B020BAF9C81D17ULL },
+	{ 0x964E858C91BA2655ULL, 0x3A6A07F8D510F86FULL },
+	{ 0xC24452DA229B021BULL, 0xFBE85BADCE996168ULL },
+	{ 0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL },
+	{ 0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL },
+	{ 0xD1B71758E219652BULL, 0xD3C36113404EA4A9ULL },
+	{ 0x878678326EAC9000ULL, 0x0000000000000000ULL },
+	{ 0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL },
+	{ 0xE264589A4DCDAB14ULL, 0xC696963C7EED2DD1ULL },
+	{ 0x924D692CA61BE758ULL, 0x593C2626705F9C56ULL },
+	{ 0xBD176620A501FBFFULL, 0xB650E5A93BC3D898ULL },
+	{ 0xF46518C2EF5B8CD1ULL, 0x7EB258665FC25D69ULL },
+	{ 0x9DEFBF01B061ADABULL, 0x3A0888136AFA64A7ULL },
+	{ 0xCC20CE9BD35C78A5ULL, 0x31EC038DF7B441F4ULL },
+	{ 0x83EA2B892091E44DULL, 0x934AED0AAB460432ULL },
+	{ 0xAA7EEBFB9DF9DE8DULL, 0xDDBB901B98FEEAB7ULL },
+	{ 0xDC5C5301C56B75F7ULL, 0x7641A140CC7810FBULL },
+	{ 0x8E679C2F5E44FF8FULL, 0x570F09EAA7EA7648ULL }
+};
+
+static const unsigned int POW10_OFFSETS[41] = {
+	0x15155440, 0x56451010, 0x55565555, 0x51555455, 0x44545545, 0x95655659,
+	0x59545556, 0x41155555, 0x41010045, 0x50401100, 0x55554155, 0x40144145,
+	0x50040015, 0x55454450, 0x55445450, 0x95515569, 0x65555465, 0x05555145,
+	0x14051554, 0x55405441, 0x555555A5, 0x00000045, 0x00000000, 0x00000000,
+	0x00000000, 0x00000000, 0x14141100, 0x55441050, 0x05440505, 0x00001055,
+	0x00401400, 0x01111000, 0x00100540, 0x44011400, 0x00000000, 0x44000004,
+	0x50155514, 0x00554115, 0x01415145, 0x40000004, 0x00000041
+};
+
+static const double POW10_EXACT[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// w * 10^q is exact with a single rounding when doubles are not evaluated with extra precision
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#	define FAST_EXACT_FLOAT	false
+#else
+#	define FAST_EXACT_FLOAT	true
+#endif
+
+static inline int clz64( uint64 v ) {
+#	if defined(__GNUC__)
+	return __builtin_clzll(v);
+#	else
+	int n = 0;
+	while( !(v & (1ULL << 63)) ) {
+		v <<= 1;
+		n++;
+	}
+	return n;
+#	endif
+}
+
+// 5^q scaled to [2^127,2^128), truncated ; out[0] is the high word
+static void compute_pow10( int q, uint64 *out ) {
+	int i = q - POW10_MIN;
+	int offset = i % POW10_STEP;
+	const uint64 *base = POW10_SPLIT[i / POW10_STEP];
+	uint64 m, l0, h0, l1, h1, mid, top;
+	int lz;
+	if( offset == 0 ) {
+		out[0] = base[0];
+		out[1] = base[1];
+		return;
+	}
+	m = POW5_TABLE[offset];
+	l0 = umul128(base[1], m, &h0);
+	l1 = umul128(base[0], m, &h1);
+	mid = h0 + l1;
+	top = h1 + (mid < h0);
+	lz = clz64(top);
+	if( lz ) {
+		top = (top << lz) | (mid >> (64 - lz));
+		mid = (mid << lz) | (l0 >> (64 - lz));
+	}
+	out[0] = top;
+	out[1] = mid + ((POW10_OFFSETS[i >> 4] >> ((i & 15) << 1)) & 3);
+}
+
+// w * 10^q rounded to nearest even, as raw positive double bits
+static uint64 eisel_lemire( uint64 w, int q ) {
+	uint64 pow[2], lo, hi, mantissa;
+	int lz, upper, shift, power2;
+	if( w == 0 || q < POW10_MIN )
+		return 0;
+	if( q > POW10_MAX )
+		return 0x7FF0000000000000ULL;
+	lz = clz64(w);
+	w <<= lz;
+	compute_pow10(q, pow);
+	lo = umul128(w, pow[0], &hi);
+	if( (hi & 0x1FF) == 0x1FF ) {
+		uint64 hi2;
+		umul128(w, pow[1], &hi2);
+		lo += hi2;
+		if( hi2 > lo ) hi++;
+	}
+	upper = (int)(hi >> 63);
+	shift = upper + 64 - 52 - 3;
+	mantissa = hi >> shift;
+	power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + 1023;
+	if( power2 <= 0 ) {
+		// subnormal
+		if( -power2 + 1 >= 64 )
+			return 0;
+		mantissa >>= -power2 + 1;
+		mantissa += mantissa & 1;
+		mantissa >>= 1;
+		power2 = mantissa < (1ULL << 52) ? 0 : 1;
+		return ((uint64)power2 << 52) | (mantissa & ((1ULL << 52) - 1));
+	}
+	// exact halfway case : round to even instead of up
+	if( lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 && (mantissa << shift) == hi )
+		mantissa &= ~1ULL;
+	mantissa += mantissa & 1;
+	mantissa >>= 1;
+	if( mantissa >= (2ULL << 52) ) {
+		mantissa = 1ULL << 52;
+		power2++;
+	}
+	if( power2 >= 0x7FF )
+		return 0x7FF0000000000000ULL;
+	return ((uint64)power2 << 52) | (mantissa & ((1ULL << 52) - 1));
+}
+
+/*
+	Converts w * 10^q. When w only holds the first 19 significant digits,
+	the result is valid if w and w + 1 round to the same double ; returns
+	false otherwise.
+*/
+static bool decimal_to_bits( uint64 w, int q, bool truncated, uint64 *bits ) {
+	*bits = eisel_lemire(w, q);
+	return !truncated || eisel_lemire(w + 1, q) == *bits;
+}
+
+#define TCHAR uchar
+#define TID(t) t##_ucs2
+#include "parse.h"
+#define TCHAR unsigned char
+#define TID(t) t##_utf8
+#include "parse.h"
+
 HL_PRIM double hl_parse_float( vbyte *bytes, int pos, int len ) {
 	const uchar *str = (uchar*)(bytes+pos);
-	uchar *end = NULL;
-	while( is_space_char(*str) ) str++;
-	double d = utod(str,&end);
-	if( end == str )
+	double d;
+	if( !parse_float_ucs2(str,str + len,&d) )
 		return hl_nan();
 	return d;
 }
 
-static inline bool has_hex_prefix( const uchar *c, int len, bool is_signed ) {
-	if (is_signed)
-		return len >= 3 && c[1] == '0' && (c[2] == 'x' || c[2] == 'X');
-	return len >= 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X');
-}
-
 HL_PRIM vdynamic *hl_parse_int( vbyte *bytes, int pos, int len ) {
-	const uchar *c = (uchar*)(bytes + pos);
-	const uchar *start = c;
+	const uchar *str = (uchar*)(bytes+pos);
 	int h;
-	while( is_space_char(*c) ) c++;
-	uchar sign = c[0];
-	bool is_signed = sign == '-' || sign == '+';
-	if( has_hex_prefix(c,(int)(len+start-c),is_signed) ) {
-		h = 0;
-		c += is_signed ? 3 : 2;
-		while( *c ) {
-			uchar k = *c++;
-			if( k >= '0' && k <= '9' )
-				h = (h << 4) | (k - '0');
-			else if( k >= 'A' && k <= 'F' )
-				h = (h << 4) | ((k - 'A') + 10);
-			else if( k >= 'a' && k <= 'f' )
-				h = (h << 4) | ((k - 'a') + 10);
-			else
-				break;
+	if( !parse_int_ucs2(str,str + len,&h) )
+		return NULL;
+	return hl_make_dyn(&h,&hlt_i32);
+}
+
+HL_PRIM double hl_try_parse_float( vbyte *bytes, int pos, int len, bool *ok ) {
+	const uchar *str = (uchar*)(bytes+pos);
+	double d = 0.;
+	*ok = parse_float_ucs2(str,str + len,&d);
+	return d;
+}
+
+HL_PRIM int hl_try_parse_int( vbyte *bytes, int pos, int len, bool *ok ) {
+	const uchar *str = (uchar*)(bytes+pos);
+	int h = 0;
+	*ok = parse_int_ucs2(str,str + len,&h);
+	return h;
+}
+
+HL_PRIM double hl_try_parse_float_utf8( vbyte *bytes, int pos, int len, bool *ok ) {
+	double d = 0.;
+	*ok = parse_float_utf8(bytes + pos,bytes + pos + len,&d);
+	return d;
+}
+
+HL_PRIM int hl_try_parse_int_utf8( vbyte *bytes, int pos, int len, bool *ok ) {
+	int h = 0;
+	*ok = parse_int_utf8(bytes + pos,bytes + pos + len,&h);
+	return h;
+}
+
+/*
+	Parses the sep separated UTF-8 fields of bytes[pos,pos+len] into a new
+	f64 array and sets *count. Fields that are not numbers are stored as
+	NaN and counted in *errors.
+*/
+HL_PRIM vbyte *hl_parse_f64_column( vbyte *bytes, int pos, int len, int sep, int *count, int *errors ) {
+	vbyte *c = bytes + pos, *end = c + len;
+	double *out;
+	int n = 1, i = 0, nerr = 0;
+	if( len == 0 ) {
+		*count = 0;
+		*errors = 0;
+		return hl_alloc_bytes(0);
+	}
+	while( (c = memchr(c,sep,end - c)) != NULL ) {
+		c++;
+		n++;
+	}
+	out = (double*)hl_alloc_bytes(n * sizeof(double));
+	c = bytes + pos;
+	while( i < n ) {
+		vbyte *next = i == n - 1 ? end : memchr(c,sep,end - c);
+		if( !parse_float_utf8(c,next,out + i) ) {
+			out[i] = hl_nan();
+			nerr++;
 		}
-		if( sign == '-' ) h = -h;
-	} else {
-		uchar *end = NULL;
-		h = utoi(c,&end);
-		if( c == end )
-			return NULL;
+		c = next + 1;
+		i++;
 	}
-	return hl_make_dyn(&h,&hlt_i32);
+	*count = n;
+	*errors = nerr;
+	return (vbyte*)out;
+}
+
+/*
+	Same as hl_parse_f64_column for an i32 array, with 0 for invalid fields.
+*/
+HL_PRIM vbyte *hl_parse_i32_column( vbyte *bytes, int pos, int len, int sep, int *count, int *errors ) {
+	vbyte *c = bytes + pos, *end = c + len;
+	int *out;
+	int n = 1, i = 0, nerr = 0;
+	if( len == 0 ) {
+		*count = 0;
+		*errors = 0;
+		return hl_alloc_bytes(0);
+	}
+	while( (c = memchr(c,sep,end - c)) != NULL ) {
+		c++;
+		n++;
+	}
+	out = (int*)hl_alloc_bytes(n * sizeof(int));
+	c = bytes + pos;
+	while( i < n ) {
+		vbyte *next = i == n - 1 ? end : memchr(c,sep,end - c);
+		if( !parse_int_utf8(c,next,out + i) ) {
+			out[i] = 0;
+			nerr++;
+		}
+		c = next + 1;
+		i++;
+	}
+	*count = n;
+	*errors = nerr;
+	return (vbyte*)out;
 }
 
 // pointer manipulation
@@ -277,11 +721,25 @@ DEFINE_PRIM(_I32,bytes_compare16,_BYTES _BYTES _I32);
 DEFINE_PRIM(_I32,string_compare,_BYTES _BYTES _I32);
 DEFINE_PRIM(_I32,bytes_find,_BYTES _I32 _I32 _BYTES _I32 _I32);
 DEFINE_PRIM(_I32,bytes_rfind,_BYTES _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,bytes_find16,_BYTES _I32 _I32 _BYTES _I32 _I32);
+DEFINE_PRIM(_I32,bytes_rfind16,_BYTES _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,bytes_find_any,_BYTES _I32 _I32 _BYTES _I32);
+DEFINE_PRIM(_I32,bytes_find_any16,_BYTES _I32 _I32 _BYTES _I32);
 DEFINE_PRIM(_VOID,bytes_fill,_BYTES _I32 _I32 _I32);
 DEFINE_PRIM(_F64, parse_float,_BYTES _I32 _I32);
 DEFINE_PRIM(_NULL(_I32), parse_int, _BYTES _I32 _I32);
+DEFINE_PRIM(_F64, try_parse_float, _BYTES _I32 _I32 _REF(_BOOL));
+DEFINE_PRIM(_I32, try_parse_int, _BYTES _I32 _I32 _REF(_BOOL));
+DEFINE_PRIM(_F64, try_parse_float_utf8, _BYTES _I32 _I32 _REF(_BOOL));
+DEFINE_PRIM(_I32, try_parse_int_utf8, _BYTES _I32 _I32 _REF(_BOOL));
+DEFINE_PRIM(_BYTES, parse_f64_column, _BYTES _I32 _I32 _I32 _REF(_I32) _REF(_I32));
+DEFINE_PRIM(_BYTES, parse_i32_column, _BYTES _I32 _I32 _I32 _REF(_I32) _REF(_I32));
 DEFINE_PRIM(_VOID,bsort_i32,_BYTES _I32 _I32 _FUN(_I32,_I32 _I32));
 DEFINE_PRIM(_VOID,bsort_f64,_BYTES _I32 _I32 _FUN(_I32,_F64 _F64));
+DEFINE_PRIM(_VOID,bsort_unstable_i32,_BYTES _I32 _I32 _FUN(_I32,_I32 _I32));
+DEFINE_PRIM(_VOID,bsort_unstable_f64,_BYTES _I32 _I32 _FUN(_I32,_F64 _F64));
+DEFINE_PRIM(_VOID,bsort_native_i32,_BYTES _I32 _I32 _BOOL _I32);
+DEFINE_PRIM(_VOID,bsort_native_f64,_BYTES _I32 _I32 _BOOL _I32);
 DEFINE_PRIM(_BYTES,bytes_offset, _BYTES _I32);
 DEFINE_PRIM(_I32,bytes_subtract, _BYTES _BYTES);
 DEFINE_PRIM(_I32,bytes_address, _BYTES _REF(_I32));
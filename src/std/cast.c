@@ -42,10 +42,7 @@ HL_PRIM vdynamic *hl_make_dyn( void *data, hl_type *t ) {
 		v->v.i = *(unsigned short*)data;
 		return v;
 	case HI32:
-		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
-		v->t = t;
-		v->v.i = *(int*)data;
-		return v;
+		return hl_alloc_dyni32(*(int*)data);
 	case HI64:
 		v = (vdynamic*)hl_gc_alloc_noptr(sizeof(vdynamic));
 		v->t = t;
@@ -522,9 +519,7 @@ static vdynamic *hl_dynf64( double v ) {
 }
 
 static vdynamic *hl_dyni32( int v ) {
-	vdynamic *d = hl_alloc_dynamic(&hlt_i32);
-	d->v.i = v;
-	return d;
+	return hl_alloc_dyni32(v);
 }
 
 static bool is_number( hl_type *t ) {
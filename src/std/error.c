@@ -51,6 +51,7 @@ typedef int (*capture_stack_type)( void **stack, int size );
 
 static resolve_symbol_type resolve_symbol_func = NULL;
 static capture_stack_type capture_stack_func = NULL;
+static int exc_stack_depth = HL_EXC_MAX_STACK;
 
 int hl_internal_capture_stack( void **stack, int size ) {
 	return capture_stack_func(stack,size);
@@ -95,7 +96,7 @@ HL_PRIM void hl_throw( vdynamic *v ) {
 	if( t->flags & HL_EXC_KILL )
 		hl_fatal("Exception Occured");
 	if( !(t->flags & HL_EXC_RETHROW) )
-		t->exc_stack_count = capture_stack_func(t->exc_stack_trace, HL_EXC_MAX_STACK);
+		t->exc_stack_count = exc_stack_depth ? capture_stack_func(t->exc_stack_trace, exc_stack_depth) : 0;
 	t->exc_value = v;
 	t->trap_current = trap->prev;
 	call_handler = trap == t->trap_uncaught || t->trap_current == NULL;
@@ -164,6 +165,12 @@ HL_PRIM int hl_exception_stack_raw( varray *arr ) {
 	return t->exc_stack_count;
 }
 
+HL_PRIM void hl_set_exception_stack_depth( int depth ) {
+	if( depth < 0 ) depth = 0;
+	if( depth > HL_EXC_MAX_STACK ) depth = HL_EXC_MAX_STACK;
+	exc_stack_depth = depth;
+}
+
 HL_PRIM int hl_call_stack_raw( varray *arr ) {
 	if( !arr )
 		return capture_stack_func(NULL,0);
@@ -263,6 +270,7 @@ HL_PRIM HL_NO_OPT void hl_assert() {
 DEFINE_PRIM(_ARR,exception_stack,_NO_ARG);
 DEFINE_PRIM(_I32,exception_stack_raw,_ARR);
 DEFINE_PRIM(_I32,call_stack_raw,_ARR);
+DEFINE_PRIM(_VOID,set_exception_stack_depth,_I32);
 DEFINE_PRIM(_VOID,set_error_handler,_FUN(_VOID,_DYN));
 DEFINE_PRIM(_VOID,breakpoint,_NO_ARG);
 DEFINE_PRIM(_BYTES,resolve_symbol, _SYMBOL _BYTES _REF(_I32));
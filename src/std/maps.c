@@ -24,117 +24,95 @@
 #	pragma warning(disable:4034) // sizeof(void) == 0
 #endif
 
-#define H_SIZE_INIT 3
+#ifdef HL_SSE2
+#	include <emmintrin.h>
+#endif
 
-// successive primes that double every time
-static int H_PRIMES[] = {
-	7,17,37,79,163,331,673,1361,2729,5471,10949,21911,43853,87613,175229,350459,700919,1401857,2803727,5607457,11214943,22429903,44859823,89719661,179424673,373587883,776531401,1611623773
-};
+/*
+	Maps are open addressing tables with a control byte per slot, probed a
+	group at a time. A control byte is either H_EMPTY, H_DELETED or the 7
+	low bits of the slot key hash. The first H_GROUP control bytes are
+	mirrored after the table so a group can be loaded at any position.
+*/
+#define H_GROUP		16
+#define H_EMPTY		0x80
+#define H_DELETED	0xFE
+
+static HL_INLINE int hl_map_clz16( unsigned int x ) {
+	return x ? 15 - hl_msb(x) : 16;
+}
 
-// ----- FREE LIST ---------------------------------
+static HL_INLINE unsigned int hl_map_mix( unsigned int h ) {
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	h ^= h >> 16;
+	return h;
+}
 
-typedef struct {
-	int pos;
-	int count;
-} hl_free_bucket;
+static HL_INLINE int hl_map_max_load( int size ) {
+	return size - (size >> 3);
+}
 
-typedef struct {
-	hl_free_bucket *buckets;
-	int head;
-	int nbuckets;
-} hl_free_list;
-
-static void hl_freelist_resize( hl_free_list *f, int newsize ) {
-	hl_free_bucket *buckets = (hl_free_bucket*)hl_gc_alloc_noptr(sizeof(hl_free_bucket)*newsize);
-	memcpy(buckets,f->buckets,f->head * sizeof(hl_free_bucket));
-	f->buckets = buckets;
-	f->nbuckets = newsize;
+// bit i is set if ctrl[i] == v
+static HL_INLINE unsigned int hl_map_match( const unsigned char *ctrl, unsigned char v ) {
+#	ifdef HL_SSE2
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(g,_mm_set1_epi8((char)v)));
+#	else
+	unsigned int bits = 0;
+	int i;
+	for(i=0;i<H_GROUP;i++)
+		if( ctrl[i] == v ) bits |= 1 << i;
+	return bits;
+#	endif
 }
 
-static void hl_freelist_init( hl_free_list *f ) {
-	memset(f,0,sizeof(hl_free_list));
+// bit i is set if ctrl[i] is empty or deleted
+static HL_INLINE unsigned int hl_map_match_free( const unsigned char *ctrl ) {
+#	ifdef HL_SSE2
+	return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#	else
+	unsigned int bits = 0;
+	int i;
+	for(i=0;i<H_GROUP;i++)
+		if( ctrl[i] & 0x80 ) bits |= 1 << i;
+	return bits;
+#	endif
 }
 
-static void hl_freelist_add_range( hl_free_list *f, int pos, int count ) {
-	hl_free_bucket *b = f->buckets;
-	hl_free_bucket *prev = NULL;
-	if( !b ) {
-		// special handling for countinuous space
-		if( f->nbuckets == 0 ) {
-			f->head = pos;
-			f->nbuckets = count;
-			return;
-		} else if( f->head + f->nbuckets == pos ) {
-			f->nbuckets += count;
-			return;
-		} else if( pos + count == f->head ) {
-			f->head -= count;
-			f->nbuckets += count;
-			return;
-		} else {
-			int cur_pos = f->head, cur_count = f->nbuckets;
-			f->head = 0;
-			f->nbuckets = 0;
-			hl_freelist_resize(f,2);
-			if( cur_count ) hl_freelist_add_range(f,cur_pos,cur_count);
-			b = f->buckets;
-		}
-	}
-	while( b < f->buckets + f->head ) {
-		if( b->pos > pos ) break;
-		prev = b;
-		b++;
-	}
-	if( b < f->buckets + f->head && b->pos == pos + count ) {
-		b->pos -= count;
-		b->count += count;
-		// merge
-		if( prev && prev->pos + prev->count == b->pos ) {
-			prev->count += b->count;
-			memmove(b,b+1,((f->buckets + f->head) - (b+1)) * sizeof(hl_free_bucket));
-			f->head--;
-		}
-		return;
-	}
-	if( prev && prev->pos + prev->count == pos ) {
-		prev->count += count;
-		return;
-	}
-	// insert
-	if( f->head == f->nbuckets ) {
-		int pos = (int)(b - f->buckets);
-		hl_freelist_resize(f,((f->nbuckets * 3) + 1) >> 1);
-		b = f->buckets + pos;
-	}
-	memmove(b+1,b,((f->buckets + f->head) - b) * sizeof(hl_free_bucket));
-	b->pos = pos;
-	b->count = count;
-	f->head++;
+static HL_INLINE unsigned int hl_map_match_full( const unsigned char *ctrl ) {
+	return hl_map_match_free(ctrl) ^ 0xFFFF;
+}
+
+static HL_INLINE void hl_map_set_ctrl( unsigned char *ctrl, int mask, int c, unsigned char v ) {
+	ctrl[c] = v;
+	if( c < H_GROUP ) ctrl[mask + 1 + c] = v;
+}
+
+/*
+	Concurrent maps are split in H_SHARDS maps, selected by the key hash.
+	Locks are first tried without blocking : hl_mutex_acquire marks the
+	thread as blocking so a shard being resized (which can trigger a GC)
+	never prevents the world from being stopped.
+*/
+#define H_SHARD_BITS	6
+#define H_SHARDS		(1 << H_SHARD_BITS)
+#define H_SHARD_SIZE	128
+
+static HL_INLINE int hl_map_shard( unsigned int hash ) {
+	return (int)((hash * 0x9E3779B9) >> (32 - H_SHARD_BITS));
 }
 
-static void hl_freelist_add( hl_free_list *f, int pos ) {
-	hl_freelist_add_range(f,pos,1);
+static HL_INLINE void hl_map_lock( hl_mutex *l ) {
+	if( !hl_mutex_try_acquire(l) ) hl_mutex_acquire(l);
 }
 
-static int hl_freelist_get( hl_free_list *f ) {
-	hl_free_bucket *b;
-	int p;
-	if( !f->buckets ) {
-		if( f->nbuckets == 0 ) return -1;
-		f->nbuckets--;
-		return f->head++;
-	}
-	if( f->head == 0 )
-		return -1;
-	b = f->buckets + f->head - 1;
-	b->count--;
-	p = b->pos + b->count;
-	if( b->count == 0 ) {
-		f->head--;
-		if( f->head < (f->nbuckets>>1) )
-			hl_freelist_resize(f,f->nbuckets>>1);
-	}
-	return p;
+static bool hl_map_was_never_full( unsigned char *ctrl, int mask, int c ) {
+	unsigned int before = hl_map_match(ctrl + ((c - H_GROUP) & mask), H_EMPTY);
+	unsigned int after = hl_map_match(ctrl + c, H_EMPTY);
+	return before && after && hl_ctz(after) + hl_map_clz16(before) < H_GROUP;
 }
 
 #define _MVAL_TYPE vdynamic*
@@ -202,8 +180,10 @@ typedef struct {
 #define _MNAME(n)	hl_hb##n
 #define _MMATCH(c)	m->entries[c].hash == hash && ucmp(m->values[c].key,key) == 0
 #define _MKEY(m,c)	m->values[c].key
+#define _MHASH(m,c)	(m)->entries[c].hash
 #define	_MSET(c)	m->entries[c].hash = hash; m->values[c].key = key
 #define _MERASE(c)  m->values[c].key = NULL
+#define _MINTERN(key)	((uchar*)hl_intern(key,(int)ustrlen(key),NULL))
 
 #include "maps.h"
 
@@ -284,6 +264,22 @@ DEFINE_PRIM( _ARR, hikeys, _IMAP );
 DEFINE_PRIM( _ARR, hivalues, _IMAP );
 DEFINE_PRIM( _VOID, hiclear, _IMAP );
 DEFINE_PRIM( _I32, hisize, _IMAP );
+DEFINE_PRIM( _VOID, hireserve, _IMAP _I32 );
+DEFINE_PRIM( _VOID, hisetmany, _IMAP _ARR _ARR );
+DEFINE_PRIM( _I32, hinext, _IMAP _I32 );
+DEFINE_PRIM( _I32, hikeyat, _IMAP _I32 );
+DEFINE_PRIM( _DYN, hivalueat, _IMAP _I32 );
+
+#define _CIMAP _ABSTRACT(hl_int_cmap)
+DEFINE_PRIM( _CIMAP, hicalloc, _NO_ARG );
+DEFINE_PRIM( _VOID, hicset, _CIMAP _I32 _DYN );
+DEFINE_PRIM( _BOOL, hicexists, _CIMAP _I32 );
+DEFINE_PRIM( _DYN, hicget, _CIMAP _I32 );
+DEFINE_PRIM( _BOOL, hicremove, _CIMAP _I32 );
+DEFINE_PRIM( _ARR, hickeys, _CIMAP );
+DEFINE_PRIM( _ARR, hicvalues, _CIMAP );
+DEFINE_PRIM( _VOID, hicclear, _CIMAP );
+DEFINE_PRIM( _I32, hicsize, _CIMAP );
 
 #define _I64MAP _ABSTRACT(hl_int64_map)
 DEFINE_PRIM( _I64MAP, hi64alloc, _NO_ARG );
@@ -295,6 +291,22 @@ DEFINE_PRIM( _ARR, hi64keys, _I64MAP );
 DEFINE_PRIM( _ARR, hi64values, _I64MAP );
 DEFINE_PRIM( _VOID, hi64clear, _I64MAP );
 DEFINE_PRIM( _I32, hi64size, _I64MAP );
+DEFINE_PRIM( _VOID, hi64reserve, _I64MAP _I32 );
+DEFINE_PRIM( _VOID, hi64setmany, _I64MAP _ARR _ARR );
+DEFINE_PRIM( _I32, hi64next, _I64MAP _I32 );
+DEFINE_PRIM( _I64, hi64keyat, _I64MAP _I32 );
+DEFINE_PRIM( _DYN, hi64valueat, _I64MAP _I32 );
+
+#define _CI64MAP _ABSTRACT(hl_int64_cmap)
+DEFINE_PRIM( _CI64MAP, hi64calloc, _NO_ARG );
+DEFINE_PRIM( _VOID, hi64cset, _CI64MAP _I64 _DYN );
+DEFINE_PRIM( _BOOL, hi64cexists, _CI64MAP _I64 );
+DEFINE_PRIM( _DYN, hi64cget, _CI64MAP _I64 );
+DEFINE_PRIM( _BOOL, hi64cremove, _CI64MAP _I64 );
+DEFINE_PRIM( _ARR, hi64ckeys, _CI64MAP );
+DEFINE_PRIM( _ARR, hi64cvalues, _CI64MAP );
+DEFINE_PRIM( _VOID, hi64cclear, _CI64MAP );
+DEFINE_PRIM( _I32, hi64csize, _CI64MAP );
 
 #define _BMAP _ABSTRACT(hl_bytes_map)
 DEFINE_PRIM( _BMAP, hballoc, _NO_ARG );
@@ -306,6 +318,23 @@ DEFINE_PRIM( _ARR, hbkeys, _BMAP );
 DEFINE_PRIM( _ARR, hbvalues, _BMAP );
 DEFINE_PRIM( _VOID, hbclear, _BMAP );
 DEFINE_PRIM( _I32, hbsize, _BMAP );
+DEFINE_PRIM( _VOID, hbreserve, _BMAP _I32 );
+DEFINE_PRIM( _VOID, hbsetmany, _BMAP _ARR _ARR );
+DEFINE_PRIM( _I32, hbnext, _BMAP _I32 );
+DEFINE_PRIM( _BYTES, hbkeyat, _BMAP _I32 );
+DEFINE_PRIM( _DYN, hbvalueat, _BMAP _I32 );
+DEFINE_PRIM( _VOID, hbintern_keys, _BMAP _BOOL );
+
+#define _CBMAP _ABSTRACT(hl_bytes_cmap)
+DEFINE_PRIM( _CBMAP, hbcalloc, _NO_ARG );
+DEFINE_PRIM( _VOID, hbcset, _CBMAP _BYTES _DYN );
+DEFINE_PRIM( _BOOL, hbcexists, _CBMAP _BYTES );
+DEFINE_PRIM( _DYN, hbcget, _CBMAP _BYTES );
+DEFINE_PRIM( _BOOL, hbcremove, _CBMAP _BYTES );
+DEFINE_PRIM( _ARR, hbckeys, _CBMAP );
+DEFINE_PRIM( _ARR, hbcvalues, _CBMAP );
+DEFINE_PRIM( _VOID, hbcclear, _CBMAP );
+DEFINE_PRIM( _I32, hbcsize, _CBMAP );
 
 #define _OMAP _ABSTRACT(hl_obj_map)
 DEFINE_PRIM( _OMAP, hoalloc, _NO_ARG );
@@ -317,3 +346,19 @@ DEFINE_PRIM( _ARR, hokeys, _OMAP );
 DEFINE_PRIM( _ARR, hovalues, _OMAP );
 DEFINE_PRIM( _VOID, hoclear, _OMAP );
 DEFINE_PRIM( _I32, hosize, _OMAP );
+DEFINE_PRIM( _VOID, horeserve, _OMAP _I32 );
+DEFINE_PRIM( _VOID, hosetmany, _OMAP _ARR _ARR );
+DEFINE_PRIM( _I32, honext, _OMAP _I32 );
+DEFINE_PRIM( _DYN, hokeyat, _OMAP _I32 );
+DEFINE_PRIM( _DYN, hovalueat, _OMAP _I32 );
+
+#define _COMAP _ABSTRACT(hl_obj_cmap)
+DEFINE_PRIM( _COMAP, hocalloc, _NO_ARG );
+DEFINE_PRIM( _VOID, hocset, _COMAP _DYN _DYN );
+DEFINE_PRIM( _BOOL, hocexists, _COMAP _DYN );
+DEFINE_PRIM( _DYN, hocget, _COMAP _DYN );
+DEFINE_PRIM( _BOOL, hocremove, _COMAP _DYN );
+DEFINE_PRIM( _ARR, hockeys, _COMAP );
+DEFINE_PRIM( _ARR, hocvalues, _COMAP );
+DEFINE_PRIM( _VOID, hocclear, _COMAP );
+DEFINE_PRIM( _I32, hocsize, _COMAP );
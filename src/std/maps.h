@@ -3,13 +3,17 @@
 #undef t_entry
 #undef t_value
 #undef t_key
+#undef t_shard
+#undef t_cmap
 #define t_key _MKEY_TYPE
 #define t_map _MNAME(_map)
 #define t_entry _MNAME(_entry)
 #define t_value _MNAME(_value)
-#define _MLIMIT 128
-#define _MINDEX(m,ckey) ((m)->maxentries < _MLIMIT ? (int)((signed char*)(m)->cells)[ckey] : ((int*)(m)->cells)[ckey])
-#define _MNEXT(m,ckey) ((m)->maxentries < _MLIMIT ? (int)((signed char*)(m)->nexts)[ckey] : ((int*)(m)->nexts)[ckey])
+#define t_shard _MNAME(_shard)
+#define t_cmap _MNAME(_cmap)
+#ifndef _MHASH
+#define _MHASH(m,c) _MNAME(hash)(_MKEY(m,c))
+#endif
 #ifdef _MNO_EXPORTS
 #define _MSTATIC
 #else
@@ -17,14 +21,15 @@
 #endif
 
 typedef struct {
-	void *cells;
-	void *nexts;
+	unsigned char *ctrl;
 	t_entry *entries;
 	t_value *values;
-	hl_free_list lfree;
-	int ncells;
+	int mask;
 	int nentries;
-	int maxentries;
+	int growth;
+#	ifdef _MINTERN
+	bool intern_keys;
+#	endif
 } t_map;
 
 #ifndef _MNO_EXPORTS
@@ -36,99 +41,100 @@ t_map *_MNAME(alloc)() {
 	return m;
 }
 
-_MSTATIC _MVAL_TYPE *_MNAME(find)( t_map *m, t_key key ) {
-	int c, ckey;
-	unsigned int hash;
+static int _MNAME(lookup)( t_map *m, t_key key, unsigned int hash ) {
+	unsigned int h = hl_map_mix(hash);
+	int pos = (int)(h >> 7) & m->mask;
+	int step = 0;
+	while( true ) {
+		unsigned int bits = hl_map_match(m->ctrl + pos, (unsigned char)(h & 0x7F));
+		while( bits ) {
+			int c = (pos + hl_ctz(bits)) & m->mask;
+			if( _MMATCH(c) )
+				return c;
+			bits &= bits - 1;
+		}
+		if( hl_map_match(m->ctrl + pos, H_EMPTY) )
+			return -1;
+		step += H_GROUP;
+		pos = (pos + step) & m->mask;
+	}
+}
 
-	if( !m->values ) return NULL;
-	hash = _MNAME(hash)(key);
-	ckey = hash % ((unsigned)m->ncells);
-	c = _MINDEX(m,ckey);
-	while( c >= 0 ) {
-		if( _MMATCH(c) )
-			return &m->values[c].value;
-		c = _MNEXT(m,c);
+static int _MNAME(free_slot)( t_map *m, unsigned int h ) {
+	int pos = (int)(h >> 7) & m->mask;
+	int step = 0;
+	while( true ) {
+		unsigned int bits = hl_map_match_free(m->ctrl + pos);
+		if( bits )
+			return (pos + hl_ctz(bits)) & m->mask;
+		step += H_GROUP;
+		pos = (pos + step) & m->mask;
 	}
-	return NULL;
 }
 
-static void _MNAME(resize)( t_map *m );
+_MSTATIC _MVAL_TYPE *_MNAME(find)( t_map *m, t_key key ) {
+	int c;
+	if( !m->ctrl ) return NULL;
+	c = _MNAME(lookup)(m,key,_MNAME(hash)(key));
+	return c < 0 ? NULL : &m->values[c].value;
+}
+
+static void _MNAME(rehash)( t_map *m, int nsize );
 
 _MSTATIC void _MNAME(set_impl)( t_map *m, t_key key, _MVAL_TYPE value ) {
-	int c, ckey = 0;
+	int c;
 	unsigned int hash = _MNAME(hash)(key);
-	if( m->values ) {
-		ckey = hash % ((unsigned)m->ncells);
-		c = _MINDEX(m,ckey);
-		while( c >= 0 ) {
-			if( _MMATCH(c) ) {
-				m->values[c].value = value;
-				return;
-			}
-			c = _MNEXT(m,c);
+	unsigned int h = hl_map_mix(hash);
+	if( m->ctrl ) {
+		c = _MNAME(lookup)(m,key,hash);
+		if( c >= 0 ) {
+			m->values[c].value = value;
+			return;
 		}
+		c = _MNAME(free_slot)(m,h);
 	}
-	c = hl_freelist_get(&m->lfree);
-	if( c < 0 ) {
-		_MNAME(resize)(m);
-		ckey = hash % ((unsigned)m->ncells);
-		c = hl_freelist_get(&m->lfree);
+	if( !m->ctrl || (m->growth == 0 && m->ctrl[c] == H_EMPTY) ) {
+		int size = m->ctrl ? m->mask + 1 : 0;
+		// only grow if deleted slots are not enough to make room
+		_MNAME(rehash)(m, size == 0 ? H_GROUP : m->nentries >= hl_map_max_load(size) >> 1 ? size << 1 : size);
+		c = _MNAME(free_slot)(m,h);
 	}
+	if( m->ctrl[c] == H_EMPTY ) m->growth--;
+#	ifdef _MINTERN
+	if( m->intern_keys ) key = _MINTERN(key);
+#	endif
+	hl_map_set_ctrl(m->ctrl,m->mask,c,(unsigned char)(h & 0x7F));
 	_MSET(c);
-	if( m->maxentries < _MLIMIT ) {
-		((signed char*)m->nexts)[c] = ((signed char*)m->cells)[ckey];
-		((signed char*)m->cells)[ckey] = (signed char)c;
-	} else {
-		((int*)m->nexts)[c] = ((int*)m->cells)[ckey];
-		((int*)m->cells)[ckey] = c;
-	}
 	m->values[c].value = value;
 	m->nentries++;
 }
 
-static void _MNAME(resize)( t_map *m ) {
+static void _MNAME(rehash)( t_map *m, int nsize ) {
 	// save
 	t_map old = *m;
+	int i, size = old.ctrl ? old.mask + 1 : 0;
 
-	if( m->nentries != m->maxentries ) hl_error("assert");
-
-	// resize
-	int i = 0;
-	int nentries = m->maxentries ? ((m->maxentries * 3) + 1) >> 1 : H_SIZE_INIT;
-	int ncells = nentries >> 2;
-
-	while( H_PRIMES[i] < ncells ) i++;
-	ncells = H_PRIMES[i];
-
-	int ksize = nentries < _MLIMIT ? 1 : sizeof(int);
-	m->entries = (t_entry*)hl_gc_alloc_noptr(nentries * sizeof(t_entry));
-	m->values = (t_value*)hl_gc_alloc_raw(nentries * sizeof(t_value));
-	m->maxentries = nentries;
-
-	if( old.ncells == ncells && (nentries < _MLIMIT || old.maxentries >= _MLIMIT) ) {
-		// simply expand
-		m->nexts = hl_gc_alloc_noptr(nentries * ksize);
-		memcpy(m->entries,old.entries,old.maxentries * sizeof(t_entry));
-		memcpy(m->values,old.values,old.maxentries * sizeof(t_value));
-		memcpy(m->nexts,old.nexts,old.maxentries * ksize);
-		memset(m->values + old.maxentries, 0, (nentries - old.maxentries) * sizeof(t_value));
-		hl_freelist_add_range(&m->lfree,old.maxentries,m->maxentries - old.maxentries);
-	} else {
-		// expand and remap
-		m->cells = hl_gc_alloc_noptr((ncells + nentries) * ksize);
-		m->nexts = (signed char*)m->cells + ncells * ksize;
-		m->ncells = ncells;
-		m->nentries = 0;
-		memset(m->cells,0xFF,ncells * ksize);
-		memset(m->values, 0, nentries * sizeof(t_value));
-		hl_freelist_init(&m->lfree);
-		hl_freelist_add_range(&m->lfree,0,m->maxentries);
-		for(i=0;i<old.ncells;i++) {
-			int c = old.maxentries < _MLIMIT ? ((signed char*)old.cells)[i] : ((int*)old.cells)[i];
-			while( c >= 0 ) {
-				_MNAME(set_impl)(m,_MKEY((&old),c),old.values[c].value);
-				c = _MNEXT(&old,c);
-			}
+	m->ctrl = (unsigned char*)hl_gc_alloc_noptr(nsize + H_GROUP);
+	m->entries = (t_entry*)hl_gc_alloc_noptr(nsize * sizeof(t_entry));
+	m->values = (t_value*)hl_gc_alloc_raw(nsize * sizeof(t_value));
+	memset(m->ctrl,H_EMPTY,nsize + H_GROUP);
+	memset(m->values,0,nsize * sizeof(t_value));
+	m->mask = nsize - 1;
+	m->growth = hl_map_max_load(nsize) - old.nentries;
+
+	// remap, without looking for existing keys
+	for(i=0;i<size;i+=H_GROUP) {
+		unsigned int bits = hl_map_match_full(old.ctrl + i);
+		while( bits ) {
+			int oc = i + hl_ctz(bits);
+			t_key key = _MKEY((&old),oc);
+			unsigned int hash = _MHASH((&old),oc);
+			unsigned int h = hl_map_mix(hash);
+			int c = _MNAME(free_slot)(m,h);
+			hl_map_set_ctrl(m->ctrl,m->mask,c,(unsigned char)(h & 0x7F));
+			_MSET(c);
+			m->values[c].value = old.values[oc].value;
+			bits &= bits - 1;
 		}
 	}
 }
@@ -149,49 +155,84 @@ HL_PRIM vdynamic* _MNAME(get)( t_map *m, t_key key ) {
 	return *v;
 }
 
-HL_PRIM bool _MNAME(remove)( t_map *m, t_key key ) {
-	int c, prev = -1, ckey;
+_MSTATIC bool _MNAME(remove_impl)( t_map *m, t_key key ) {
+	int c;
 	unsigned int hash;
-	if( !m->cells ) return false;
-	key = _MNAME(filter)(key);
+	if( !m->ctrl ) return false;
 	hash = _MNAME(hash)(key);
-	ckey = hash % ((unsigned)m->ncells);
-	c = _MINDEX(m,ckey);
-	while( c >= 0 ) {
-		if( _MMATCH(c) ) {
-			hl_freelist_add(&m->lfree,c);
-			m->nentries--;
-			_MERASE(c);
-			m->values[c].value = NULL;
-			if( m->maxentries < _MLIMIT ) {
-				if( prev >= 0 )
-					((signed char*)m->nexts)[prev] = ((signed char*)m->nexts)[c];
-				else
-					((signed char*)m->cells)[ckey] = ((signed char*)m->nexts)[c];
-			} else {
-				if( prev >= 0 )
-					((int*)m->nexts)[prev] = ((int*)m->nexts)[c];
-				else
-					((int*)m->cells)[ckey] = ((int*)m->nexts)[c];
-			}
-			return true;
-		}
-		prev = c;
-		c = _MNEXT(m,c);
+	c = _MNAME(lookup)(m,key,hash);
+	if( c < 0 )
+		return false;
+	m->nentries--;
+	_MERASE(c);
+	m->values[c].value = NULL;
+	// if no group around the slot was ever full, no probe went past it and it can be reused as empty
+	if( hl_map_was_never_full(m->ctrl,m->mask,c) ) {
+		hl_map_set_ctrl(m->ctrl,m->mask,c,H_EMPTY);
+		m->growth++;
+	} else
+		hl_map_set_ctrl(m->ctrl,m->mask,c,H_DELETED);
+	return true;
+}
+
+HL_PRIM bool _MNAME(remove)( t_map *m, t_key key ) {
+	return _MNAME(remove_impl)(m,_MNAME(filter)(key));
+}
+
+HL_PRIM void _MNAME(reserve)( t_map *m, int count ) {
+	int nsize = H_GROUP;
+	if( count - m->nentries <= m->growth )
+		return;
+	while( hl_map_max_load(nsize) < count && nsize < (1 << 30) )
+		nsize <<= 1;
+	_MNAME(rehash)(m,nsize);
+}
+
+HL_PRIM void _MNAME(setmany)( t_map *m, varray *keys, varray *values ) {
+	int i, count = keys->size;
+	if( values->size != count ) hl_error("Keys and values arrays must have the same length");
+	_MNAME(reserve)(m,m->nentries + count);
+	for(i=0;i<count;i++)
+		_MNAME(set_impl)(m,_MNAME(filter)(hl_aptr(keys,t_key)[i]),hl_aptr(values,vdynamic*)[i]);
+}
+
+/*
+	Iterates the slots in place : next returns the first used slot at or
+	after pos, or -1 at the end. Slots are only valid until the map is
+	modified, keyat and valueat return a default value for invalid ones.
+*/
+HL_PRIM int _MNAME(next)( t_map *m, int pos ) {
+	int size = m->ctrl ? m->mask + 1 : 0;
+	if( pos < 0 ) pos = 0;
+	while( pos < size ) {
+		unsigned int bits = hl_map_match_full(m->ctrl + pos);
+		if( size - pos < H_GROUP ) bits &= (1 << (size - pos)) - 1;
+		if( bits ) return pos + hl_ctz(bits);
+		pos += H_GROUP;
 	}
-	return false;
+	return -1;
+}
+
+HL_PRIM t_key _MNAME(keyat)( t_map *m, int c ) {
+	if( !m->ctrl || c < 0 || c > m->mask || (m->ctrl[c] & 0x80) ) return (t_key)0;
+	return _MKEY(m,c);
+}
+
+HL_PRIM vdynamic *_MNAME(valueat)( t_map *m, int c ) {
+	if( !m->ctrl || c < 0 || c > m->mask || (m->ctrl[c] & 0x80) ) return NULL;
+	return m->values[c].value;
 }
 
 HL_PRIM varray* _MNAME(keys)( t_map *m ) {
 	varray *a = hl_alloc_array(&hlt_key,m->nentries);
 	t_key *keys = hl_aptr(a,t_key);
 	int p = 0;
-	int i;
-	for(i=0;i<m->ncells;i++) {
-		int c = _MINDEX(m,i);
-		while( c >= 0 ) {
-			keys[p++] = _MKEY(m,c);
-			c = _MNEXT(m,c);
+	int i, size = m->ctrl ? m->mask + 1 : 0;
+	for(i=0;i<size;i+=H_GROUP) {
+		unsigned int bits = hl_map_match_full(m->ctrl + i);
+		while( bits ) {
+			keys[p++] = _MKEY(m,i + hl_ctz(bits));
+			bits &= bits - 1;
 		}
 	}
 	return a;
@@ -201,25 +242,173 @@ HL_PRIM varray* _MNAME(values)( t_map *m ) {
 	varray *a = hl_alloc_array(&hlt_dyn,m->nentries);
 	vdynamic **values = hl_aptr(a,vdynamic*);
 	int p = 0;
-	int i;
-	for(i=0;i<m->ncells;i++) {
-		int c = _MINDEX(m,i);
-		while( c >= 0 ) {
-			values[p++] = m->values[c].value;
-			c = _MNEXT(m,c);
+	int i, size = m->ctrl ? m->mask + 1 : 0;
+	for(i=0;i<size;i+=H_GROUP) {
+		unsigned int bits = hl_map_match_full(m->ctrl + i);
+		while( bits ) {
+			values[p++] = m->values[i + hl_ctz(bits)].value;
+			bits &= bits - 1;
 		}
 	}
 	return a;
 }
 
 HL_PRIM void _MNAME(clear)( t_map *m ) {
+#	ifdef _MINTERN
+	bool intern_keys = m->intern_keys;
 	memset(m,0,sizeof(t_map));
+	m->intern_keys = intern_keys;
+#	else
+	memset(m,0,sizeof(t_map));
+#	endif
 }
 
+#ifdef _MINTERN
+// keys added from now on are replaced by their interned copy
+HL_PRIM void _MNAME(intern_keys)( t_map *m, bool b ) {
+	m->intern_keys = b;
+}
+#endif
+
 HL_PRIM int _MNAME(size)( t_map *m ) {
 	return m->nentries;
 }
 
+// ----- concurrent version : H_SHARDS maps, each with its own lock
+
+typedef union {
+	struct {
+		hl_mutex *lock;
+		t_map map;
+	} s;
+	char pad[H_SHARD_SIZE]; // keep shards on separate cache lines
+} t_shard;
+
+typedef struct {
+	t_shard shards[H_SHARDS];
+} t_cmap;
+
+HL_PRIM t_cmap *_MNAME(calloc)() {
+	int i;
+	t_cmap *c = (t_cmap*)hl_gc_alloc_raw(sizeof(t_cmap));
+	memset(c,0,sizeof(t_cmap));
+	for(i=0;i<H_SHARDS;i++)
+		c->shards[i].s.lock = hl_mutex_alloc(true);
+	return c;
+}
+
+static t_shard *_MNAME(clock)( t_cmap *c, t_key key ) {
+	t_shard *s = c->shards + hl_map_shard(_MNAME(hash)(key));
+	hl_map_lock(s->s.lock);
+	return s;
+}
+
+HL_PRIM void _MNAME(cset)( t_cmap *c, t_key key, _MVAL_TYPE value ) {
+	t_shard *s;
+	key = _MNAME(filter)(key);
+	s = _MNAME(clock)(c,key);
+	_MNAME(set_impl)(&s->s.map,key,value);
+	hl_mutex_release(s->s.lock);
+}
+
+HL_PRIM vdynamic* _MNAME(cget)( t_cmap *c, t_key key ) {
+	t_shard *s;
+	vdynamic **v, *r;
+	key = _MNAME(filter)(key);
+	s = _MNAME(clock)(c,key);
+	v = _MNAME(find)(&s->s.map,key);
+	r = v ? *v : NULL;
+	hl_mutex_release(s->s.lock);
+	return r;
+}
+
+HL_PRIM bool _MNAME(cexists)( t_cmap *c, t_key key ) {
+	t_shard *s;
+	bool r;
+	key = _MNAME(filter)(key);
+	s = _MNAME(clock)(c,key);
+	r = _MNAME(find)(&s->s.map,key) != NULL;
+	hl_mutex_release(s->s.lock);
+	return r;
+}
+
+HL_PRIM bool _MNAME(cremove)( t_cmap *c, t_key key ) {
+	t_shard *s;
+	bool r;
+	key = _MNAME(filter)(key);
+	s = _MNAME(clock)(c,key);
+	r = _MNAME(remove_impl)(&s->s.map,key);
+	hl_mutex_release(s->s.lock);
+	return r;
+}
+
+HL_PRIM int _MNAME(csize)( t_cmap *c ) {
+	int i, n = 0;
+	for(i=0;i<H_SHARDS;i++) {
+		hl_map_lock(c->shards[i].s.lock);
+		n += c->shards[i].s.map.nentries;
+		hl_mutex_release(c->shards[i].s.lock);
+	}
+	return n;
+}
+
+/*
+	Shards are always locked in the same order, so a snapshot can't deadlock.
+	The array is allocated before taking the locks, since the allocation can
+	trigger a GC : if the size changed in between, we allocate again.
+*/
+static varray *_MNAME(csnapshot)( t_cmap *c, bool keys ) {
+	varray *a;
+	int i, p = 0, n = _MNAME(csize)(c);
+	while( true ) {
+		int count = 0;
+		a = hl_alloc_array(keys ? &hlt_key : &hlt_dyn,n);
+		for(i=0;i<H_SHARDS;i++) {
+			hl_map_lock(c->shards[i].s.lock);
+			count += c->shards[i].s.map.nentries;
+		}
+		if( count == n ) break;
+		for(i=H_SHARDS-1;i>=0;i--)
+			hl_mutex_release(c->shards[i].s.lock);
+		n = count;
+	}
+	for(i=0;i<H_SHARDS;i++) {
+		t_map *m = &c->shards[i].s.map;
+		int k, size = m->ctrl ? m->mask + 1 : 0;
+		for(k=0;k<size;k+=H_GROUP) {
+			unsigned int bits = hl_map_match_full(m->ctrl + k);
+			while( bits ) {
+				int s = k + hl_ctz(bits);
+				if( keys )
+					hl_aptr(a,t_key)[p++] = _MKEY(m,s);
+				else
+					hl_aptr(a,vdynamic*)[p++] = m->values[s].value;
+				bits &= bits - 1;
+			}
+		}
+	}
+	for(i=H_SHARDS-1;i>=0;i--)
+		hl_mutex_release(c->shards[i].s.lock);
+	return a;
+}
+
+HL_PRIM varray* _MNAME(ckeys)( t_cmap *c ) {
+	return _MNAME(csnapshot)(c,true);
+}
+
+HL_PRIM varray* _MNAME(cvalues)( t_cmap *c ) {
+	return _MNAME(csnapshot)(c,false);
+}
+
+HL_PRIM void _MNAME(cclear)( t_cmap *c ) {
+	int i;
+	for(i=0;i<H_SHARDS;i++) {
+		hl_map_lock(c->shards[i].s.lock);
+		memset(&c->shards[i].s.map,0,sizeof(t_map));
+		hl_mutex_release(c->shards[i].s.lock);
+	}
+}
+
 
 #endif
 
@@ -228,9 +417,8 @@ HL_PRIM int _MNAME(size)( t_map *m ) {
 #undef _MNAME
 #undef _MMATCH
 #undef _MKEY
+#undef _MHASH
 #undef _MSET
 #undef _MERASE
-#undef _MOLD_KEY
-#undef _MINDEX
-#undef _MNEXT
+#undef _MINTERN
 #undef _MSTATIC
@@ -0,0 +1,126 @@
+#define parse_float TID(parse_float)
+#define parse_int TID(parse_int)
+
+/*
+	Parses a decimal float in [c,end) after optional spaces, with the syntax
+	accepted by strtod without hex, inf or nan. Returns false if no digit
+	was found.
+*/
+static bool parse_float( const TCHAR *c, const TCHAR *end, double *out ) {
+	const TCHAR *start;
+	uint64 w = 0, bits;
+	int q = 0, ndigits = 0, nsig = 0;
+	bool neg = false, truncated = false;
+	while( c < end && is_space_char(*c) ) c++;
+	start = c;
+	if( c < end && (*c == '-' || *c == '+') ) {
+		neg = *c == '-';
+		c++;
+	}
+	while( c < end && *c >= '0' && *c <= '9' ) {
+		if( nsig < 19 ) {
+			w = w * 10 + (*c - '0');
+			if( w ) nsig++;
+		} else {
+			if( *c != '0' ) truncated = true;
+			q++;
+		}
+		ndigits++;
+		c++;
+	}
+	if( c < end && *c == '.' ) {
+		c++;
+		while( c < end && *c >= '0' && *c <= '9' ) {
+			if( nsig < 19 ) {
+				w = w * 10 + (*c - '0');
+				if( w ) nsig++;
+				q--;
+			} else if( *c != '0' )
+				truncated = true;
+			ndigits++;
+			c++;
+		}
+	}
+	if( ndigits == 0 )
+		return false;
+	if( c < end && (*c == 'e' || *c == 'E') ) {
+		const TCHAR *e = c + 1;
+		bool eneg = false;
+		int exp = 0;
+		if( e < end && (*e == '-' || *e == '+') ) {
+			eneg = *e == '-';
+			e++;
+		}
+		if( e < end && *e >= '0' && *e <= '9' ) {
+			while( e < end && *e >= '0' && *e <= '9' ) {
+				if( exp < 100000 ) exp = exp * 10 + (*e - '0');
+				e++;
+			}
+			q += eneg ? -exp : exp;
+			c = e;
+		}
+	}
+	if( !truncated && w <= (1ULL << 53) && q >= -22 && q <= 22 && FAST_EXACT_FLOAT ) {
+		double d = (double)w;
+		d = q < 0 ? d / POW10_EXACT[-q] : d * POW10_EXACT[q];
+		*out = neg ? -d : d;
+		return true;
+	}
+	if( !decimal_to_bits(w, q, truncated, &bits) ) {
+		// more than 19 significant digits right on a rounding boundary
+		char tmp[64];
+		char *buf = tmp;
+		int n = (int)(c - start), i;
+		if( n >= 64 ) buf = (char*)malloc(n + 1);
+		for(i=0;i<n;i++)
+			buf[i] = (char)start[i];
+		buf[n] = 0;
+		*out = strtod(buf,NULL);
+		if( buf != tmp ) free(buf);
+		return true;
+	}
+	if( neg ) bits |= 1ULL << 63;
+	memcpy(out,&bits,sizeof(double));
+	return true;
+}
+
+/*
+	Parses a decimal or 0x prefixed hexadecimal int in [c,end) after optional
+	spaces. Overflowing values wrap around. Returns false if no digit was found.
+*/
+static bool parse_int( const TCHAR *c, const TCHAR *end, int *out ) {
+	unsigned int h = 0;
+	bool neg = false;
+	while( c < end && is_space_char(*c) ) c++;
+	if( c < end && (*c == '-' || *c == '+') ) {
+		neg = *c == '-';
+		c++;
+	}
+	if( end - c >= 2 && c[0] == '0' && (c[1] == 'x' || c[1] == 'X') ) {
+		c += 2;
+		while( c < end ) {
+			unsigned int k = *c++;
+			if( k >= '0' && k <= '9' )
+				h = (h << 4) | (k - '0');
+			else if( k >= 'A' && k <= 'F' )
+				h = (h << 4) | ((k - 'A') + 10);
+			else if( k >= 'a' && k <= 'f' )
+				h = (h << 4) | ((k - 'a') + 10);
+			else
+				break;
+		}
+	} else {
+		const TCHAR *start = c;
+		while( c < end && *c >= '0' && *c <= '9' )
+			h = h * 10 + (*c++ - '0');
+		if( c == start )
+			return false;
+	}
+	*out = (int)(neg ? 0u - h : h);
+	return true;
+}
+
+#undef parse_float
+#undef parse_int
+#undef TCHAR
+#undef TID
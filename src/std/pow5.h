@@ -0,0 +1,34 @@
+/*
+	Powers of 5 which fit in 64 bits and a 64x64 to 128 bits multiply, shared
+	by the double formatting of string.c and the parsing of bytes.c.
+*/
+
+#define POW5_TABLE_SIZE		26
+
+static const uint64 POW5_TABLE[POW5_TABLE_SIZE] = {
+	1ULL, 5ULL, 25ULL, 125ULL,
+	625ULL, 3125ULL, 15625ULL, 78125ULL,
+	390625ULL, 1953125ULL, 9765625ULL, 48828125ULL,
+	244140625ULL, 1220703125ULL, 6103515625ULL, 30517578125ULL,
+	152587890625ULL, 762939453125ULL, 3814697265625ULL, 19073486328125ULL,
+	95367431640625ULL, 476837158203125ULL, 2384185791015625ULL, 11920928955078125ULL,
+	59604644775390625ULL, 298023223876953125ULL
+};
+
+static inline uint64 umul128( uint64 a, uint64 b, uint64 *hi ) {
+#	if defined(__SIZEOF_INT128__)
+	unsigned __int128 r = (unsigned __int128)a * b;
+	*hi = (uint64)(r >> 64);
+	return (uint64)r;
+#	elif defined(HL_VCC) && defined(_M_X64)
+	return _umul128(a, b, hi);
+#	else
+	uint64 aLo = (unsigned int)a, aHi = a >> 32;
+	uint64 bLo = (unsigned int)b, bHi = b >> 32;
+	uint64 b00 = aLo * bLo, b01 = aLo * bHi, b10 = aHi * bLo, b11 = aHi * bHi;
+	uint64 mid1 = b10 + (b00 >> 32);
+	uint64 mid2 = b01 + (unsigned int)mid1;
+	*hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+	return (mid2 << 32) | (unsigned int)b00;
+#	endif
+}
@@ -38,6 +38,8 @@ struct _ereg {
 	bool matched;
 };
 
+#define MATCH_ALL_BUFFER	256
+
 static void regexp_finalize( ereg *e ) {
 	pcre2_code_free(e->regex);
 	pcre2_match_data_free(e->match_data);
@@ -114,8 +116,8 @@ HL_PRIM int hl_regexp_matched_num( ereg *e ) {
 		return e->n_groups;
 }
 
-HL_PRIM bool hl_regexp_match( ereg *e, vbyte *s, int pos, int len ) {
-	int res = pcre2_match(e->regex,(PCRE2_SPTR)s,pos+len,pos,PCRE2_NO_UTF_CHECK,e->match_data,NULL);
+static bool regexp_exec( ereg *e, vbyte *s, int pos, int end, int flags ) {
+	int res = pcre2_match(e->regex,(PCRE2_SPTR)s,end,pos,flags | PCRE2_NO_UTF_CHECK,e->match_data,NULL);
 	e->matched = res >= 0;
 	if( res >= 0 )
 		return true;
@@ -124,8 +126,70 @@ HL_PRIM bool hl_regexp_match( ereg *e, vbyte *s, int pos, int len ) {
 	return false;
 }
 
+HL_PRIM bool hl_regexp_match( ereg *e, vbyte *s, int pos, int len ) {
+	return regexp_exec(e,s,pos,pos+len,0);
+}
+
+/*
+	Finds up to max (all if <= 0) non-overlapping matches in s[pos,pos+len), in a
+	single call so split and replace do not go back to Haxe for each match.
+	Returns (pos,len) pairs for each match, followed by the pairs of its capture
+	groups if groups is set, with -1,-1 for unset groups. After an empty match,
+	a non empty match is tried at the same position before moving on.
+*/
+HL_PRIM varray *hl_regexp_match_all( ereg *e, vbyte *s, int pos, int len, int max, bool groups ) {
+	int tmp[MATCH_ALL_BUFFER];
+	int *out = tmp;
+	int size = MATCH_ALL_BUFFER, count = 0, nmatches = 0, flags = 0, i;
+	int end = pos + len;
+	int stride = groups ? e->n_groups * 2 : 2;
+	uchar *str = (uchar*)s;
+	varray *a;
+	while( pos <= end && (max <= 0 || nmatches < max) ) {
+		size_t *m;
+		if( !regexp_exec(e,s,pos,end,flags) ) {
+			if( !flags ) break;
+			// no non empty match at pos : skip one char, including surrogate pairs
+			flags = 0;
+			pos++;
+			if( pos < end && str[pos-1] >= 0xD800 && str[pos-1] < 0xDC00 && str[pos] >= 0xDC00 && str[pos] < 0xE000 )
+				pos++;
+			continue;
+		}
+		if( count + stride > size ) {
+			int nsize = size << 1;
+			int *nout;
+			while( count + stride > nsize ) nsize <<= 1;
+			// GC memory : nothing to release if a later match raises an error
+			nout = (int*)hl_gc_alloc_noptr(nsize * sizeof(int));
+			memcpy(nout,out,count * sizeof(int));
+			out = nout;
+			size = nsize;
+		}
+		m = pcre2_get_ovector_pointer(e->match_data);
+		for(i=0;i<stride;i+=2) {
+			if( m[i] == PCRE2_UNSET ) {
+				out[count++] = -1;
+				out[count++] = -1;
+			} else {
+				out[count++] = (int)m[i];
+				out[count++] = (int)(m[i+1] - m[i]);
+			}
+		}
+		nmatches++;
+		flags = m[0] == m[1] ? PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED : 0;
+		pos = (int)m[1];
+	}
+	// the match data has been reused, matched_pos() would not refer to the first match
+	e->matched = false;
+	a = hl_alloc_array(&hlt_i32,count);
+	memcpy(hl_aptr(a,int),out,count * sizeof(int));
+	return a;
+}
+
 #define _EREG _ABSTRACT(ereg)
 DEFINE_PRIM( _EREG, regexp_new_options, _BYTES _BYTES);
 DEFINE_PRIM( _I32, regexp_matched_pos, _EREG _I32 _REF(_I32));
 DEFINE_PRIM( _I32, regexp_matched_num, _EREG );
 DEFINE_PRIM( _BOOL, regexp_match, _EREG _BYTES _I32 _I32);
+DEFINE_PRIM( _ARR, regexp_match_all, _EREG _BYTES _I32 _I32 _I32 _BOOL);
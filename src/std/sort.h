@@ -1,19 +1,43 @@
 #define m_sort TID(m_sort)
 #define ms_compare TID(ms_compare)
 #define ms_swap TID(ms_swap)
-#define ms_lower TID(ms_lower)
-#define ms_upper TID(ms_upper)
-#define ms_rotate TID(ms_rotate)
-#define ms_do_merge TID(ms_do_merge)
+#define ms_insert_sort TID(ms_insert_sort)
 #define merge_sort_rec TID(merge_sort_rec)
+#define pdq_sort3 TID(pdq_sort3)
+#define pdq_partial_insert TID(pdq_partial_insert)
+#define pdq_partition_right TID(pdq_partition_right)
+#define pdq_partition_left TID(pdq_partition_left)
+#define pdq_heap_sort TID(pdq_heap_sort)
+#define pdq_loop TID(pdq_loop)
+#define pdq_sort TID(pdq_sort)
+#define radix_sort TID(radix_sort)
+#define radix_merge TID(radix_merge)
+#define sort_task TID(sort_task)
+#define sort_task_radix TID(sort_task_radix)
+#define sort_task_merge TID(sort_task_merge)
+#define native_sort TID(native_sort)
+
+/*
+	Sorts with a Haxe comparator are either a stable merge sort, merging
+	through a buffer of half the size, or an unstable pattern-defeating
+	quicksort (Orson Peters' pdqsort). Bounds are checked while partitioning
+	so an inconsistent comparator can only give an unsorted result.
+
+	Native sorts never call a comparator : they are LSD radix sorts on TKEY
+	values built by TKEY_OF, which preserve the order of the sorted values.
+	They can run on several threads, each sorting a slice before the slices
+	are merged two by two. The threads are started once per sort and run
+	every pass.
+*/
 
 typedef struct {
 	TSORT *arr;
+	TSORT *tmp;
 	vclosure *c;
 } m_sort;
 
-static int ms_compare( m_sort *m, int a, int b ) {
-	return m->c->hasValue ? ((int(*)(void*,TSORT,TSORT))m->c->fun)(m->c->value,m->arr[a],m->arr[b]) : ((int(*)(TSORT,TSORT))m->c->fun)(m->arr[a],m->arr[b]);
+static int ms_compare( m_sort *m, TSORT a, TSORT b ) {
+	return m->c->hasValue ? ((int(*)(void*,TSORT,TSORT))m->c->fun)(m->c->value,a,b) : ((int(*)(TSORT,TSORT))m->c->fun)(a,b);
 }
 
 static void ms_swap( m_sort *m, int a, int b ) {
@@ -22,109 +46,372 @@ static void ms_swap( m_sort *m, int a, int b ) {
 	m->arr[b] = tmp;
 }
 
-static int ms_lower( m_sort *m, int from, int to, int val ) {
-  	int len = to - from, half, mid;
-  	while( len > 0 ) {
-  		half = len>>1;
-		mid = from + half;
-		if( ms_compare(m, mid, val) < 0 ) {
-    		from = mid+1;
-    		len = len - half -1;
-   		} else
-   			len = half;
-  	}
-	return from;
-}
-
-static int ms_upper( m_sort *m, int from, int to, int val ) {
-	int len = to - from, half, mid;
-	while( len > 0 ) {
-		half = len>>1;
-		mid = from + half;
-		if( ms_compare(m, val, mid) < 0 )
-			len = half;
-		else {
-			from = mid+1;
-			len = len - half -1;
+static void ms_insert_sort( m_sort *m, int from, int to ) {
+	TSORT *arr = m->arr;
+	int i;
+	for(i=from+1;i<to;i++) {
+		TSORT v = arr[i];
+		int j = i;
+		while( j > from && ms_compare(m,v,arr[j-1]) < 0 ) {
+			arr[j] = arr[j-1];
+			j--;
 		}
+		arr[j] = v;
+	}
+}
+
+// m->tmp must hold at least (to - from) / 2 values
+static void merge_sort_rec( m_sort *m, int from, int to ) {
+	TSORT *arr = m->arr, *tmp = m->tmp;
+	int middle, i, j, k, n;
+	if( to - from <= MS_INSERT ) {
+		ms_insert_sort(m,from,to);
+		return;
+	}
+	middle = (from + to) >> 1;
+	merge_sort_rec(m, from, middle);
+	merge_sort_rec(m, middle, to);
+	if( ms_compare(m,arr[middle-1],arr[middle]) <= 0 )
+		return;
+	n = middle - from;
+	memcpy(tmp,arr + from,n * sizeof(TSORT));
+	i = 0;
+	j = middle;
+	k = from;
+	while( i < n && j < to ) {
+		if( ms_compare(m,arr[j],tmp[i]) < 0 )
+			arr[k++] = arr[j++];
+		else
+			arr[k++] = tmp[i++];
 	}
-	return from;
-}
-
-static void ms_rotate( m_sort *m, int from, int mid, int to ) {
-	int n;
-	if( from==mid || mid==to ) return;
-	n = ms_gcd(to - from, mid - from);
-	while (n-- != 0) {
-		TSORT val = m->arr[from+n];
-		int shift = mid - from;
-		int p1 = from+n, p2=from+n+shift;
-		while (p2 != from + n) {
-			m->arr[p1] = m->arr[p2];
-			p1=p2;
-			if( to - p2 > shift) p2 += shift;
-			else p2=from + (shift - (to - p2));
+	while( i < n )
+		arr[k++] = tmp[i++];
+}
+
+static void pdq_sort3( m_sort *m, int a, int b, int c ) {
+	TSORT *arr = m->arr;
+	if( ms_compare(m,arr[b],arr[a]) < 0 ) ms_swap(m,a,b);
+	if( ms_compare(m,arr[c],arr[b]) < 0 ) ms_swap(m,b,c);
+	if( ms_compare(m,arr[b],arr[a]) < 0 ) ms_swap(m,a,b);
+}
+
+// insertion sort which gives up after moving too many values
+static bool pdq_partial_insert( m_sort *m, int begin, int end ) {
+	TSORT *arr = m->arr;
+	int limit = 0, cur;
+	for(cur=begin+1;cur<end;cur++) {
+		if( ms_compare(m,arr[cur],arr[cur-1]) < 0 ) {
+			TSORT v = arr[cur];
+			int j = cur;
+			do {
+				arr[j] = arr[j-1];
+				j--;
+			} while( j > begin && ms_compare(m,v,arr[j-1]) < 0 );
+			arr[j] = v;
+			limit += cur - j;
 		}
-		m->arr[p1] = val;
+		if( limit > PDQ_PARTIAL_LIMIT )
+			return false;
 	}
+	return true;
 }
-static void ms_do_merge( m_sort *m, int from, int pivot, int to, int len1, int len2 ) {
-	int first_cut, second_cut, len11, len22, new_mid;
-	if( len1 == 0 || len2==0 )
-		return;
-	if( len1+len2 == 2 ) {
-		if( ms_compare(m, pivot, from) < 0 )
-			ms_swap(m, pivot, from);
-   		return;
-  	}
-	if (len1 > len2) {
-		len11=len1>>1;
-		first_cut = from + len11;
-		second_cut = ms_lower(m, pivot, to, first_cut);
-		len22 = second_cut - pivot;
-	} else {
-		len22 = len2>>1;
-		second_cut = pivot + len22;
-		first_cut = ms_upper(m, from, pivot, second_cut);
-		len11=first_cut - from;
-	}
-	ms_rotate(m, first_cut, pivot, second_cut);
-	new_mid=first_cut+len22;
-	ms_do_merge(m, from, first_cut, new_mid, len11, len22);
-	ms_do_merge(m, new_mid, second_cut, to, len1 - len11, len2 - len22);
+
+// values < pivot go left of it : returns the pivot position
+static int pdq_partition_right( m_sort *m, int begin, int end, bool *partitioned ) {
+	TSORT *arr = m->arr;
+	TSORT pivot = arr[begin];
+	int first = begin, last = end, pos;
+	while( ++first < end && ms_compare(m,arr[first],pivot) < 0 ) {}
+	if( first - 1 == begin )
+		while( first < last && !(ms_compare(m,arr[--last],pivot) < 0) ) {}
+	else
+		while( --last > begin && !(ms_compare(m,arr[last],pivot) < 0) ) {}
+	*partitioned = first >= last;
+	while( first < last ) {
+		ms_swap(m,first,last);
+		while( ++first < end && ms_compare(m,arr[first],pivot) < 0 ) {}
+		while( --last > begin && !(ms_compare(m,arr[last],pivot) < 0) ) {}
+	}
+	pos = first - 1;
+	arr[begin] = arr[pos];
+	arr[pos] = pivot;
+	return pos;
 }
 
-static void merge_sort_rec( m_sort *m, int from, int to ) {
-	int middle;
-	if( to - from < 12 ) {
-		// insert sort
-		int i;
-		if( to <= from ) return;
-		for(i=from+1;i<to;i++) {
+// values <= pivot go left of it, used when many values are equal to the pivot
+static int pdq_partition_left( m_sort *m, int begin, int end ) {
+	TSORT *arr = m->arr;
+	TSORT pivot = arr[begin];
+	int first = begin, last = end;
+	while( --last > begin && ms_compare(m,pivot,arr[last]) < 0 ) {}
+	if( last + 1 == end )
+		while( first < last && !(ms_compare(m,pivot,arr[++first]) < 0) ) {}
+	else
+		while( ++first < end && !(ms_compare(m,pivot,arr[first]) < 0) ) {}
+	while( first < last ) {
+		ms_swap(m,first,last);
+		while( --last > begin && ms_compare(m,pivot,arr[last]) < 0 ) {}
+		while( ++first < end && !(ms_compare(m,pivot,arr[first]) < 0) ) {}
+	}
+	arr[begin] = arr[last];
+	arr[last] = pivot;
+	return last;
+}
+
+static void pdq_heap_sort( m_sort *m, int begin, int end ) {
+	TSORT *arr = m->arr + begin;
+	int n = end - begin, i;
+	for(i=n-1;i>=0;i--) {
+		int k = i;
+		while( true ) {
+			int c = k * 2 + 1;
+			if( c >= n ) break;
+			if( c + 1 < n && ms_compare(m,arr[c],arr[c+1]) < 0 ) c++;
+			if( !(ms_compare(m,arr[k],arr[c]) < 0) ) break;
+			ms_swap(m,begin + k,begin + c);
+			k = c;
+		}
+	}
+	for(i=n-1;i>0;i--) {
+		int k = 0;
+		ms_swap(m,begin,begin + i);
+		while( true ) {
+			int c = k * 2 + 1;
+			if( c >= i ) break;
+			if( c + 1 < i && ms_compare(m,arr[c],arr[c+1]) < 0 ) c++;
+			if( !(ms_compare(m,arr[k],arr[c]) < 0) ) break;
+			ms_swap(m,begin + k,begin + c);
+			k = c;
+		}
+	}
+}
+
+static void pdq_loop( m_sort *m, int begin, int end, int bad_allowed, bool leftmost ) {
+	TSORT *arr = m->arr;
+	while( true ) {
+		int size = end - begin, s2 = size >> 1, pos, l_size, r_size;
+		bool already_partitioned;
+		if( size < PDQ_INSERT ) {
+			ms_insert_sort(m,begin,end);
+			return;
+		}
+		// pivot is the median of 3, or the pseudo median of 9, moved to begin
+		if( size > PDQ_NINTHER ) {
+			pdq_sort3(m,begin,begin + s2,end - 1);
+			pdq_sort3(m,begin + 1,begin + s2 - 1,end - 2);
+			pdq_sort3(m,begin + 2,begin + s2 + 1,end - 3);
+			pdq_sort3(m,begin + s2 - 1,begin + s2,begin + s2 + 1);
+			ms_swap(m,begin,begin + s2);
+		} else
+			pdq_sort3(m,begin + s2,begin,end - 1);
+		// the value before this range is a pivot from a previous step : if it
+		// is equal to ours, skip all the values equal to it at once
+		if( !leftmost && !(ms_compare(m,arr[begin-1],arr[begin]) < 0) ) {
+			begin = pdq_partition_left(m,begin,end) + 1;
+			continue;
+		}
+		pos = pdq_partition_right(m,begin,end,&already_partitioned);
+		l_size = pos - begin;
+		r_size = end - (pos + 1);
+		if( l_size < (size >> 3) || r_size < (size >> 3) ) {
+			// bad partition : shuffle some values, fall back to heap sort if it keeps happening
+			if( --bad_allowed == 0 ) {
+				pdq_heap_sort(m,begin,end);
+				return;
+			}
+			if( l_size >= PDQ_INSERT ) {
+				ms_swap(m,begin,begin + l_size / 4);
+				ms_swap(m,pos - 1,pos - l_size / 4);
+				if( l_size > PDQ_NINTHER ) {
+					ms_swap(m,begin + 1,begin + l_size / 4 + 1);
+					ms_swap(m,begin + 2,begin + l_size / 4 + 2);
+					ms_swap(m,pos - 2,pos - (l_size / 4 + 1));
+					ms_swap(m,pos - 3,pos - (l_size / 4 + 2));
+				}
+			}
+			if( r_size >= PDQ_INSERT ) {
+				ms_swap(m,pos + 1,pos + 1 + r_size / 4);
+				ms_swap(m,end - 1,end - r_size / 4);
+				if( r_size > PDQ_NINTHER ) {
+					ms_swap(m,pos + 2,pos + 2 + r_size / 4);
+					ms_swap(m,pos + 3,pos + 3 + r_size / 4);
+					ms_swap(m,end - 2,end - (1 + r_size / 4));
+					ms_swap(m,end - 3,end - (2 + r_size / 4));
+				}
+			}
+		} else if( already_partitioned && pdq_partial_insert(m,begin,pos) && pdq_partial_insert(m,pos + 1,end) )
+			return;
+		pdq_loop(m,begin,pos,bad_allowed,leftmost);
+		begin = pos + 1;
+		leftmost = false;
+	}
+}
+
+static void pdq_sort( m_sort *m, int len ) {
+	int bad_allowed = 0;
+	while( (1 << bad_allowed) <= len && bad_allowed < 31 ) bad_allowed++;
+	pdq_loop(m,0,len,bad_allowed,true);
+}
+
+static void radix_sort( TSORT *arr, TSORT *tmp, int len, bool desc ) {
+	int counts[sizeof(TKEY)][256];
+	TKEY flip = desc ? ~(TKEY)0 : 0;
+	TKEY first;
+	TSORT *src = arr, *dst = tmp;
+	int i, d;
+	if( len < 2 ) return;
+	memset(counts,0,sizeof(counts));
+	for(i=0;i<len;i++) {
+		TKEY k = TKEY_OF(arr[i]) ^ flip;
+		for(d=0;d<(int)sizeof(TKEY);d++)
+			counts[d][(k >> (d << 3)) & 0xFF]++;
+	}
+	first = TKEY_OF(arr[0]) ^ flip;
+	for(d=0;d<(int)sizeof(TKEY);d++) {
+		int *c = counts[d];
+		int shift = d << 3, sum = 0;
+		TSORT *t;
+		// all values have the same digit
+		if( c[(first >> shift) & 0xFF] == len ) continue;
+		for(i=0;i<256;i++) {
+			int n = c[i];
+			c[i] = sum;
+			sum += n;
+		}
+		for(i=0;i<len;i++) {
+			TSORT v = src[i];
+			dst[c[((TKEY_OF(v) ^ flip) >> shift) & 0xFF]++] = v;
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
+	if( src != arr ) memcpy(arr,src,len * sizeof(TSORT));
+}
+
+static void radix_merge( TSORT *a, int na, TSORT *b, int nb, TSORT *out, bool desc ) {
+	TKEY flip = desc ? ~(TKEY)0 : 0;
+	TSORT *ea = a + na, *eb = b + nb;
+	while( a < ea && b < eb ) {
+		if( (TKEY_OF(*b) ^ flip) < (TKEY_OF(*a) ^ flip) )
+			*out++ = *b++;
+		else
+			*out++ = *a++;
+	}
+	while( a < ea ) *out++ = *a++;
+	while( b < eb ) *out++ = *b++;
+}
+
+typedef struct {
+	TSORT *arr;
+	TSORT *tmp;
+	int len;
+	int len2;
+	bool desc;
+} sort_task;
+
+static void sort_task_radix( void *p ) {
+	sort_task *t = (sort_task*)p;
+	radix_sort(t->arr,t->tmp,t->len,t->desc);
+}
+
+// merges arr[0..len] with arr[len..len+len2] into tmp
+static void sort_task_merge( void *p ) {
+	sort_task *t = (sort_task*)p;
+	radix_merge(t->arr,t->len,t->arr + t->len,t->len2,t->tmp,t->desc);
+}
+
+static void native_sort( TSORT *arr, int len, bool desc, int threads ) {
+	sort_task tasks[SORT_MAX_THREADS];
+	int starts[SORT_MAX_THREADS + 1];
+	sort_pool pool;
+	TSORT *tmp, *src, *dst;
+	int i, nruns, width;
+	if( len < NATIVE_INSERT ) {
+		TKEY flip = desc ? ~(TKEY)0 : 0;
+		for(i=1;i<len;i++) {
+			TSORT v = arr[i];
+			TKEY k = TKEY_OF(v) ^ flip;
 			int j = i;
-			while( j > from ) {
-				if( ms_compare(m,j,j-1) < 0 )
-					ms_swap(m,j-1,j);
-		    	else
-		    		break;
-			    j--;
+			while( j > 0 && k < (TKEY_OF(arr[j-1]) ^ flip) ) {
+				arr[j] = arr[j-1];
+				j--;
 			}
-   		}
+			arr[j] = v;
+		}
 		return;
 	}
-	middle = (from + to)>>1;
-	merge_sort_rec(m, from, middle);
-	merge_sort_rec(m, middle, to);
-	ms_do_merge(m, from, middle, to, middle-from, to - middle);
+	{
+		// already ordered input is common and costs a full radix pass otherwise
+		TKEY flip = desc ? ~(TKEY)0 : 0;
+		TKEY prev = TKEY_OF(arr[0]) ^ flip;
+		for(i=1;i<len;i++) {
+			TKEY k = TKEY_OF(arr[i]) ^ flip;
+			if( k < prev ) break;
+			prev = k;
+		}
+		if( i == len ) return;
+	}
+	tmp = (TSORT*)hl_gc_alloc_noptr(len * sizeof(TSORT));
+	if( threads > SORT_MAX_THREADS ) threads = SORT_MAX_THREADS;
+	if( threads <= 1 || len < SORT_PARALLEL_MIN ) {
+		radix_sort(arr,tmp,len,desc);
+		return;
+	}
+	nruns = threads;
+	for(i=0;i<=nruns;i++)
+		starts[i] = (int)(((int64)len * i) / nruns);
+	for(i=0;i<nruns;i++) {
+		sort_task *t = tasks + i;
+		t->arr = arr + starts[i];
+		t->tmp = tmp + starts[i];
+		t->len = starts[i+1] - starts[i];
+		t->len2 = 0;
+		t->desc = desc;
+	}
+	sort_pool_start(&pool,nruns);
+	sort_pool_run(&pool,sort_task_radix,tasks,sizeof(sort_task),nruns);
+	// merge runs two by two, back and forth between arr and tmp
+	src = arr;
+	dst = tmp;
+	for(width=1;width<nruns;width<<=1) {
+		int n = 0;
+		for(i=0;i<nruns;i+=width<<1) {
+			int mid = i + width > nruns ? nruns : i + width;
+			int end = i + (width << 1) > nruns ? nruns : i + (width << 1);
+			sort_task *t = tasks + n++;
+			t->arr = src + starts[i];
+			t->tmp = dst + starts[i];
+			t->len = starts[mid] - starts[i];
+			t->len2 = starts[end] - starts[mid];
+		}
+		sort_pool_run(&pool,sort_task_merge,tasks,sizeof(sort_task),n);
+		src = dst;
+		dst = src == arr ? tmp : arr;
+	}
+	sort_pool_stop(&pool);
+	if( src != arr ) memcpy(arr,src,len * sizeof(TSORT));
 }
 
 #undef ms_compare
 #undef ms_swap
-#undef ms_lower
-#undef ms_upper
-#undef ms_rotate
-#undef ms_do_merge
+#undef ms_insert_sort
 #undef merge_sort_rec
+#undef pdq_sort3
+#undef pdq_partial_insert
+#undef pdq_partition_right
+#undef pdq_partition_left
+#undef pdq_heap_sort
+#undef pdq_loop
+#undef pdq_sort
+#undef radix_sort
+#undef radix_merge
+#undef sort_task
+#undef sort_task_radix
+#undef sort_task_merge
+#undef native_sort
 #undef m_sort
 #undef TSORT
+#undef TKEY
+#undef TKEY_OF
 #undef TID
@@ -21,38 +21,389 @@
  */
 #include <hl.h>
 
+/*
+	Shortest round-trip double formatting, following Ulf Adams' Ryu
+	(https://github.com/ulfjack/ryu). The 128-bit powers of 5 are rebuilt
+	from one base every 26 exponents, with a 2-bit correction per entry.
+*/
+
+#include "pow5.h"
+
+#define POW5_BITCOUNT		125
+#define POW5_INV_BITCOUNT	125
+
+static const uint64 POW5_SPLIT[13][2] = {
+	{ 0ULL, 1152921504606846976ULL },
+	{ 0ULL, 1490116119384765625ULL },
+	{ 1032610780636961552ULL, 1925929944387235853ULL },
+	{ 7910200175544436838ULL, 1244603055572228341ULL },
+	{ 16941905809032713930ULL, 1608611746708759036ULL },
+	{ 13024893955298202172ULL, 2079081953128979843ULL },
+	{ 6607496772837067824ULL, 1343575221513417750ULL },
+	{ 17332926989895652603ULL, 1736530273035216783ULL },
+	{ 13037379183483547984ULL, 2244412773384604712ULL },
+	{ 1605989338741628675ULL, 1450417759929778918ULL },
+	{ 9630225068416591280ULL, 1874621017369538693ULL },
+	{ 665883850346957067ULL, 1211445438634777304ULL },
+	{ 14931890668723713708ULL, 1565756531257009982ULL }
+};
+
+static const unsigned int POW5_OFFSETS[21] = {
+	0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x40000000, 0x59695995,
+	0x55545555, 0x56555515, 0x41150504, 0x40555410, 0x44555145, 0x44504540,
+	0x45555550, 0x40004000, 0x96440440, 0x55565565, 0x54454045, 0x40154151,
+	0x55559155, 0x51405555, 0x00000105
+};
+
+static const uint64 POW5_INV_SPLIT[15][2] = {
+	{ 1ULL, 2305843009213693952ULL },
+	{ 5955668970331000884ULL, 1784059615882449851ULL },
+	{ 8982663654677661702ULL, 1380349269358112757ULL },
+	{ 7286864317269821294ULL, 2135987035920910082ULL },
+	{ 7005857020398200553ULL, 1652639921975621497ULL },
+	{ 17965325103354776697ULL, 1278668206209430417ULL },
+	{ 8928596168509315048ULL, 1978643211784836272ULL },
+	{ 10075671573058298858ULL, 1530901034580419511ULL },
+	{ 597001226353042382ULL, 1184477304306571148ULL },
+	{ 1527430471115325346ULL, 1832889850782397517ULL },
+	{ 12533209867169019542ULL, 1418129833677084982ULL },
+	{ 5577825024675947042ULL, 2194449627517475473ULL },
+	{ 11006974540203867551ULL, 1697873161311732311ULL },
+	{ 10313493231639821582ULL, 1313665730009899186ULL },
+	{ 12701016819766672773ULL, 2032799256770390445ULL }
+};
+
+static const unsigned int POW5_INV_OFFSETS[22] = {
+	0x54544554, 0x04055545, 0x10041000, 0x00400414, 0x40010000, 0x41155555,
+	0x00000454, 0x00010044, 0x40000000, 0x44000041, 0x50454450, 0x55550054,
+	0x51655554, 0x40004000, 0x01000001, 0x00010500, 0x51515411, 0x05555554,
+	0x50411500, 0x40040000, 0x05040110, 0x00000000
+};
+
+static const char DIGITS_100[200] = {
+	'0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+	'1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+	'2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+	'3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+	'4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+	'5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+	'6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+	'7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+	'8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+	'9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9'
+};
+
+// 0 < dist < 64
+static inline uint64 shiftright128( uint64 lo, uint64 hi, int dist ) {
+	return (hi << (64 - dist)) | (lo >> dist);
+}
+
+// ceil(log2(5^e)), exact for 0 <= e <= 3528
+static inline int pow5bits( int e ) {
+	return (int)(((unsigned int)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e)) and floor(log10(5^e)), exact for 0 <= e <= 1650
+static inline int log10pow2( int e ) {
+	return (int)(((unsigned int)e * 78913) >> 18);
+}
+
+static inline int log10pow5( int e ) {
+	return (int)(((unsigned int)e * 732923) >> 20);
+}
+
+static void compute_pow5( int i, uint64 *result ) {
+	int base = i / POW5_TABLE_SIZE;
+	int base2 = base * POW5_TABLE_SIZE;
+	int offset = i - base2;
+	const uint64 *mul = POW5_SPLIT[base];
+	uint64 m, low0, high0, low1, high1, sum;
+	int delta;
+	if( offset == 0 ) {
+		result[0] = mul[0];
+		result[1] = mul[1];
+		return;
+	}
+	m = POW5_TABLE[offset];
+	low1 = umul128(m, mul[1], &high1);
+	low0 = umul128(m, mul[0], &high0);
+	sum = high0 + low1;
+	if( sum < high0 ) high1++;
+	delta = pow5bits(i) - pow5bits(base2);
+	result[0] = shiftright128(low0, sum, delta) + ((POW5_OFFSETS[i >> 4] >> ((i & 15) << 1)) & 3);
+	result[1] = shiftright128(sum, high1, delta);
+}
+
+static void compute_inv_pow5( int i, uint64 *result ) {
+	int base = (i + POW5_TABLE_SIZE - 1) / POW5_TABLE_SIZE;
+	int base2 = base * POW5_TABLE_SIZE;
+	int offset = base2 - i;
+	const uint64 *mul = POW5_INV_SPLIT[base];
+	uint64 m, low0, high0, low1, high1, sum;
+	int delta;
+	if( offset == 0 ) {
+		result[0] = mul[0];
+		result[1] = mul[1];
+		return;
+	}
+	m = POW5_TABLE[offset];
+	low1 = umul128(m, mul[1], &high1);
+	low0 = umul128(m, mul[0] - 1, &high0);
+	sum = high0 + low1;
+	if( sum < high0 ) high1++;
+	delta = pow5bits(base2) - pow5bits(i);
+	result[0] = shiftright128(low0, sum, delta) + 1 + ((POW5_INV_OFFSETS[i >> 4] >> ((i & 15) << 1)) & 3);
+	result[1] = shiftright128(sum, high1, delta);
+}
+
+static inline bool multiple_of_pow5( uint64 v, int p ) {
+	int count = 0;
+	while( v % 5 == 0 ) {
+		v /= 5;
+		count++;
+	}
+	return count >= p;
+}
+
+// 64 < j < 128
+static inline uint64 mul_shift64( uint64 m, const uint64 *mul, int j ) {
+	uint64 high0, high1, sum;
+	uint64 low1 = umul128(m, mul[1], &high1);
+	umul128(m, mul[0], &high0);
+	sum = high0 + low1;
+	if( sum < high0 ) high1++;
+	return shiftright128(sum, high1, j - 64);
+}
+
+static inline int decimal_length17( uint64 v ) {
+	int n = 1;
+	while( v >= 10000 ) {
+		v /= 10000;
+		n += 4;
+	}
+	if( v >= 10 ) n++;
+	if( v >= 100 ) n++;
+	if( v >= 1000 ) n++;
+	return n;
+}
+
+/*
+	Returns the shortest decimal digits that parse back to the double given
+	by its raw ieee mantissa and (non zero, non max) exponent, as
+	digits * 10^exponent.
+*/
+static uint64 ryu_shortest( uint64 ieee_mantissa, int ieee_exponent, int *exponent ) {
+	int e2, e10, removed = 0, q;
+	uint64 m2, mv, vr, vp, vm, pow[2], output;
+	bool even, mm_shift, vm_zeros = false, vr_zeros = false;
+	int last_removed = 0;
+	if( ieee_exponent == 0 ) {
+		e2 = 1 - 1023 - 52 - 2;
+		m2 = ieee_mantissa;
+	} else {
+		e2 = ieee_exponent - 1023 - 52 - 2;
+		m2 = (1ULL << 52) | ieee_mantissa;
+	}
+	even = (m2 & 1) == 0;
+	mv = 4 * m2;
+	mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+	if( e2 >= 0 ) {
+		int k, i;
+		q = log10pow2(e2) - (e2 > 3);
+		e10 = q;
+		k = POW5_INV_BITCOUNT + pow5bits(q) - 1;
+		i = -e2 + q + k;
+		compute_inv_pow5(q, pow);
+		vr = mul_shift64(4 * m2, pow, i);
+		vp = mul_shift64(4 * m2 + 2, pow, i);
+		vm = mul_shift64(4 * m2 - 1 - mm_shift, pow, i);
+		if( q <= 21 ) {
+			// only one of mp, mv, and mm can be a multiple of 5, if any
+			if( mv % 5 == 0 )
+				vr_zeros = multiple_of_pow5(mv, q);
+			else if( even )
+				vm_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+			else
+				vp -= multiple_of_pow5(mv + 2, q);
+		}
+	} else {
+		int i, k, j;
+		q = log10pow5(-e2) - (-e2 > 1);
+		e10 = q + e2;
+		i = -e2 - q;
+		k = pow5bits(i) - POW5_BITCOUNT;
+		j = q - k;
+		compute_pow5(i, pow);
+		vr = mul_shift64(4 * m2, pow, j);
+		vp = mul_shift64(4 * m2 + 2, pow, j);
+		vm = mul_shift64(4 * m2 - 1 - mm_shift, pow, j);
+		if( q <= 1 ) {
+			// mv has at least q trailing 0 bits
+			vr_zeros = true;
+			if( even )
+				vm_zeros = mm_shift;
+			else
+				vp--;
+		} else if( q < 63 )
+			vr_zeros = (mv & ((1ULL << q) - 1)) == 0;
+	}
+	if( vm_zeros || vr_zeros ) {
+		// rare : exact boundaries need the whole digit history
+		while( vp / 10 > vm / 10 ) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last_removed == 0;
+			last_removed = (int)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if( vm_zeros ) {
+			while( vm % 10 == 0 ) {
+				vr_zeros &= last_removed == 0;
+				last_removed = (int)(vr % 10);
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		}
+		// round to even on an exact tie
+		if( vr_zeros && last_removed == 5 && (vr & 1) == 0 )
+			last_removed = 4;
+		output = vr + ((vr == vm && (!even || !vm_zeros)) || last_removed >= 5);
+	} else {
+		bool round_up = false;
+		if( vp / 100 > vm / 100 ) {
+			round_up = vr % 100 >= 50;
+			vr /= 100;
+			vp /= 100;
+			vm /= 100;
+			removed += 2;
+		}
+		while( vp / 10 > vm / 10 ) {
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || round_up);
+	}
+	*exponent = e10 + removed;
+	return output;
+}
+
+static int write_uint( uchar *out, unsigned int v ) {
+	int len = 1, i;
+	unsigned int t = v;
+	while( t >= 10 ) {
+		t /= 10;
+		len++;
+	}
+	i = len;
+	while( v >= 100 ) {
+		int d = (v % 100) << 1;
+		v /= 100;
+		out[--i] = DIGITS_100[d + 1];
+		out[--i] = DIGITS_100[d];
+	}
+	if( v >= 10 ) {
+		out[--i] = DIGITS_100[(v << 1) + 1];
+		out[--i] = DIGITS_100[v << 1];
+	} else
+		out[--i] = (uchar)('0' + v);
+	return len;
+}
+
+/*
+	Writes the decimal representation of i into out (at least 12 chars),
+	without a terminating zero, and returns its length.
+*/
+HL_PRIM int hl_itoa( int i, uchar *out ) {
+	if( i < 0 ) {
+		*out = '-';
+		return write_uint(out + 1, 0u - (unsigned int)i) + 1;
+	}
+	return write_uint(out, (unsigned int)i);
+}
+
+/*
+	Writes the shortest representation of d that parses back to the same
+	value into out (at least 32 chars) and returns its length. The layout
+	is the one of printf("%.15g") : exponent form below 1e-4 and from 1e15.
+*/
+HL_PRIM int hl_dtoa( double d, uchar *out ) {
+	union { double d; uint64 i; } u;
+	uint64 mantissa, digits;
+	int exponent, ndigits, sci, pos = 0, i;
+	uchar tmp[17];
+	u.d = d;
+	mantissa = u.i & ((1ULL << 52) - 1);
+	exponent = (int)((u.i >> 52) & 0x7FF);
+	if( exponent == 0x7FF ) {
+		if( mantissa ) {
+			out[0] = 'N'; out[1] = 'a'; out[2] = 'N';
+			return 3;
+		}
+		if( u.i >> 63 ) out[pos++] = '-';
+		out[pos++] = 'i'; out[pos++] = 'n'; out[pos++] = 'f';
+		return pos;
+	}
+	if( u.i >> 63 ) out[pos++] = '-';
+	if( exponent == 0 && mantissa == 0 ) {
+		out[pos++] = '0';
+		return pos;
+	}
+	digits = ryu_shortest(mantissa, exponent, &exponent);
+	ndigits = decimal_length17(digits);
+	for(i=ndigits-1;i>=0;i--) {
+		tmp[i] = (uchar)('0' + digits % 10);
+		digits /= 10;
+	}
+	sci = exponent + ndigits - 1;
+	if( sci < -4 || sci >= 15 ) {
+		out[pos++] = tmp[0];
+		if( ndigits > 1 ) {
+			out[pos++] = '.';
+			for(i=1;i<ndigits;i++)
+				out[pos++] = tmp[i];
+		}
+		out[pos++] = 'e';
+		out[pos++] = sci < 0 ? '-' : '+';
+		if( sci < 0 ) sci = -sci;
+		if( sci < 10 ) out[pos++] = '0';
+		pos += write_uint(out + pos, (unsigned int)sci);
+	} else if( sci < 0 ) {
+		out[pos++] = '0';
+		out[pos++] = '.';
+		for(i=-1;i>sci;i--)
+			out[pos++] = '0';
+		for(i=0;i<ndigits;i++)
+			out[pos++] = tmp[i];
+	} else {
+		for(i=0;i<ndigits;i++) {
+			if( i == sci + 1 ) out[pos++] = '.';
+			out[pos++] = tmp[i];
+		}
+		for(i=ndigits;i<=sci;i++)
+			out[pos++] = '0';
+	}
+	return pos;
+}
+
 HL_PRIM vbyte *hl_itos( int i, int *len ) {
-	uchar tmp[24];
-	int k = (int)usprintf(tmp,24,USTR("%d"),i);
+	uchar tmp[12];
+	int k = hl_itoa(i,tmp);
+	tmp[k] = 0;
 	*len = k;
-	return hl_copy_bytes((vbyte*)tmp,(k + 1)<<1);
+	return hl_copy_bytes((vbyte*)tmp,(k + 1) << 1);
 }
 
 HL_PRIM vbyte *hl_ftos( double d, int *len ) {
-	uchar tmp[24];
-	int k;
-	if( d != d ) {
-		*len = 3;
-		return hl_copy_bytes((vbyte*)USTR("NaN"),8);
-	}
-	// don't use the last digit (eg 5.1 = 5.09999..996)
-	// also cut one more digit for some numbers (eg 86.57 and 85.18) <- to fix since we lose one PI digit
-	k = (int)usprintf(tmp,24,USTR("%.15g"),d);
-#	if defined(HL_WIN) && _MSC_VER <= 1800
-	// fix for window : 1e-5 is printed as 1e-005 whereas it's 1e-05 on other platforms
-	// note : this is VS2013 std bug, VS2015 works correctly
-	{
-		int i;
-		for(i=0;i<k;i++)
-			if( tmp[i] == 'e' ) {
-				if( tmp[i+1] == '+' || tmp[i+1] == '-' ) i++;
-				if( tmp[i+1] != '0' || tmp[i+2] != '0' ) break;
-				memmove(tmp+i+1,tmp+i+2,(k-(i+1))*2);
-				k--;
-				break;
-			}
-	}
-#	endif
+	uchar tmp[32];
+	int k = hl_dtoa(d,tmp);
+	tmp[k] = 0;
 	*len = k;
 	return hl_copy_bytes((vbyte*)tmp,(k + 1) << 1);
 }
@@ -80,6 +431,130 @@ HL_PRIM int hl_ucs2length( vbyte *str, int pos ) {
 	return (int)ustrlen((uchar*)(str + pos));
 }
 
+/*
+	Vector helpers for the UTF-8/UTF-16 conversions. They only consume plain
+	ASCII (or, when counting, non surrogate UTF-16), which every conversion
+	handles one char at a time the same way, so invalid sequences still go
+	through the scalar code below. Null terminated input
+	is only read by aligned blocks, which never cross a page boundary.
+*/
+
+#ifdef HL_SSE2
+#	include <emmintrin.h>
+#	define U_ALIGN		15
+#else
+#	define U_ALIGN		7
+#endif
+#define U_ASCII_MASK	0x8080808080808080ULL
+#define U_ONES			0x0101010101010101ULL
+
+#ifdef HL_SSE2
+static inline int popcount16( unsigned int v ) {
+	v = v - ((v >> 1) & 0x5555);
+	v = (v & 0x3333) + ((v >> 2) & 0x3333);
+	v = (v + (v >> 4)) & 0x0F0F;
+	return (v + (v >> 8)) & 0x1F;
+}
+#endif
+
+// copies the aligned blocks of non zero ASCII bytes at str into out while room allows it,
+// may write a whole block past the returned count
+static inline int utf8_ascii_blocks( uchar *out, const unsigned char *str, int room ) {
+	int n = 0;
+#	ifdef HL_SSE2
+	__m128i zero = _mm_setzero_si128();
+	while( room - n >= 16 ) {
+		__m128i v = _mm_load_si128((const __m128i*)(str + n));
+		unsigned int stop = _mm_movemask_epi8(_mm_or_si128(v,_mm_cmpeq_epi8(v,zero)));
+		if( out ) {
+			_mm_storeu_si128((__m128i*)(out + n),_mm_unpacklo_epi8(v,zero));
+			_mm_storeu_si128((__m128i*)(out + n + 8),_mm_unpackhi_epi8(v,zero));
+		}
+		if( stop ) {
+			// keep the ASCII chars before the stop, the rest is rewritten
+			n += hl_ctz(stop);
+			break;
+		}
+		n += 16;
+	}
+#	else
+	while( room - n >= 8 ) {
+		uint64 v = *(const uint64*)(str + n);
+		int i;
+		// high bit set or zero byte
+		if( ((v - U_ONES) | v) & U_ASCII_MASK )
+			break;
+		if( out )
+			for(i=0;i<8;i++)
+				out[n + i] = str[n + i];
+		n += 8;
+	}
+#	endif
+	return n;
+}
+
+/*
+	Sizes the 8-char blocks at c as UTF-8 into *bytes, stopping before
+	surrogates, end or (if end is NULL) a zero. Returns the chars read.
+*/
+static inline int utf16_size_blocks( const uchar *c, const uchar *end, int *bytes ) {
+	int n = 0;
+#	ifdef HL_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i m80 = _mm_set1_epi16((short)0xFF80);
+	__m128i m800 = _mm_set1_epi16((short)0xF800);
+	__m128i surr = _mm_set1_epi16((short)0xD800);
+	int total = 0;
+	if( end == NULL && ((int_val)c & 15) != 0 )
+		return 0;
+	while( end == NULL || end - (c + n) >= 8 ) {
+		__m128i v = end ? _mm_loadu_si128((const __m128i*)(c + n)) : _mm_load_si128((const __m128i*)(c + n));
+		__m128i hi = _mm_and_si128(v,m800);
+		__m128i stop = _mm_cmpeq_epi16(hi,surr);
+		if( end == NULL ) stop = _mm_or_si128(stop,_mm_cmpeq_epi16(v,zero));
+		if( _mm_movemask_epi8(stop) )
+			break;
+		// 3 bytes per char, minus one below 0x800 and one more below 0x80
+		total += 24 - (popcount16(_mm_movemask_epi8(_mm_cmpeq_epi16(hi,zero))) >> 1) - (popcount16(_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v,m80),zero))) >> 1);
+		n += 8;
+	}
+	*bytes += total;
+#	endif
+	return n;
+}
+
+// where to try again after a block stopped at c
+static inline const uchar *utf16_next_probe( const uchar *c, const uchar *end ) {
+	if( end == NULL )
+		return (const uchar*)(((int_val)c + 16) & ~(int_val)15);
+	return c + 8;
+}
+
+/*
+	Writes the 8-char blocks of non zero ASCII at c as UTF-8, stopping
+	before end. Returns the chars written.
+*/
+static inline int utf16_ascii_blocks( vbyte *out, const uchar *c, const uchar *end ) {
+	int n = 0;
+#	ifdef HL_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i m80 = _mm_set1_epi16((short)0xFF80);
+	if( end == NULL && ((int_val)c & 15) != 0 )
+		return 0;
+	while( end == NULL || end - (c + n) >= 8 ) {
+		__m128i v = end ? _mm_loadu_si128((const __m128i*)(c + n)) : _mm_load_si128((const __m128i*)(c + n));
+		__m128i bad = _mm_cmpeq_epi16(_mm_and_si128(v,m80),zero);
+		bad = _mm_xor_si128(bad,_mm_set1_epi16(-1));
+		if( end == NULL ) bad = _mm_or_si128(bad,_mm_cmpeq_epi16(v,zero));
+		if( _mm_movemask_epi8(bad) )
+			break;
+		_mm_storel_epi64((__m128i*)(out + n),_mm_packus_epi16(v,v));
+		n += 8;
+	}
+#	endif
+	return n;
+}
+
 HL_PRIM int hl_utf8_length( const vbyte *s, int pos ) {
 	int len = 0;
 	s += pos;
@@ -92,6 +567,11 @@ HL_PRIM int hl_utf8_length( const vbyte *s, int pos ) {
 				break;
 			}
 			s++;
+			if( ((int_val)s & U_ALIGN) == 0 ) {
+				int n = utf8_ascii_blocks(NULL,s,0x7FFFFFFF);
+				len += n;
+				s += n;
+			}
 		} else if( c < 0xC0 )
 			return len - 1;
 		else if( c < 0xE0 ) {
@@ -113,7 +593,14 @@ HL_PRIM int hl_utf8_length( const vbyte *s, int pos ) {
 HL_PRIM int hl_from_utf8( uchar *out, int outLen, const char *str ) {
 	int p = 0;
 	unsigned int c, c2, c3;
-	while( p++ < outLen ) {
+	while( true ) {
+		if( ((int_val)str & U_ALIGN) == 0 && (unsigned char)*str < 0x80 ) {
+			int n = utf8_ascii_blocks(out,(unsigned char*)str,outLen - p);
+			out += n;
+			str += n;
+			p += n;
+		}
+		if( p++ >= outLen ) break;
 		c = *(unsigned char *)str++;
 		if( c < 0x80 ) {
 			if( c == 0 ) break;
@@ -156,42 +643,117 @@ HL_PRIM vbyte* hl_utf8_to_utf16( vbyte *str, int pos, int *size ) {
 
 #include "unicase.h"
 
-HL_PRIM vbyte* hl_ucs2_upper( vbyte *str, int pos, int len ) {
-	uchar *cstr = (uchar*)(str + pos);
+/*
+	Case mapping goes through the unicase.h tables one char at a time, except
+	for runs of 8 ASCII chars which are mapped together by flipping the 0x20
+	bit of the letters in range. Once a block holds a non-ASCII char, the
+	next 8 chars are left to the tables before probing again.
+*/
+
+#define UL_MASK		((1 << UL_BITS) - 1)
+
+#ifdef HL_SSE2
+static inline __m128i ucs2_ascii_case( __m128i v, int upper ) {
+	__m128i lo = _mm_set1_epi16(upper ? 'a' - 1 : 'A' - 1);
+	__m128i hi = _mm_set1_epi16(upper ? 'z' + 1 : 'Z' + 1);
+	__m128i range = _mm_and_si128(_mm_cmpgt_epi16(v,lo),_mm_cmplt_epi16(v,hi));
+	return _mm_xor_si128(v,_mm_and_si128(range,_mm_set1_epi16(0x20)));
+}
+
+static inline bool ucs2_is_ascii( __m128i v ) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v,_mm_set1_epi16((short)0xFF80)),_mm_setzero_si128())) == 0xFFFF;
+}
+#endif
+
+static int ucs2_ascii_case_blocks( uchar *out, const uchar *s, int len, int upper ) {
+	int n = 0;
+#	ifdef HL_SSE2
+	while( len - n >= 8 ) {
+		__m128i v = _mm_loadu_si128((__m128i*)(s + n));
+		if( !ucs2_is_ascii(v) ) break;
+		_mm_storeu_si128((__m128i*)(out + n),ucs2_ascii_case(v,upper));
+		n += 8;
+	}
+#	endif
+	return n;
+}
+
+static vbyte *ucs2_case( vbyte *str, int pos, int len, int upper ) {
+	const uchar *cstr = (uchar*)(str + pos);
 	uchar *out = (uchar*)hl_gc_alloc_noptr((len + 1) * sizeof(uchar));
-	int i;
-	uchar *cout = out;
-	memcpy(out,cstr,len << 1);
-	for(i=0;i<len;i++) {
-		unsigned int c = *cstr++;
-		int up = c >> UL_BITS;
-		if( up < UMAX ) {
-			unsigned int c2 = UPPER[up][c&((1<<UL_BITS)-1)];
-			if( c2 != 0 ) *cout = (uchar)c2;
+	int max = upper ? UMAX : LMAX;
+	int i = 0, probe = 0;
+	while( i < len ) {
+		unsigned int c;
+		int up;
+		if( i >= probe ) {
+			i += ucs2_ascii_case_blocks(out + i, cstr + i, len - i, upper);
+			probe = i + 8;
+			if( i == len ) break;
+		}
+		c = cstr[i];
+		up = c >> UL_BITS;
+		if( up < max ) {
+			unsigned int c2 = upper ? UPPER[up][c&UL_MASK] : LOWER[up][c&UL_MASK];
+			if( c2 != 0 ) c = c2;
 		}
-		cout++;
+		out[i++] = (uchar)c;
 	}
-	*cout = 0;
+	out[len] = 0;
 	return (vbyte*)out;
 }
 
+HL_PRIM vbyte* hl_ucs2_upper( vbyte *str, int pos, int len ) {
+	return ucs2_case(str,pos,len,1);
+}
+
 HL_PRIM vbyte* hl_ucs2_lower( vbyte *str, int pos, int len ) {
-	uchar *cstr = (uchar*)(str + pos);
-	uchar *out = (uchar*)hl_gc_alloc_noptr((len + 1) * sizeof(uchar));
-	uchar *cout = out;
-	int i;
-	memcpy(out,cstr,len << 1);
-	for(i=0;i<len;i++) {
-		unsigned int c = *cstr++;
-		int up = c >> UL_BITS;
-		if( up < LMAX ) {
-			unsigned int c2 = LOWER[up][c&((1<<UL_BITS)-1)];
-			if( c2 != 0 ) *cout = (uchar)c2;
+	return ucs2_case(str,pos,len,0);
+}
+
+static inline int ucs2_fold( unsigned int c ) {
+	int up = c >> UL_BITS;
+	if( up < LMAX ) {
+		unsigned int c2 = LOWER[up][c&UL_MASK];
+		if( c2 != 0 ) return c2;
+	}
+	return c;
+}
+
+/*
+	Compares len chars of a and b after mapping both through the lower case
+	table, without allocating. Returns the difference of the first unequal
+	pair of lowered chars, or 0.
+*/
+HL_PRIM int hl_ucs2_icompare( vbyte *a, int apos, vbyte *b, int bpos, int len ) {
+	const uchar *s1 = (uchar*)(a + apos);
+	const uchar *s2 = (uchar*)(b + bpos);
+	int i = 0;
+#	ifdef HL_SSE2
+	while( len - i >= 8 ) {
+		__m128i v1 = _mm_loadu_si128((__m128i*)(s1 + i));
+		__m128i v2 = _mm_loadu_si128((__m128i*)(s2 + i));
+		int k;
+		if( ucs2_is_ascii(_mm_or_si128(v1,v2)) ) {
+			unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(ucs2_ascii_case(v1,0),ucs2_ascii_case(v2,0))) ^ 0xFFFF;
+			if( mask == 0 ) {
+				i += 8;
+				continue;
+			}
+			i += hl_ctz(mask) >> 1;
+			return ucs2_fold(s1[i]) - ucs2_fold(s2[i]);
+		}
+		for(k=0;k<8;k++,i++) {
+			int d = ucs2_fold(s1[i]) - ucs2_fold(s2[i]);
+			if( d ) return d;
 		}
-		cout++;
 	}
-	*cout = 0;
-	return (vbyte*)out;
+#	endif
+	for(;i<len;i++) {
+		int d = ucs2_fold(s1[i]) - ucs2_fold(s2[i]);
+		if( d ) return d;
+	}
+	return 0;
 }
 
 HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
@@ -199,9 +761,16 @@ HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
 	uchar *c = (uchar*)str;
 	uchar *end = len == 0 ? NULL : c + len;
 	int utf8bytes = 0;
+	const uchar *probe = c;
 	int p = 0;
 	while( c != end ) {
-		unsigned int v = (unsigned int)*c;
+		unsigned int v;
+		if( c >= probe ) {
+			c += utf16_size_blocks(c,end,&utf8bytes);
+			if( c == end ) break;
+			probe = utf16_next_probe(c,end);
+		}
+		v = (unsigned int)*c;
 		if( v == 0 && end == NULL ) break;
 		if( v < 0x80 )
 			utf8bytes++;
@@ -216,8 +785,17 @@ HL_PRIM vbyte *hl_utf16_to_utf8( vbyte *str, int len, int *size ) {
 	}
 	out = hl_gc_alloc_noptr(utf8bytes + 1);
 	c = (uchar*)str;
+	probe = c;
 	while( c != end ) {
-		unsigned int v = (unsigned int)*c;
+		unsigned int v;
+		if( c >= probe && *c < 0x80 ) {
+			int n = utf16_ascii_blocks(out + p,c,end);
+			c += n;
+			p += n;
+			if( c == end ) break;
+			probe = utf16_next_probe(c,end);
+		}
+		v = (unsigned int)*c;
 		if( v < 0x80 ) {
 			out[p++] = (vbyte)v;
 			if( v == 0 && end == NULL ) break;
@@ -370,14 +948,161 @@ HL_PRIM vbyte *hl_url_decode( vbyte *str, int *len ) {
 	return NULL;
 }
 
+/*
+	Interned strings are canonical UCS2 copies, so equal strings coming from
+	different places share the same bytes. They are kept in an open addressing
+	table allocated outside of the GC, which therefore does not keep them
+	alive : a GC weak hook drops the strings that were not marked and rebuilds
+	the table. The table is only modified with the lock held and without
+	allocating, so a GC can never see it half updated.
+*/
+
+typedef struct {
+	uchar *str;
+	int hash;
+	int len;
+} intern_entry;
+
+static intern_entry *intern_table = NULL;
+static int intern_mask = 0;
+static int intern_count = 0;
+static hl_mutex *intern_lock = NULL;
+
+#define INTERN_MIN_SIZE	256
+
+// same as hl_hash_gen, without the field names cache
+static int intern_hash( const uchar *s, int len ) {
+	int h = 0, i;
+	for(i=0;i<len;i++)
+		h = 223 * h + (unsigned)s[i];
+	h %= 0x1FFFFF7B;
+	return h;
+}
+
+static HL_INLINE int intern_slot( int hash ) {
+	unsigned int h = (unsigned int)hash * 0x9E3779B1;
+	return (int)(h ^ (h >> 15)) & intern_mask;
+}
+
+static uchar *intern_find( const uchar *s, int len, int hash ) {
+	int i = intern_slot(hash);
+	while( true ) {
+		intern_entry *e = intern_table + i;
+		if( !e->str ) return NULL;
+		if( e->hash == hash && e->len == len && memcmp(e->str,s,len << 1) == 0 ) return e->str;
+		i = (i + 1) & intern_mask;
+	}
+}
+
+static void intern_add( uchar *str, int len, int hash ) {
+	int i = intern_slot(hash);
+	while( intern_table[i].str )
+		i = (i + 1) & intern_mask;
+	intern_table[i].str = str;
+	intern_table[i].hash = hash;
+	intern_table[i].len = len;
+	intern_count++;
+}
+
+static void intern_rehash( int size ) {
+	intern_entry *old = intern_table;
+	int i, osize = old ? intern_mask + 1 : 0;
+	intern_table = (intern_entry*)malloc(sizeof(intern_entry) * size);
+	if( intern_table == NULL ) hl_fatal("out of memory");
+	memset(intern_table,0,sizeof(intern_entry) * size);
+	intern_mask = size - 1;
+	intern_count = 0;
+	for(i=0;i<osize;i++) {
+		intern_entry *e = old + i;
+		if( e->str ) intern_add(e->str,e->len,e->hash);
+	}
+	free(old);
+}
+
+static void intern_gc_hook() {
+	int i, live = 0, size = INTERN_MIN_SIZE;
+	for(i=0;i<=intern_mask;i++) {
+		intern_entry *e = intern_table + i;
+		if( !e->str ) continue;
+		if( hl_gc_is_marked(e->str) )
+			live++;
+		else
+			e->str = NULL;
+	}
+	if( live == intern_count )
+		return;
+	// removed entries break probe runs, so always rebuild
+	while( size < live * 2 )
+		size <<= 1;
+	intern_rehash(size);
+}
+
+void hl_intern_init() {
+#	ifdef HL_THREADS
+	hl_add_root(&intern_lock);
+#	endif
+	intern_lock = hl_mutex_alloc(true);
+	intern_rehash(INTERN_MIN_SIZE);
+	hl_gc_add_weak_hook(intern_gc_hook);
+}
+
+void hl_intern_free() {
+	free(intern_table);
+	intern_table = NULL;
+	intern_mask = intern_count = 0;
+	hl_mutex_free(intern_lock);
+	intern_lock = NULL;
+	hl_remove_root(&intern_lock);
+}
+
+static HL_INLINE void intern_acquire() {
+	if( !hl_mutex_try_acquire(intern_lock) ) hl_mutex_acquire(intern_lock);
+}
+
+/*
+	Returns the interned copy of str[0..len], null terminated. The optional
+	hash is the one hl_hash_gen returns for names without conflicts.
+*/
+HL_PRIM vbyte *hl_intern( const uchar *str, int len, int *hash ) {
+	int h = intern_hash(str,len);
+	uchar *s;
+	if( hash ) *hash = h;
+	intern_acquire();
+	s = intern_find(str,len,h);
+	hl_mutex_release(intern_lock);
+	if( s ) return (vbyte*)s;
+	// allocate outside of the lock, the GC might run
+	s = (uchar*)hl_gc_alloc_noptr((len + 1) << 1);
+	memcpy(s,str,len << 1);
+	s[len] = 0;
+	intern_acquire();
+	{
+		uchar *prev = intern_find(str,len,h);
+		if( prev )
+			s = prev;
+		else {
+			if( (intern_count + 1) * 2 > intern_mask + 1 ) intern_rehash((intern_mask + 1) << 1);
+			intern_add(s,len,h);
+		}
+	}
+	hl_mutex_release(intern_lock);
+	return (vbyte*)s;
+}
+
+HL_PRIM vbyte *hl_string_intern( vbyte *str, int len ) {
+	return hl_intern((uchar*)str,len,NULL);
+}
+
 DEFINE_PRIM(_BYTES,itos,_I32 _REF(_I32));
 DEFINE_PRIM(_BYTES,ftos,_F64 _REF(_I32));
 DEFINE_PRIM(_BYTES,value_to_string,_DYN _REF(_I32));
+DEFINE_PRIM(_BYTES,string_intern,_BYTES _I32);
 DEFINE_PRIM(_I32,ucs2length,_BYTES _I32);
 DEFINE_PRIM(_BYTES,utf8_to_utf16,_BYTES _I32 _REF(_I32));
 DEFINE_PRIM(_BYTES,utf16_to_utf8,_BYTES _I32 _REF(_I32));
 DEFINE_PRIM(_BYTES,ucs2_upper,_BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,ucs2_lower,_BYTES _I32 _I32);
+DEFINE_PRIM(_I32,ucs2_icompare,_BYTES _I32 _BYTES _I32 _I32);
 DEFINE_PRIM(_BYTES,url_encode,_BYTES _REF(_I32));
 DEFINE_PRIM(_BYTES,url_decode,_BYTES _REF(_I32));
 